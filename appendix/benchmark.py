@@ -0,0 +1,593 @@
+import os
+import os.path as osp
+import sys
+import glob
+import json
+import shutil
+import subprocess
+import tempfile
+import time
+from argparse import ArgumentParser
+
+import numpy as np
+import cv2
+
+
+# Benchmarks for waifu2x-caffe-cui.
+#
+#   memory:    peak memory usage against input image size for each model.
+#              The peak is taken from the "memory" counter in the --trace output.
+#   coldstart: Waifu2x::Init time for each model and each model loading path
+#              (protobin+caffemodel, prototxt+caffemodel, json) with cold and warm page cache.
+#              Parse, construction, weight-copy and write time are taken from the cNet::* trace events.
+#   threads:   wall time to process a folder of mixed-size images for each --workers/--threads combination.
+#              "no limit" (--threads 0) shows the oversubscription of OpenCV, BLAS and the workers.
+#              --numa 0,1 compares runs with and without NUMA node placement (use on multi-socket machines).
+#   adaptive:  time and quality trade-off of --tile_skip_threshold on an image with flat and detailed regions.
+#              PSNR is measured against the output with the threshold 0 (every tile through the network),
+#              the share of skipped tiles is taken from the --metrics_file output.
+#   encode:    encode speed (MB/s of raw pixels) against output size for each --encode_preset.
+#              Runs the CLI with --encode_preset; the time is the "save" stage from the --metrics_file output.
+#   hugepages: CPU forward (reconstruct) and pre/post-processing time for each --huge_pages mode.
+#              Stage times are taken from waifu2x_stage_seconds in the --metrics_file output.
+#
+#   python benchmark.py memory --exe ../bin/waifu2x-caffe-cui.exe --sizes 64,128,256,512 --out memory.csv
+#   python benchmark.py coldstart --exe ../bin/waifu2x-caffe-cui.exe --out coldstart.csv
+#   python benchmark.py threads --exe ../bin/waifu2x-caffe-cui.exe --workers 1,2,4 --threads 0,8,16,32 --out threads.csv
+#   python benchmark.py adaptive --exe ../bin/waifu2x-caffe-cui.exe --thresholds 0,0.005,0.01,0.02 --out adaptive.csv
+#   python benchmark.py encode --exe ../bin/waifu2x-caffe-cui.exe --size 2048 --out encode.csv
+#   python benchmark.py hugepages --exe ../bin/waifu2x-caffe-cui --modes none,thp,explicit --out hugepages.csv
+
+
+def make_input(path, size):
+    rng = np.random.RandomState(size)
+    im = rng.randint(0, 256, (size, size, 3)).astype(np.uint8)
+    im = cv2.GaussianBlur(im, (5, 5), 0)
+    cv2.imwrite(path, im)
+
+
+def list_models(models_dir):
+    models = []
+    for model_dir in sorted(glob.glob(osp.join(models_dir, '*'))):
+        if not osp.exists(osp.join(model_dir, 'info.json')):
+            continue
+
+        def exists(base_name):
+            return any(osp.exists(osp.join(model_dir, base_name + ext)) for ext in ('.json', '.json.caffemodel'))
+
+        if exists('scale2.0x_model'):
+            models.append((model_dir, 'scale'))
+        elif exists('noise1_scale2.0x_model'):
+            models.append((model_dir, 'noise_scale'))
+        elif exists('noise1_model'):
+            models.append((model_dir, 'noise'))
+
+    return models
+
+
+def peak_memory(trace_path):
+    with open(trace_path) as f:
+        trace = json.load(f)
+
+    peak = {}
+    for e in trace['traceEvents']:
+        if e.get('name') != 'memory' or e.get('ph') != 'C':
+            continue
+        for k, v in e['args'].items():
+            peak[k] = max(peak.get(k, 0), v)
+
+    return peak
+
+
+def run_memory(args):
+    keys = ['total', 'image', 'net_blob', 'output_block', 'col_buffer']
+    sizes = [int(s) for s in args.sizes.split(',')]
+    models = list_models(args.models_dir)
+
+    rows = []
+    work_dir = tempfile.mkdtemp(prefix='waifu2x_benchmark_')
+    try:
+        for model_dir, mode in models:
+            model = osp.basename(model_dir)
+            for size in sizes:
+                input_path = osp.join(work_dir, 'in{}.png'.format(size))
+                if not osp.exists(input_path):
+                    make_input(input_path, size)
+
+                trace_path = osp.join(work_dir, 'trace.json')
+                cmd = [args.exe, '-i', input_path, '-o', osp.join(work_dir, 'out.png'), '-m', mode, '-n', '1',
+                       '-s', '2.0', '--model_dir', model_dir, '-p', args.process, '-c', str(args.crop_size),
+                       '-b', str(args.batch_size), '-t', str(args.tta), '--trace', trace_path]
+                subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+
+                peak = peak_memory(trace_path)
+                row = [model, size] + [peak.get(k, 0) for k in keys]
+                rows.append(row)
+                print('{:32s} {:5d}px total {:8.1f}MB'.format(model, size, row[2] / 1024.0 / 1024.0))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write(','.join(['model', 'size'] + keys) + '\n')
+            for row in rows:
+                f.write(','.join(str(v) for v in row) + '\n')
+
+    if args.chart:
+        try:
+            import matplotlib
+            matplotlib.use('Agg')
+            import matplotlib.pyplot as plt
+        except ImportError:
+            print('matplotlib is not installed; chart is not written')
+            return 0
+
+        fig, ax = plt.subplots()
+        for model, _ in [(osp.basename(m), mode) for m, mode in models]:
+            xs = [r[1] for r in rows if r[0] == model]
+            ys = [r[2] / 1024.0 / 1024.0 for r in rows if r[0] == model]
+            ax.plot(xs, ys, marker='o', label=model)
+        ax.set_xlabel('input size (px, square)')
+        ax.set_ylabel('peak memory (MB)')
+        ax.set_title('peak memory (process={}, crop={}, batch={}, tta={})'.format(
+            args.process, args.crop_size, args.batch_size, args.tta))
+        ax.grid(True)
+        ax.legend(fontsize='small')
+        fig.savefig(args.chart)
+
+    return 0
+
+
+LOAD_PATHS = ['protobin', 'prototxt', 'json']
+LOAD_PHASES = [('parse', 'cNet::Parse'), ('construct', 'cNet::Construct'),
+               ('weight_copy', 'cNet::WeightCopy'), ('write', 'cNet::Write')]
+
+
+def evict_page_cache(path):
+    # Best effort: drops the cached pages of one file without needing administrator rights.
+    if hasattr(os, 'posix_fadvise'):
+        fd = os.open(path, os.O_RDONLY)
+        try:
+            os.fsync(fd)
+            os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+        finally:
+            os.close(fd)
+    elif os.name == 'nt':
+        # Opening a file without buffering makes Windows purge its cached pages.
+        import ctypes
+        GENERIC_READ = 0x80000000
+        FILE_SHARE_READ = 0x1
+        OPEN_EXISTING = 3
+        FILE_FLAG_NO_BUFFERING = 0x20000000
+        INVALID_HANDLE_VALUE = ctypes.c_void_p(-1).value
+        kernel32 = ctypes.windll.kernel32
+        kernel32.CreateFileW.restype = ctypes.c_void_p
+        h = kernel32.CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, None, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, None)
+        if h != INVALID_HANDLE_VALUE:
+            kernel32.CloseHandle(ctypes.c_void_p(h))
+
+
+def warm_page_cache(path):
+    with open(path, 'rb') as f:
+        while f.read(1 << 20):
+            pass
+
+
+def coldstart_mode(model_dir):
+    def exists(base_name):
+        return any(osp.exists(osp.join(model_dir, base_name + ext)) for ext in ('.json', '.json.caffemodel'))
+
+    if exists('noise1_model') or exists('noise1_scale2.0x_model'):
+        return 'noise_scale'
+    return 'scale'
+
+
+def prepare_load_path(args, src_model_dir, dst_model_dir, load_path, input_path, work_dir):
+    # models that are distributed as caffemodel only cannot take the json path
+    if load_path == 'json' and not glob.glob(osp.join(src_model_dir, '*_model.json')):
+        return False
+
+    if osp.exists(dst_model_dir):
+        shutil.rmtree(dst_model_dir)
+    shutil.copytree(src_model_dir, dst_model_dir)
+
+    # protobin and caffemodel are written by the first run (json path)
+    if load_path != 'json':
+        run_init(args, dst_model_dir, input_path, work_dir)
+
+    for path in glob.glob(osp.join(dst_model_dir, '*')):
+        if load_path == 'json' and (path.endswith('.protobin') or path.endswith('.caffemodel')):
+            os.remove(path)
+        elif load_path == 'prototxt' and path.endswith('.protobin'):
+            os.remove(path)
+
+    return True
+
+
+def run_init(args, model_dir, input_path, work_dir):
+    trace_path = osp.join(work_dir, 'trace.json')
+    cmd = [args.exe, '-i', input_path, '-o', osp.join(work_dir, 'out.png'), '-m', coldstart_mode(model_dir), '-n', '1',
+           '-s', '2.0', '--model_dir', model_dir, '-p', args.process, '--trace', trace_path]
+    subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+
+    with open(trace_path) as f:
+        trace = json.load(f)
+
+    result = {'total': 0.0}
+    for key, _ in LOAD_PHASES:
+        result[key] = 0.0
+
+    for e in trace['traceEvents']:
+        if e.get('ph') != 'X':
+            continue
+        if e['name'] == 'Waifu2x::Init':
+            result['total'] += e['dur'] / 1000000.0
+        for key, name in LOAD_PHASES:
+            if e['name'] == name:
+                result[key] += e['dur'] / 1000000.0
+
+    return result
+
+
+def run_coldstart(args):
+    keys = ['total'] + [key for key, _ in LOAD_PHASES]
+
+    rows = []
+    work_dir = tempfile.mkdtemp(prefix='waifu2x_benchmark_')
+    try:
+        input_path = osp.join(work_dir, 'in.png')
+        make_input(input_path, 16)
+
+        for src_model_dir in sorted(glob.glob(osp.join(args.models_dir, '*'))):
+            if not osp.exists(osp.join(src_model_dir, 'info.json')):
+                continue
+            model = osp.basename(src_model_dir)
+            model_dir = osp.join(work_dir, model)
+
+            for load_path in LOAD_PATHS:
+                for cache in ('cold', 'warm'):
+                    results = []
+                    for _ in range(args.repeat):
+                        # every run needs the files of its load path, because the json and prototxt paths write protobin/caffemodel
+                        if not prepare_load_path(args, src_model_dir, model_dir, load_path, input_path, work_dir):
+                            break
+
+                        for path in glob.glob(osp.join(model_dir, '*')):
+                            if cache == 'cold':
+                                evict_page_cache(path)
+                            else:
+                                warm_page_cache(path)
+
+                        results.append(run_init(args, model_dir, input_path, work_dir))
+
+                    if not results:
+                        print('{:32s} {:8s} {:4s} skipped (no json model)'.format(model, load_path, cache))
+                        continue
+
+                    best = min(results, key=lambda r: r['total'])
+                    rows.append([model, load_path, cache] + [best[k] for k in keys])
+                    print('{:32s} {:8s} {:4s} total {:7.3f}s parse {:7.3f}s construct {:7.3f}s weight_copy {:7.3f}s write {:7.3f}s'.format(
+                        model, load_path, cache, best['total'], best['parse'], best['construct'], best['weight_copy'], best['write']))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write(','.join(['model', 'load_path', 'cache'] + keys) + '\n')
+            for row in rows:
+                f.write(','.join(str(v) for v in row) + '\n')
+
+    return 0
+
+
+def run_threads(args):
+    workers_list = [int(s) for s in args.workers.split(',')]
+    threads_list = [int(s) for s in args.threads.split(',')]
+    numa_list = [int(s) for s in args.numa.split(',')]
+
+    rows = []
+    work_dir = tempfile.mkdtemp(prefix='waifu2x_benchmark_')
+    try:
+        input_dir = osp.join(work_dir, 'in')
+        os.makedirs(input_dir)
+        # one large image and many small ones, the case where a single worker is left with the large image
+        make_input(osp.join(input_dir, 'large.png'), args.large_size)
+        for i in range(args.small_num):
+            make_input(osp.join(input_dir, 'small{:03d}.png'.format(i)), args.small_size)
+
+        for workers in workers_list:
+            for threads in threads_list:
+                for numa in numa_list:
+                    output_dir = osp.join(work_dir, 'out')
+                    shutil.rmtree(output_dir, ignore_errors=True)
+                    os.makedirs(output_dir)
+
+                    cmd = [args.exe, '-i', input_dir, '-o', output_dir, '-m', 'noise_scale', '-n', '1', '-s', '2.0',
+                           '-p', args.process, '--workers', str(workers), '--threads', str(threads), '--numa', str(numa)]
+
+                    best = None
+                    for _ in range(args.repeat):
+                        start = time.time()
+                        subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+                        elapsed = time.time() - start
+                        best = elapsed if best is None else min(best, elapsed)
+
+                    rows.append([workers, threads, numa, best])
+                    print('workers {:2d} threads {:3d} numa {:d} {:8.3f}s'.format(workers, threads, numa, best))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if rows:
+        base = rows[0][3]
+        print('speedup against workers {} threads {} numa {}:'.format(rows[0][0], rows[0][1], rows[0][2]))
+        for workers, threads, numa, elapsed in rows:
+            print('  workers {:2d} threads {:3d} numa {:d} x{:.2f}'.format(workers, threads, numa, base / elapsed))
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write('workers,threads,numa,seconds\n')
+            for row in rows:
+                f.write(','.join(str(v) for v in row) + '\n')
+
+    return 0
+
+
+def make_mixed_input(path, size):
+    # flat gradient background with a detailed square in the middle and some soft shapes
+    rng = np.random.RandomState(size)
+    y, x = np.mgrid[0:size, 0:size].astype(np.float32) / size
+    im = np.dstack([x * 160 + 40, y * 120 + 60, (x + y) * 60 + 50])
+
+    for _ in range(4):
+        cx, cy, r = rng.randint(0, size, 2).tolist() + [rng.randint(size // 16, size // 6)]
+        cv2.circle(im, (cx, cy), r, rng.randint(0, 256, 3).tolist(), -1)
+
+    q = size // 4
+    detail = rng.randint(0, 256, (size // 2, size // 2, 3)).astype(np.float32)
+    im[q:q + size // 2, q:q + size // 2] = cv2.GaussianBlur(detail, (3, 3), 0)
+
+    cv2.imwrite(path, np.clip(im, 0, 255).astype(np.uint8))
+
+
+def read_counter(metrics_path, name):
+    with open(metrics_path) as f:
+        for line in f:
+            if line.startswith(name + ' '):
+                return float(line.split()[1])
+    return 0.0
+
+
+def read_stage_seconds(metrics_path, stage):
+    prefix = 'waifu2x_stage_seconds_sum{{stage="{}"}} '.format(stage)
+    with open(metrics_path) as f:
+        for line in f:
+            if line.startswith(prefix):
+                return float(line.split()[1])
+    return 0.0
+
+
+def psnr(a, b):
+    mse = np.mean((a.astype(np.float64) - b.astype(np.float64)) ** 2)
+    return float('inf') if mse == 0 else 10.0 * np.log10(255.0 ** 2 / mse)
+
+
+def run_adaptive(args):
+    thresholds = [float(s) for s in args.thresholds.split(',')]
+    if thresholds[0] != 0.0:
+        thresholds.insert(0, 0.0)
+
+    rows = []
+    work_dir = tempfile.mkdtemp(prefix='waifu2x_benchmark_')
+    try:
+        input_path = osp.join(work_dir, 'in.png')
+        make_mixed_input(input_path, args.size)
+
+        reference = None
+        for threshold in thresholds:
+            output_path = osp.join(work_dir, 'out_{}.png'.format(threshold))
+            metrics_path = osp.join(work_dir, 'metrics_{}.prom'.format(threshold))
+
+            cmd = [args.exe, '-i', input_path, '-o', output_path, '-m', args.mode, '-n', '1', '-s', '2.0',
+                   '-p', args.process, '-c', str(args.crop_size), '--tile_skip_threshold', str(threshold),
+                   '--metrics_file', metrics_path]
+
+            best = None
+            for _ in range(args.repeat):
+                start = time.time()
+                subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+                elapsed = time.time() - start
+                best = elapsed if best is None else min(best, elapsed)
+
+            processed = read_counter(metrics_path, 'waifu2x_tiles_processed_total')
+            skipped = read_counter(metrics_path, 'waifu2x_tiles_skipped_total')
+            skipped_ratio = skipped / max(processed + skipped, 1.0)
+
+            out = cv2.imread(output_path, cv2.IMREAD_COLOR)
+            if reference is None:
+                reference = out
+
+            quality = psnr(reference, out)
+            rows.append([threshold, best, skipped_ratio, quality])
+            print('threshold {:6.4f} {:8.3f}s skipped {:5.1f}% psnr {:6.2f}dB'.format(threshold, best, skipped_ratio * 100.0, quality))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write('threshold,seconds,skipped_ratio,psnr\n')
+            for row in rows:
+                f.write(','.join(str(v) for v in row) + '\n')
+
+    return 0
+
+
+def run_hugepages(args):
+    modes = args.modes.split(',')
+    stages = ['preprocess', 'reconstruct', 'postprocess']
+
+    rows = []
+    work_dir = tempfile.mkdtemp(prefix='waifu2x_benchmark_')
+    try:
+        input_path = osp.join(work_dir, 'in.png')
+        make_input(input_path, args.size)
+
+        for mode in modes:
+            output_path = osp.join(work_dir, 'out_{}.png'.format(mode))
+            metrics_path = osp.join(work_dir, 'metrics_{}.prom'.format(mode))
+
+            cmd = [args.exe, '-i', input_path, '-o', output_path, '-m', 'noise_scale', '-n', '1', '-s', '2.0',
+                   '-p', 'cpu', '-c', str(args.crop_size), '--huge_pages', mode,
+                   '--huge_page_threshold', str(args.threshold), '--metrics_file', metrics_path]
+
+            # fastest run for each stage
+            best = {}
+            for _ in range(args.repeat):
+                subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+                for stage in stages:
+                    seconds = read_stage_seconds(metrics_path, stage)
+                    best[stage] = min(best.get(stage, seconds), seconds)
+
+            huge = read_counter(metrics_path, 'waifu2x_huge_page_bytes_total')
+            rows.append([mode] + [best[stage] for stage in stages] + [huge])
+            print('{:8s} '.format(mode) + ' '.join('{} {:8.3f}s'.format(stage, best[stage]) for stage in stages) +
+                  ' huge pages {:.1f}MB'.format(huge / (1024.0 * 1024.0)))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if rows:
+        print('speedup against {}:'.format(rows[0][0]))
+        for row in rows:
+            print('  {:8s} '.format(row[0]) + ' '.join('{} x{:.2f}'.format(stage, rows[0][i + 1] / max(row[i + 1], 1e-9)) for i, stage in enumerate(stages)))
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write('mode,' + ','.join(s + '_seconds' for s in stages) + ',huge_page_bytes\n')
+            for row in rows:
+                f.write(','.join(str(v) for v in row) + '\n')
+
+    return 0
+
+
+def run_encode(args):
+    # encode through the CLI so the presets are the ones stImage::GetEncodePreset() actually uses.
+    # The input is upscaled 2x by the network to get a smooth image like a real waifu2x output,
+    # and only the "save" stage (encode and write) is timed.
+    rows = []
+    work_dir = tempfile.mkdtemp(prefix='waifu2x_benchmark_')
+    try:
+        input_path = osp.join(work_dir, 'in.png')
+        make_mixed_input(input_path, args.size // 2)
+
+        for ext in args.formats.split(','):
+            for preset in args.presets.split(','):
+                output_path = osp.join(work_dir, 'out_{}{}'.format(preset, ext))
+                metrics_path = osp.join(work_dir, 'metrics_{}_{}.prom'.format(preset, ext[1:]))
+
+                cmd = [args.exe, '-i', input_path, '-o', output_path, '-m', 'scale', '-s', '2.0',
+                       '-p', args.process, '--encode_preset', preset, '--metrics_file', metrics_path]
+                if ext == '.jpg':
+                    cmd += ['-q', str(args.quality)]
+
+                best = None
+                for _ in range(args.repeat):
+                    subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+                    seconds = read_stage_seconds(metrics_path, 'save')
+                    best = seconds if best is None else min(best, seconds)
+
+                im = cv2.imread(output_path, cv2.IMREAD_UNCHANGED)
+                raw_mb = im.nbytes / (1024.0 * 1024.0)
+                size = osp.getsize(output_path)
+
+                rows.append([ext, preset, raw_mb / max(best, 1e-9), size])
+                print('{:4s} {:8s} {:8.1f}MB/s {:10d}bytes ({:5.1f}% of raw)'.format(ext, preset, raw_mb / max(best, 1e-9), size, size * 100.0 / im.nbytes))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write('format,preset,mb_per_second,bytes\n')
+            for row in rows:
+                f.write(','.join(str(v) for v in row) + '\n')
+
+    return 0
+
+
+def main():
+    parser = ArgumentParser()
+    subparsers = parser.add_subparsers(dest='command')
+
+    p = subparsers.add_parser('memory', help='peak memory usage against image size')
+    p.add_argument('--exe', required=True, help='path to waifu2x-caffe-cui')
+    p.add_argument('--models_dir', default=osp.join(osp.dirname(__file__), '..', 'bin', 'models'))
+    p.add_argument('--sizes', default='64,128,256,512,1024', help='comma separated input sizes')
+    p.add_argument('--process', default='cpu')
+    p.add_argument('--crop_size', type=int, default=128)
+    p.add_argument('--batch_size', type=int, default=1)
+    p.add_argument('--tta', type=int, default=0)
+    p.add_argument('--out', default='', help='write results as csv')
+    p.add_argument('--chart', default='', help='write chart image (requires matplotlib)')
+    p.set_defaults(func=run_memory)
+
+    p = subparsers.add_parser('coldstart', help='model loading time for each loading path')
+    p.add_argument('--exe', required=True, help='path to waifu2x-caffe-cui')
+    p.add_argument('--models_dir', default=osp.join(osp.dirname(__file__), '..', 'bin', 'models'))
+    p.add_argument('--process', default='cpu')
+    p.add_argument('--repeat', type=int, default=3, help='runs per case (fastest one is used)')
+    p.add_argument('--out', default='', help='write results as csv')
+    p.set_defaults(func=run_coldstart)
+
+    p = subparsers.add_parser('threads', help='folder processing time for each worker and thread count')
+    p.add_argument('--exe', required=True, help='path to waifu2x-caffe-cui')
+    p.add_argument('--process', default='cpu')
+    p.add_argument('--workers', default='1,2,4', help='comma separated --workers values')
+    p.add_argument('--threads', default='0,{}'.format(os.cpu_count() or 1), help='comma separated --threads values (0: no limit)')
+    p.add_argument('--numa', default='0', help='comma separated --numa values (0,1 to compare)')
+    p.add_argument('--large_size', type=int, default=2048)
+    p.add_argument('--small_size', type=int, default=256)
+    p.add_argument('--small_num', type=int, default=16)
+    p.add_argument('--repeat', type=int, default=2, help='runs per case (fastest one is used)')
+    p.add_argument('--out', default='', help='write results as csv')
+    p.set_defaults(func=run_threads)
+
+    p = subparsers.add_parser('adaptive', help='time and PSNR against --tile_skip_threshold')
+    p.add_argument('--exe', required=True, help='path to waifu2x-caffe-cui')
+    p.add_argument('--process', default='cpu')
+    p.add_argument('--mode', default='noise_scale')
+    p.add_argument('--thresholds', default='0,0.0025,0.005,0.01,0.02', help='comma separated --tile_skip_threshold values')
+    p.add_argument('--size', type=int, default=1024)
+    p.add_argument('--crop_size', type=int, default=64)
+    p.add_argument('--repeat', type=int, default=2, help='runs per case (fastest one is used)')
+    p.add_argument('--out', default='', help='write results as csv')
+    p.set_defaults(func=run_adaptive)
+
+    p = subparsers.add_parser('encode', help='encode speed and output size for each --encode_preset')
+    p.add_argument('--exe', required=True, help='path to waifu2x-caffe-cui')
+    p.add_argument('--process', default='cpu')
+    p.add_argument('--presets', default='default,fast,balanced,small', help='comma separated --encode_preset values')
+    p.add_argument('--formats', default='.png,.jpg', help='comma separated output extensions')
+    p.add_argument('--size', type=int, default=2048, help='width and height of the encoded image (the input is half of it)')
+    p.add_argument('--quality', type=int, default=95, help='JPEG quality')
+    p.add_argument('--repeat', type=int, default=3, help='runs per case (fastest one is used)')
+    p.add_argument('--out', default='', help='write results as csv')
+    p.set_defaults(func=run_encode)
+
+    p = subparsers.add_parser('hugepages', help='CPU forward and pre/post-processing time for each --huge_pages mode')
+    p.add_argument('--exe', required=True, help='path to waifu2x-caffe-cui')
+    p.add_argument('--modes', default='none,thp,explicit', help='comma separated --huge_pages values')
+    p.add_argument('--threshold', type=int, default=16, help='--huge_page_threshold in MB')
+    p.add_argument('--size', type=int, default=2048)
+    p.add_argument('--crop_size', type=int, default=128)
+    p.add_argument('--repeat', type=int, default=2, help='runs per case (fastest one is used)')
+    p.add_argument('--out', default='', help='write results as csv')
+    p.set_defaults(func=run_hugepages)
+
+    args = parser.parse_args()
+    if not hasattr(args, 'func'):
+        parser.print_help()
+        return 1
+
+    return args.func(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
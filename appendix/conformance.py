@@ -0,0 +1,229 @@
+import os
+import os.path as osp
+import sys
+import glob
+import json
+import hashlib
+import shutil
+import subprocess
+import tempfile
+from argparse import ArgumentParser
+
+import numpy as np
+import cv2
+
+
+# Golden-output conformance and throughput regression check for waifu2x-caffe-cui.
+#
+# Runs every bundled model on a fixed, synthetically generated CPU input set and compares
+# the output pixels against stored golden hashes (falling back to a PSNR threshold against
+# the stored golden image when the hash differs), and the per-image processing time
+# (taken from the --trace output) against a stored throughput baseline.
+#
+#   python conformance.py --exe ../bin/waifu2x-caffe-cui.exe --update   # record golden data
+#   python conformance.py --exe ../bin/waifu2x-caffe-cui.exe            # check
+
+
+INPUT_W = 96
+INPUT_H = 80
+
+
+def make_inputs(dst_dir):
+    rng = np.random.RandomState(20170416)
+
+    yy, xx = np.mgrid[0:INPUT_H, 0:INPUT_W].astype(np.float32)
+    base = np.stack([
+        xx / INPUT_W * 255.0,
+        yy / INPUT_H * 255.0,
+        (np.sin(xx / 5.0) * np.cos(yy / 7.0) * 0.5 + 0.5) * 255.0,
+    ], axis=2)
+    noise = rng.normal(0.0, 12.0, base.shape)
+    rgb = np.clip(base + noise, 0, 255).astype(np.uint8)
+
+    # soft-edged alpha so that both the alpha border extension and the alpha net are exercised
+    alpha = np.zeros((INPUT_H, INPUT_W), np.uint8)
+    cv2.circle(alpha, (INPUT_W // 2, INPUT_H // 2), min(INPUT_W, INPUT_H) // 3, 255, -1)
+    alpha = cv2.GaussianBlur(alpha, (9, 9), 0)
+    rgba = np.dstack([rgb, alpha])
+
+    inputs = {
+        'rgb': osp.join(dst_dir, 'rgb.png'),
+        'rgba': osp.join(dst_dir, 'rgba.png'),
+    }
+    cv2.imwrite(inputs['rgb'], rgb)
+    cv2.imwrite(inputs['rgba'], rgba)
+
+    return inputs
+
+
+def list_cases(models_dir, use_tta_list):
+    cases = []
+    for model_dir in sorted(glob.glob(osp.join(models_dir, '*'))):
+        info_path = osp.join(model_dir, 'info.json')
+        if not osp.exists(info_path):
+            continue
+
+        with open(info_path) as f:
+            info = json.load(f)
+
+        model = osp.basename(model_dir)
+
+        def exists(base_name):
+            return any(osp.exists(osp.join(model_dir, base_name + ext)) for ext in ('.json', '.json.caffemodel'))
+
+        if info.get('has_noise_scale', False):
+            noise_name = 'noise{}_scale2.0x_model'
+        else:
+            noise_name = 'noise{}_model'
+
+        levels = [n for n in range(4) if exists(noise_name.format(n))]
+
+        modes = []
+        if levels:
+            modes += [('noise', n) for n in levels]
+        if exists('scale2.0x_model'):
+            modes.append(('scale', 0))
+            modes += [('noise_scale', n) for n in levels]
+
+        for mode, level in modes:
+            for tta in use_tta_list:
+                for input_name in ('rgb', 'rgba'):
+                    name = '{}/{}/n{}/tta{}/{}'.format(model, mode, level, tta, input_name)
+                    cases.append({'name': name, 'model_dir': model_dir, 'mode': mode, 'level': level,
+                                  'tta': tta, 'input': input_name})
+
+    return cases
+
+
+def pixel_hash(im):
+    h = hashlib.sha256()
+    h.update(str(im.shape).encode())
+    h.update(str(im.dtype).encode())
+    h.update(np.ascontiguousarray(im).tobytes())
+    return h.hexdigest()
+
+
+def psnr(a, b):
+    if a.shape != b.shape:
+        return 0.0
+    mse = np.mean((a.astype(np.float64) - b.astype(np.float64)) ** 2)
+    if mse == 0:
+        return float('inf')
+    return 10.0 * np.log10(255.0 ** 2 / mse)
+
+
+def process_time_us(trace_path):
+    with open(trace_path) as f:
+        trace = json.load(f)
+
+    times = [e['dur'] for e in trace['traceEvents'] if e.get('name') == 'Waifu2x::waifu2x' and e.get('ph') == 'X']
+    return min(times) if times else None
+
+
+def run_case(exe, case, inputs, work_dir, repeat):
+    output_path = osp.join(work_dir, 'out.png')
+    trace_path = osp.join(work_dir, 'trace.json')
+
+    best = None
+    for _ in range(repeat):
+        cmd = [exe, '-i', inputs[case['input']], '-o', output_path, '-m', case['mode'],
+               '-n', str(case['level']), '-s', '2.0', '--model_dir', case['model_dir'],
+               '-p', 'cpu', '-c', '32', '-t', str(case['tta']), '--trace', trace_path]
+        subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+
+        t = process_time_us(trace_path)
+        if t is not None and (best is None or t < best):
+            best = t
+
+    im = cv2.imread(output_path, cv2.IMREAD_UNCHANGED)
+    if im is None:
+        raise RuntimeError('failed to read output of ' + case['name'])
+
+    return im, best
+
+
+def main():
+    parser = ArgumentParser()
+    parser.add_argument('--exe', required=True, help='path to waifu2x-caffe-cui')
+    parser.add_argument('--models_dir', default=osp.join(osp.dirname(__file__), '..', 'bin', 'models'))
+    parser.add_argument('--golden_dir', default=osp.join(osp.dirname(__file__), 'conformance'),
+                        help='directory that holds golden.json and the golden images')
+    parser.add_argument('--update', action='store_true', help='record current outputs as golden data')
+    parser.add_argument('--psnr', type=float, default=50.0, help='minimum PSNR(dB) when the hash differs')
+    parser.add_argument('--tolerance', type=float, default=0.10,
+                        help='allowed slowdown against the baseline (0.10 = 10%%)')
+    parser.add_argument('--repeat', type=int, default=3, help='runs per case (fastest one is used)')
+    parser.add_argument('--no_tta', action='store_true', help='skip TTA cases')
+    parser.add_argument('--filter', default='', help='only run cases whose name contains this string')
+    args = parser.parse_args()
+
+    golden_json = osp.join(args.golden_dir, 'golden.json')
+    golden = {}
+    if osp.exists(golden_json):
+        with open(golden_json) as f:
+            golden = json.load(f)
+    elif not args.update:
+        print('golden data not found: {} (run with --update first)'.format(golden_json))
+        return 1
+
+    cases = list_cases(args.models_dir, [0] if args.no_tta else [0, 1])
+    cases = [c for c in cases if args.filter in c['name']]
+
+    work_dir = tempfile.mkdtemp(prefix='waifu2x_conformance_')
+    failed = []
+    try:
+        inputs = make_inputs(work_dir)
+
+        for case in cases:
+            name = case['name']
+            im, t = run_case(args.exe, case, inputs, work_dir, args.repeat)
+            h = pixel_hash(im)
+            image_name = name.replace('/', '_') + '.png'
+
+            if args.update:
+                if not osp.exists(args.golden_dir):
+                    os.makedirs(args.golden_dir)
+                cv2.imwrite(osp.join(args.golden_dir, image_name), im)
+                golden[name] = {'hash': h, 'time_us': t}
+                print('{:60s} recorded ({} us)'.format(name, t))
+                continue
+
+            g = golden.get(name)
+            if g is None:
+                print('{:60s} NEW (no golden data)'.format(name))
+                failed.append(name)
+                continue
+
+            status = 'OK'
+            if h != g['hash']:
+                golden_im = cv2.imread(osp.join(args.golden_dir, image_name), cv2.IMREAD_UNCHANGED)
+                p = psnr(im, golden_im) if golden_im is not None else 0.0
+                if p < args.psnr:
+                    status = 'PIXEL MISMATCH (PSNR {:.2f}dB)'.format(p)
+                else:
+                    status = 'OK (PSNR {:.2f}dB)'.format(p)
+
+            if status.startswith('OK') and t is not None and g.get('time_us'):
+                ratio = float(t) / g['time_us']
+                if ratio > 1.0 + args.tolerance:
+                    status = 'SLOW ({:.1f}% of baseline)'.format(ratio * 100.0)
+                else:
+                    status += ' {:.1f}%'.format(ratio * 100.0)
+
+            print('{:60s} {}'.format(name, status))
+            if not status.startswith('OK'):
+                failed.append(name)
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    if args.update:
+        with open(golden_json, 'w') as f:
+            json.dump(golden, f, indent=1, sort_keys=True)
+        return 0
+
+    print('{} / {} cases passed'.format(len(cases) - len(failed), len(cases)))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
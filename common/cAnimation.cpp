@@ -0,0 +1,476 @@
+#include "cAnimation.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <boost/filesystem/fstream.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <stb_image.h>
+#include <zlib.h>
+#include "stImage.h"
+#include "cTrace.h"
+#include "cWriterPool.h"
+
+
+namespace
+{
+	const unsigned char PngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	// APNGfcTLdispose_op, blend_op
+	const int APNG_DISPOSE_OP_NONE = 0;
+	const int APNG_DISPOSE_OP_BACKGROUND = 1;
+	const int APNG_DISPOSE_OP_PREVIOUS = 2;
+	const int APNG_BLEND_OP_SOURCE = 0;
+	const int APNG_BLEND_OP_OVER = 1;
+
+	struct stChunk
+	{
+		std::string type;
+		const unsigned char *data;
+		uint32_t size;
+	};
+
+	uint32_t ReadU32(const unsigned char *p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+	}
+
+	uint16_t ReadU16(const unsigned char *p)
+	{
+		return (uint16_t)((p[0] << 8) | p[1]);
+	}
+
+	void PutU32(std::vector<unsigned char> &buf, const uint32_t v)
+	{
+		buf.push_back((unsigned char)(v >> 24));
+		buf.push_back((unsigned char)(v >> 16));
+		buf.push_back((unsigned char)(v >> 8));
+		buf.push_back((unsigned char)v);
+	}
+
+	void PutU16(std::vector<unsigned char> &buf, const uint16_t v)
+	{
+		buf.push_back((unsigned char)(v >> 8));
+		buf.push_back((unsigned char)v);
+	}
+
+	void PutChunk(std::vector<unsigned char> &buf, const char *type, const unsigned char *data, const uint32_t size)
+	{
+		PutU32(buf, size);
+
+		const size_t start = buf.size();
+		buf.insert(buf.end(), type, type + 4);
+		buf.insert(buf.end(), data, data + size);
+
+		PutU32(buf, (uint32_t)crc32(0, buf.data() + start, (uInt)(size + 4)));
+	}
+
+	void PutChunk(std::vector<unsigned char> &buf, const char *type, const std::vector<unsigned char> &data)
+	{
+		PutChunk(buf, type, data.data(), (uint32_t)data.size());
+	}
+
+	// PNG`Nɕ(databufw)
+	bool ParseChunks(const unsigned char *buf, const size_t size, std::vector<stChunk> &chunks)
+	{
+		chunks.clear();
+
+		if (size < sizeof(PngSignature) || memcmp(buf, PngSignature, sizeof(PngSignature)) != 0)
+			return false;
+
+		size_t pos = sizeof(PngSignature);
+		while (pos + 12 <= size)
+		{
+			const uint32_t len = ReadU32(buf + pos);
+			if (size - pos - 12 < len)
+				return false;
+
+			stChunk c;
+			c.type.assign((const char *)buf + pos + 4, 4);
+			c.data = buf + pos + 8;
+			c.size = len;
+			chunks.push_back(c);
+
+			pos += 12 + len;
+
+			if (c.type == "IEND")
+				break;
+		}
+
+		return !chunks.empty() && chunks[0].type == "IHDR" && chunks[0].size == 13;
+	}
+
+	// PNG̃`N̓(Ǝ)ǂŁAIDATOacTL邩ׂ(摜f[^͓ǂݔ΂)
+	// is̈ʒu̓VOl`̒ł邱
+	bool HasAnimationControl(std::istream &is)
+	{
+		unsigned char head[8];
+		while (is.read((char *)head, sizeof(head)))
+		{
+			if (memcmp(head + 4, "acTL", 4) == 0)
+				return true;
+
+			if (memcmp(head + 4, "IDAT", 4) == 0 || memcmp(head + 4, "IEND", 4) == 0)
+				return false;
+
+			// f[^CRCǂݔ΂
+			is.seekg((std::streamoff)ReadU32(head) + 4, std::ios::cur);
+		}
+
+		return false;
+	}
+
+	// APNGBLEND_OP_OVER(`lZĂȂBGRA 8bitm)
+	void BlendOver(const cv::Mat &src, cv::Mat &dst)
+	{
+		for (int i = 0; i < src.rows; i++)
+		{
+			const cv::Vec4b *s = src.ptr<cv::Vec4b>(i);
+			cv::Vec4b *d = dst.ptr<cv::Vec4b>(i);
+
+			for (int j = 0; j < src.cols; j++)
+			{
+				const int sa = s[j][3];
+				if (sa == 255)
+					d[j] = s[j];
+				else if (sa != 0)
+				{
+					const float a = sa / 255.0f;
+					const float da = d[j][3] / 255.0f * (1.0f - a);
+					const float oa = a + da;
+
+					for (int c = 0; c < 3; c++)
+						d[j][c] = cv::saturate_cast<uchar>((s[j][c] * a + d[j][c] * da) / oa);
+					d[j][3] = cv::saturate_cast<uchar>(oa * 255.0f);
+				}
+			}
+		}
+	}
+}
+
+cv::Rect cAnimation::GetChangedRect(const cv::Mat &prev, const cv::Mat &cur)
+{
+	cv::Mat diff;
+	cv::absdiff(prev, cur, diff);
+
+	std::vector<cv::Mat> planes;
+	cv::split(diff, planes);
+
+	cv::Mat mask = planes[0];
+	for (size_t i = 1; i < planes.size(); i++)
+		mask |= planes[i];
+
+	if (cv::countNonZero(mask) == 0)
+		return cv::Rect();
+
+	std::vector<cv::Point> points;
+	cv::findNonZero(mask, points);
+
+	return cv::boundingRect(points);
+}
+
+bool cAnimation::LoadGIF(const std::vector<char> &buf, std::vector<stFrame> &frames, int &loop)
+{
+	int *delays = nullptr;
+	int x, y, z, comp;
+	stbi_uc *data = stbi_load_gif_from_memory((const stbi_uc *)buf.data(), (int)buf.size(), &delays, &x, &y, &z, &comp, 4);
+	if (!data)
+		return false;
+
+	if (z >= 2)
+	{
+		frames.resize(z);
+		for (int i = 0; i < z; i++)
+		{
+			const cv::Mat rgba(cv::Size(x, y), CV_8UC4, data + (size_t)x * y * 4 * i);
+			cv::cvtColor(rgba, frames[i].image, cv::COLOR_RGBA2BGRA);
+			frames[i].delay = delays ? delays[i] : 100;
+		}
+	}
+
+	stbi_image_free(data);
+	if (delays)
+		stbi_image_free(delays);
+
+	if (z < 2)
+		return false;
+
+	// JԂ񐔂NETSCAPE2.0̃AvP[Vgɂ(1񂾂Đ)
+	loop = 1;
+
+	static const char Netscape[] = "NETSCAPE2.0";
+	const auto it = std::search(buf.begin(), buf.end(), Netscape, Netscape + sizeof(Netscape) - 1);
+	if (it != buf.end() && buf.end() - it >= (ptrdiff_t)(sizeof(Netscape) - 1 + 4))
+	{
+		const unsigned char *p = (const unsigned char *)&*(it + sizeof(Netscape) - 1);
+		if (p[0] == 3 && p[1] == 1)
+			loop = p[2] | (p[3] << 8);
+	}
+
+	return true;
+}
+
+bool cAnimation::LoadAPNG(const std::vector<char> &buf, std::vector<stFrame> &frames, int &loop)
+{
+	std::vector<stChunk> chunks;
+	if (!ParseChunks((const unsigned char *)buf.data(), buf.size(), chunks))
+		return false;
+
+	const auto actl = std::find_if(chunks.begin(), chunks.end(), [](const stChunk &c) { return c.type == "acTL"; });
+	if (actl == chunks.end() || actl->size < 8)
+		return false;
+
+	loop = (int)ReadU32(actl->data + 4);
+
+	const stChunk &ihdr = chunks[0];
+	const int Width = (int)ReadU32(ihdr.data);
+	const int Height = (int)ReadU32(ihdr.data + 4);
+
+	// t[ƂfcTLƉ摜f[^(fdAT̓V[PXԍIDATɂ)
+	struct stApngFrame
+	{
+		const unsigned char *ctl;
+		std::vector<stChunk> data;
+	};
+
+	std::vector<stApngFrame> list;
+	std::vector<stChunk> common; // ŏIDATOɂAt[̉摜̂ɕKvȃ`N(PLTE, tRNSȂ)
+	bool isIDATFound = false;
+	bool isDefaultImageFrame = false;
+	for (const auto &c : chunks)
+	{
+		if (c.type == "fcTL")
+		{
+			if (c.size < 26)
+				return false;
+
+			stApngFrame f;
+			f.ctl = c.data;
+			list.push_back(f);
+		}
+		else if (c.type == "IDAT")
+		{
+			// ŏIDATOfcTL΁AIDAT̉摜ŏ̃t[(΃Aj[VɊ܂܂Ȃ摜)
+			if (!isIDATFound)
+				isDefaultImageFrame = !list.empty();
+
+			isIDATFound = true;
+
+			if (isDefaultImageFrame)
+				list[0].data.push_back(c);
+		}
+		else if (c.type == "fdAT")
+		{
+			if (c.size < 4 || list.empty())
+				return false;
+
+			stChunk d;
+			d.type = "IDAT";
+			d.data = c.data + 4;
+			d.size = c.size - 4;
+			list.back().data.push_back(d);
+		}
+		else if (!isIDATFound && c.type != "IHDR" && c.type != "acTL" && c.type != "IEND")
+			common.push_back(c);
+	}
+
+	if (list.size() < 2)
+		return false;
+
+	const cv::Rect full(0, 0, Width, Height);
+
+	cv::Mat canvas = cv::Mat::zeros(cv::Size(Width, Height), CV_8UC4);
+
+	frames.resize(list.size());
+	for (size_t i = 0; i < list.size(); i++)
+	{
+		const unsigned char *ctl = list[i].ctl;
+		const cv::Rect rect((int)ReadU32(ctl + 12), (int)ReadU32(ctl + 16), (int)ReadU32(ctl + 4), (int)ReadU32(ctl + 8));
+		const int delayNum = ReadU16(ctl + 20);
+		const int delayDen = ReadU16(ctl + 22);
+		const int dispose = ctl[24];
+		const int blend = ctl[25];
+
+		if (rect.area() == 0 || (rect & full) != rect || list[i].data.empty())
+			return false;
+
+		// t[͈̔͂̕ʂPNGɂăfR[h
+		std::vector<unsigned char> png(PngSignature, PngSignature + sizeof(PngSignature));
+
+		std::vector<unsigned char> header(ihdr.data, ihdr.data + ihdr.size);
+		header[0] = (unsigned char)(rect.width >> 24);
+		header[1] = (unsigned char)(rect.width >> 16);
+		header[2] = (unsigned char)(rect.width >> 8);
+		header[3] = (unsigned char)rect.width;
+		header[4] = (unsigned char)(rect.height >> 24);
+		header[5] = (unsigned char)(rect.height >> 16);
+		header[6] = (unsigned char)(rect.height >> 8);
+		header[7] = (unsigned char)rect.height;
+		PutChunk(png, "IHDR", header);
+
+		for (const auto &c : common)
+			PutChunk(png, c.type.c_str(), c.data, c.size);
+
+		for (const auto &c : list[i].data)
+			PutChunk(png, "IDAT", c.data, c.size);
+
+		PutChunk(png, "IEND", nullptr, 0);
+
+		cv::Mat im = cv::imdecode(png, cv::IMREAD_UNCHANGED);
+		if (im.empty() || im.size() != rect.size())
+			return false;
+
+		im = stImage::ConvertTo8bit(im);
+		if (im.channels() == 1)
+			cv::cvtColor(im, im, cv::COLOR_GRAY2BGRA);
+		else if (im.channels() == 3)
+			cv::cvtColor(im, im, cv::COLOR_BGR2BGRA);
+
+		cv::Mat region = canvas(rect);
+
+		cv::Mat saved;
+		if (dispose == APNG_DISPOSE_OP_PREVIOUS)
+			saved = region.clone();
+
+		if (blend == APNG_BLEND_OP_OVER)
+			BlendOver(im, region);
+		else
+			im.copyTo(region);
+
+		frames[i].image = canvas.clone();
+		frames[i].delay = delayDen == 0 ? delayNum * 10 : delayNum * 1000 / delayDen; // ꂪ0Ȃ1/100bP
+
+		// ̃t[̑Oɔ͈͂߂
+		if (dispose == APNG_DISPOSE_OP_BACKGROUND)
+			region.setTo(cv::Scalar::all(0));
+		else if (dispose == APNG_DISPOSE_OP_PREVIOUS)
+			saved.copyTo(region);
+	}
+
+	return true;
+}
+
+bool cAnimation::Load(const boost::filesystem::path &path, std::vector<stFrame> &frames, int &loop)
+{
+	TRACE_SCOPE_WAIFU2X("cAnimation::Load");
+
+	frames.clear();
+	loop = 0;
+
+	std::vector<char> buf;
+	try
+	{
+		boost::filesystem::ifstream ifs(path, std::ios::in | std::ios::binary);
+		if (!ifs)
+			return false;
+
+		// قƂǂPNG̓Aj[Vł͂Ȃ̂ŁAacTL΃t@CŜǂݍ܂ɏI
+		unsigned char signature[sizeof(PngSignature)];
+		if (ifs.read((char *)signature, sizeof(signature)) && memcmp(signature, PngSignature, sizeof(PngSignature)) == 0)
+		{
+			if (!HasAnimationControl(ifs))
+				return false;
+		}
+
+		ifs.clear();
+		ifs.seekg(0);
+
+		buf.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	bool isLoaded = false;
+	if (buf.size() >= 6 && (memcmp(buf.data(), "GIF87a", 6) == 0 || memcmp(buf.data(), "GIF89a", 6) == 0))
+		isLoaded = LoadGIF(buf, frames, loop);
+	else if (buf.size() >= sizeof(PngSignature) && memcmp(buf.data(), PngSignature, sizeof(PngSignature)) == 0)
+		isLoaded = LoadAPNG(buf, frames, loop);
+
+	if (!isLoaded)
+	{
+		frames.clear();
+		return false;
+	}
+
+	// Õt[ς͈
+	frames[0].rect = cv::Rect(0, 0, frames[0].image.cols, frames[0].image.rows);
+	for (size_t i = 1; i < frames.size(); i++)
+		frames[i].rect = GetChangedRect(frames[i - 1].image, frames[i].image);
+
+	return true;
+}
+
+bool cAnimation::SaveAPNG(const boost::filesystem::path &path, const cv::Size_<int> &size, const std::vector<stFrame> &frames, const int loop)
+{
+	TRACE_SCOPE_WAIFU2X("cAnimation::SaveAPNG");
+
+	if (frames.empty() || frames[0].rect != cv::Rect(0, 0, size.width, size.height))
+		return false;
+
+	std::vector<unsigned char> out(PngSignature, PngSignature + sizeof(PngSignature));
+
+	std::vector<int> params;
+	stImage::AppendEncodeParams(".png", params);
+
+	uint32_t seq = 0;
+	std::vector<unsigned char> png;
+	std::vector<stChunk> chunks;
+	std::vector<unsigned char> data;
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		const auto &f = frames[i];
+		if (f.image.size() != f.rect.size() || f.image.type() != frames[0].image.type())
+			return false;
+
+		// t[͈̔͂𕁒ʂPNGɂāA摜f[^o
+		if (!cv::imencode(".png", f.image, png, params) || !ParseChunks(png.data(), png.size(), chunks))
+			return false;
+
+		if (i == 0)
+		{
+			PutChunk(out, "IHDR", chunks[0].data, chunks[0].size);
+
+			data.clear();
+			PutU32(data, (uint32_t)frames.size());
+			PutU32(data, (uint32_t)loop);
+			PutChunk(out, "acTL", data);
+		}
+
+		// Õt[̏ɂ̃t[͈̔͂̂܂ܒu
+		data.clear();
+		PutU32(data, seq++);
+		PutU32(data, (uint32_t)f.rect.width);
+		PutU32(data, (uint32_t)f.rect.height);
+		PutU32(data, (uint32_t)f.rect.x);
+		PutU32(data, (uint32_t)f.rect.y);
+		PutU16(data, (uint16_t)std::min(std::max(f.delay, 0), 65535));
+		PutU16(data, 1000);
+		data.push_back(APNG_DISPOSE_OP_NONE);
+		data.push_back(APNG_BLEND_OP_SOURCE);
+		PutChunk(out, "fcTL", data);
+
+		for (const auto &c : chunks)
+		{
+			if (c.type != "IDAT")
+				continue;
+
+			if (i == 0)
+				PutChunk(out, "IDAT", c.data, c.size);
+			else
+			{
+				data.clear();
+				PutU32(data, seq++);
+				data.insert(data.end(), c.data, c.data + c.size);
+				PutChunk(out, "fdAT", data);
+			}
+		}
+	}
+
+	PutChunk(out, "IEND", nullptr, 0);
+
+	return cWriterPool::Write(path, out);
+}
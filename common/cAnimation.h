@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <opencv2/core.hpp>
+
+
+// Aj[V摜(GIF, APNG)̓ǂݍ݂APNG̏
+class cAnimation
+{
+public:
+	struct stFrame
+	{
+		cv::Mat image; // Load(): ς݂̃t[S(BGRA 8bit)ASaveAPNG(): rect͈̔͂̉摜(SẴt[Ő[xƃ`l)
+		cv::Rect rect; // Õt[ς͈(ŏ̃t[͉摜ŚBȂÕt[Ɠ)
+		int delay; // \鎞(~b)
+	};
+
+private:
+	static bool LoadGIF(const std::vector<char> &buf, std::vector<stFrame> &frames, int &loop);
+	static bool LoadAPNG(const std::vector<char> &buf, std::vector<stFrame> &frames, int &loop);
+
+public:
+	// 2t[ȏ̃Aj[VȂSẴt[framesɓǂݍށB1t[̉摜ΉĂȂ`Ȃfalse
+	// PNG̓`N̓ǂacTL(Aj[VłȂ)At@CŜ͓ǂݍ܂falseԂ
+	// loop: JԂ(0͖)
+	static bool Load(const boost::filesystem::path &path, std::vector<stFrame> &frames, int &loop);
+
+	// APNGŏށB2t[ڈȍ~͑Õt[rect͈̔͂ut[ɂ
+	// size: 摜Ŝ̃TCY
+	static bool SaveAPNG(const boost::filesystem::path &path, const cv::Size_<int> &size, const std::vector<stFrame> &frames, const int loop);
+
+	// prevcurŕςf͂ޔ͈(ςĂȂ΋)
+	static cv::Rect GetChangedRect(const cv::Mat &prev, const cv::Mat &cur);
+};
@@ -0,0 +1,231 @@
+#include "cDziWriter.h"
+#include <algorithm>
+#include <boost/filesystem/fstream.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "stImage.h"
+#include "cTrace.h"
+
+
+cDziWriter::cDziWriter(const boost::optional<int> &quality, const int tile_size, const int overlap) : mQuality(quality), mTileSize(tile_size), mOverlap(overlap),
+	mChannel(0), mIsOpen(false), mIsError(false)
+{}
+
+cDziWriter::~cDziWriter()
+{}
+
+bool cDziWriter::Open(const boost::filesystem::path &path, const cv::Size_<int> &size, const int channel, const int depth)
+{
+	if (mIsOpen || size.area() == 0 || !(channel == 1 || channel == 3 || channel == 4) || mTileSize <= 0 || mOverlap < 0)
+		return false;
+
+	mPath = path;
+	mTileDir = path.parent_path() / (path.stem().wstring() + L"_files");
+	mFormat = channel == 4 ? "png" : "jpg";
+	mChannel = channel;
+
+	// ԍׂx摜̂̂ŁA(؂グ)ɂĂ1x1ɂȂ܂
+	int maxLevel = 0;
+	while ((1 << maxLevel) < std::max(size.width, size.height))
+		maxLevel++;
+
+	mLevelList.clear();
+	mLevelList.resize(maxLevel + 1);
+
+	cv::Size_<int> s = size;
+	for (int level = maxLevel; level >= 0; level--)
+	{
+		auto &l = mLevelList[level];
+		l.size = s;
+		l.rows_y = 0;
+		l.tile_row = 0;
+
+		s = cv::Size_<int>((s.width + 1) / 2, (s.height + 1) / 2);
+	}
+
+	try
+	{
+		for (size_t level = 0; level < mLevelList.size(); level++)
+			boost::filesystem::create_directories(mTileDir / std::to_string(level));
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	mIsOpen = true;
+	mIsError = false;
+
+	return true;
+}
+
+bool cDziWriter::IsOpen() const
+{
+	return mIsOpen;
+}
+
+bool cDziWriter::WriteTileRow(const int level)
+{
+	TRACE_SCOPE_WAIFU2X("cDziWriter::WriteTileRow");
+
+	auto &l = mLevelList[level];
+
+	const int r = l.tile_row;
+	const int y0 = std::max(r * mTileSize - mOverlap, 0);
+	const int y1 = std::min((r + 1) * mTileSize + mOverlap, l.size.height);
+
+	std::vector<int> params;
+	if (mFormat == "jpg" && mQuality)
+	{
+		params.push_back(cv::IMWRITE_JPEG_QUALITY);
+		params.push_back(*mQuality);
+	}
+	stImage::AppendEncodeParams("." + mFormat, params);
+
+	std::vector<uchar> buf;
+	for (int c = 0; c * mTileSize < l.size.width; c++)
+	{
+		const int x0 = std::max(c * mTileSize - mOverlap, 0);
+		const int x1 = std::min((c + 1) * mTileSize + mOverlap, l.size.width);
+
+		const cv::Mat tile = l.rows(cv::Rect(x0, y0 - l.rows_y, x1 - x0, y1 - y0));
+
+		try
+		{
+			if (!cv::imencode("." + mFormat, tile, buf, params))
+				return false;
+
+			boost::filesystem::ofstream ofs(mTileDir / std::to_string(level) / (std::to_string(c) + "_" + std::to_string(r) + "." + mFormat), std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!ofs.write((const char *)buf.data(), buf.size()))
+				return false;
+		}
+		catch (...)
+		{
+			return false;
+		}
+	}
+
+	l.tile_row++;
+
+	// ̃^C̍sŎgs(㑤̏dȂ̕)͎̂Ă
+	const int next_y0 = std::max(l.tile_row * mTileSize - mOverlap, 0);
+	if (next_y0 > l.rows_y)
+	{
+		const int drop = std::min(next_y0 - l.rows_y, l.rows.rows);
+		l.rows = l.rows.rowRange(drop, l.rows.rows).clone();
+		l.rows_y += drop;
+	}
+
+	return true;
+}
+
+bool cDziWriter::PushRows(const int level, const cv::Mat &rows)
+{
+	auto &l = mLevelList[level];
+
+	if (l.rows.empty())
+		l.rows = rows.clone();
+	else
+		cv::vconcat(l.rows, rows, l.rows);
+
+	const int received = l.rows_y + l.rows.rows;
+
+	// ^C̍s(Ō̍s͉摜̉[܂)
+	while (l.tile_row * mTileSize < l.size.height && received >= std::min((l.tile_row + 1) * mTileSize + mOverlap, l.size.height))
+	{
+		if (!WriteTileRow(level))
+			return false;
+	}
+
+	if (level == 0)
+		return true;
+
+	// 2x2̉f̕ςŏk1̃xɓn
+	cv::Mat half;
+	if (l.pending.empty())
+		half = rows;
+	else
+		cv::vconcat(l.pending, rows, half);
+
+	const bool isEnd = received == l.size.height;
+
+	int useRows = half.rows / 2 * 2;
+	if (isEnd)
+		useRows = half.rows; // ȂŌ1s͂̍sŏk
+
+	l.pending = half.rowRange(useRows, half.rows).clone();
+	if (useRows == 0)
+		return true;
+
+	cv::Mat src = half.rowRange(0, useRows);
+	if (src.cols % 2 != 0 || src.rows % 2 != 0)
+		cv::copyMakeBorder(src, src, 0, src.rows % 2, 0, src.cols % 2, cv::BORDER_REPLICATE);
+
+	cv::Mat down;
+	cv::resize(src, down, cv::Size(src.cols / 2, src.rows / 2), 0.0, 0.0, cv::INTER_AREA);
+
+	return PushRows(level - 1, down);
+}
+
+bool cDziWriter::WriteRows(const cv::Mat &rows)
+{
+	TRACE_SCOPE_WAIFU2X("cDziWriter::WriteRows");
+
+	if (!mIsOpen || mIsError || mLevelList.empty())
+		return false;
+
+	auto &top = mLevelList.back();
+	if (rows.cols != top.size.width || rows.channels() != mChannel || top.rows_y + top.rows.rows + rows.rows > top.size.height)
+		return false;
+
+	if (!PushRows((int)mLevelList.size() - 1, stImage::ConvertTo8bit(rows)))
+	{
+		mIsError = true;
+		return false;
+	}
+
+	return true;
+}
+
+bool cDziWriter::WriteDescriptor() const
+{
+	const auto &size = mLevelList.back().size;
+
+	try
+	{
+		boost::filesystem::ofstream ofs(mPath, std::ios::out | std::ios::trunc);
+		ofs << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+		ofs << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"" << mFormat << "\" Overlap=\"" << mOverlap << "\" TileSize=\"" << mTileSize << "\">\n";
+		ofs << "  <Size Width=\"" << size.width << "\" Height=\"" << size.height << "\"/>\n";
+		ofs << "</Image>\n";
+
+		return (bool)ofs;
+	}
+	catch (...)
+	{}
+
+	return false;
+}
+
+bool cDziWriter::Close()
+{
+	if (!mIsOpen)
+		return false;
+
+	mIsOpen = false;
+
+	// SẴx̑SẴ^C̍s߂Ă邱
+	bool isOK = !mIsError;
+	for (const auto &l : mLevelList)
+	{
+		if (l.tile_row * mTileSize < l.size.height)
+			isOK = false;
+	}
+
+	mLevelList.clear();
+
+	if (!isOK)
+		return false;
+
+	return WriteDescriptor();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <boost/optional.hpp>
+#include "cRowWriter.h"
+
+
+// DeepZoom(DZI)̃^C̃s~bhォ珇ɏ
+// E󂯎s͈ԍׂx̃^CɂA2sk1̃xɓnƂSẴxŌJԂ
+// Eex̂̓^C1s(ƏdȂ̕)̍sȂ̂ŁAo͉摜Ŝs~bhɎȂ
+// E^C̓`lPNGAJPEG(8bit)ŁA.dzi̋Lqt@C͑SẴ^C߂Ă
+class cDziWriter : public cRowWriter
+{
+private:
+	struct stLevel
+	{
+		cv::Size_<int> size;
+		cv::Mat rows; // 󂯎Ă܂gs(8bit)
+		int rows_y; // rows̐擪̍s̈ʒu
+		int tile_row; // ɏރ^C̍s
+		cv::Mat pending; // 1̃xɓn߂ɏk҂Ăs(2sk)
+	};
+
+	boost::filesystem::path mPath;
+	boost::filesystem::path mTileDir; // (O)_files
+	std::string mFormat; // "jpg" or "png"
+	boost::optional<int> mQuality;
+	int mTileSize;
+	int mOverlap;
+	int mChannel;
+
+	std::vector<stLevel> mLevelList; // Yx(01x1)
+	bool mIsOpen;
+	bool mIsError;
+
+private:
+	// levelrowsǉA^C̍sŁAks1̃xɓn
+	bool PushRows(const int level, const cv::Mat &rows);
+	bool WriteTileRow(const int level);
+	bool WriteDescriptor() const;
+
+public:
+	// quality: JPEG̉掿(OpenCṼftHg)
+	// tile_size: dȂ^C̑傫
+	// overlap: ׂ̃^CƏd˂f
+	explicit cDziWriter(const boost::optional<int> &quality = boost::optional<int>(), const int tile_size = 254, const int overlap = 1);
+	~cDziWriter();
+
+	// path: .dzĩpXB^C͓tH_(O)_filestH_ɏ
+	bool Open(const boost::filesystem::path &path, const cv::Size_<int> &size, const int channel, const int depth);
+	bool IsOpen() const;
+	bool WriteRows(const cv::Mat &rows);
+	bool Close();
+};
@@ -0,0 +1,242 @@
+#include "cJobScheduler.h"
+#include <algorithm>
+#include "cTrace.h"
+#include "cMetrics.h"
+
+
+namespace
+{
+	const char * const PriorityNameList[] = {"interactive", "normal", "batch"};
+	const char * const PriorityLabelList[] = {"priority=\"interactive\"", "priority=\"normal\"", "priority=\"batch\""};
+
+	thread_local cJobScheduler *g_CurrentJobScheduler = nullptr;
+	thread_local int g_CurrentPriority = -1;
+
+	double ToSec(const std::chrono::steady_clock::duration &d)
+	{
+		return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+	}
+}
+
+
+cJobScheduler::cJobScheduler() : mJobNo(0), mIsStop(false)
+{
+	for (int i = 0; i < ePriorityNum; i++)
+	{
+		mIsRunning[i] = false;
+		mIsBlocked[i] = false;
+	}
+
+	for (int i = 0; i < ePriorityNum; i++)
+		mThread[i] = std::thread([this, i]() { RunnerThread((ePriority)i); });
+}
+
+cJobScheduler::~cJobScheduler()
+{
+	Stop();
+}
+
+bool cJobScheduler::HasHigherPriorityJob(const ePriority priority) const
+{
+	for (int i = 0; i < priority; i++)
+	{
+		// s̃Wu҂ĂԂ́A҂ĂWui܂Ȃ̂ŐȂ
+		if (mIsBlocked[i])
+			continue;
+
+		if (mIsRunning[i] || !mQueue[i].empty())
+			return true;
+	}
+
+	return false;
+}
+
+double cJobScheduler::Yield(const ePriority priority)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	if (!HasHigherPriorityJob(priority) || mIsStop)
+		return 0.0;
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto YieldStartTime = cTrace::Now();
+
+	mCond.wait(lock, [this, priority]() { return mIsStop || !HasHigherPriorityJob(priority); });
+
+	cTrace::AddEvent("cJobScheduler::Yield", YieldStartTime, cTrace::Now());
+
+	return ToSec(std::chrono::steady_clock::now() - start);
+}
+
+void cJobScheduler::RunnerThread(const ePriority priority)
+{
+	cTrace::SetThreadName(PriorityNameList[priority]);
+
+	g_CurrentJobScheduler = this;
+	g_CurrentPriority = priority;
+
+	while (true)
+	{
+		stJob job;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			// Dx̍WuԂ͊JnȂ
+			mCond.wait(lock, [this, priority]() { return mIsStop || (!mQueue[priority].empty() && !HasHigherPriorityJob(priority)); });
+			if (mIsStop)
+				break;
+
+			// ߐ؂̑Aߐ؂肪̂͌AȂǉ
+			auto &queue = mQueue[priority];
+			const auto it = std::min_element(queue.begin(), queue.end(), [](const stJob &a, const stJob &b)
+			{
+				if (a.has_deadline != b.has_deadline)
+					return a.has_deadline;
+				if (a.has_deadline && a.deadline != b.deadline)
+					return a.deadline < b.deadline;
+				return a.no < b.no;
+			});
+
+			job = std::move(*it);
+			queue.erase(it);
+
+			mIsRunning[priority] = true;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+
+		double yield_time = 0.0;
+		const Checkpoint checkpoint = [this, priority, &yield_time]()
+		{
+			yield_time += Yield(priority);
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mIsStop;
+		};
+
+		try
+		{
+			job.func(checkpoint);
+		}
+		catch (...)
+		{}
+
+		const auto end = std::chrono::steady_clock::now();
+
+		stJobResult result;
+		result.queue_time = ToSec(start - job.push_time);
+		result.run_time = ToSec(end - start);
+		result.yield_time = yield_time;
+		result.deadline_missed = job.has_deadline && end > job.deadline;
+
+		cMetrics::Observe("waifu2x_job_queue_seconds", result.queue_time, PriorityLabelList[priority]);
+		cMetrics::Observe("waifu2x_job_seconds", result.run_time, PriorityLabelList[priority]);
+		if (result.deadline_missed)
+			cMetrics::Increment("waifu2x_job_deadline_missed_total", 1, PriorityLabelList[priority]);
+
+		// WaitAll()߂OɏI̒ʒmςނ悤ɁAs̃tO낷OɌĂ
+		if (job.done)
+		{
+			try
+			{
+				job.done(result);
+			}
+			catch (...)
+			{}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mIsRunning[priority] = false;
+			mIsBlocked[priority] = false;
+		}
+		mCond.notify_all();
+	}
+
+	g_CurrentJobScheduler = nullptr;
+	g_CurrentPriority = -1;
+}
+
+void cJobScheduler::Push(const ePriority priority, const TimePoint *deadline, JobFunc func, DoneFunc done)
+{
+	stJob job;
+	job.push_time = std::chrono::steady_clock::now();
+	job.has_deadline = deadline != nullptr;
+	if (deadline)
+		job.deadline = *deadline;
+	job.func = std::move(func);
+	job.done = std::move(done);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		job.no = mJobNo++;
+		mQueue[priority].push_back(std::move(job));
+	}
+	mCond.notify_all();
+}
+
+void cJobScheduler::WaitAll()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mCond.wait(lock, [this]()
+	{
+		for (int i = 0; i < ePriorityNum; i++)
+		{
+			if (mIsRunning[i] || !mQueue[i].empty())
+				return false;
+		}
+
+		return true;
+	});
+}
+
+void cJobScheduler::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mIsStop = true;
+
+		for (int i = 0; i < ePriorityNum; i++)
+			mQueue[i].clear();
+	}
+	mCond.notify_all();
+
+	for (int i = 0; i < ePriorityNum; i++)
+	{
+		if (mThread[i].joinable())
+			mThread[i].join();
+	}
+}
+
+bool cJobScheduler::ParsePriority(const std::string &name, ePriority &priority)
+{
+	for (int i = 0; i < ePriorityNum; i++)
+	{
+		if (name == PriorityNameList[i])
+		{
+			priority = (ePriority)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char* cJobScheduler::GetPriorityName(const ePriority priority)
+{
+	return PriorityNameList[priority];
+}
+
+void cJobScheduler::SetCurrentJobBlocked(const bool blocked)
+{
+	cJobScheduler *scheduler = g_CurrentJobScheduler;
+	if (!scheduler)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(scheduler->mMutex);
+		scheduler->mIsBlocked[g_CurrentPriority] = blocked;
+	}
+	scheduler->mCond.notify_all();
+}
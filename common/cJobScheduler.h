@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Dxƒߐ؂WũXPW[
+// EDxƂ1̎sXbhADx̃Wu͒ߐ؂̑(Ȃǉ)Ɏs
+// EDx̍Wu҂Ă邩s̊ԁADx̒ႢWu͊JnA
+//   ŝ̂̓`FbN|Cg(ubNlbgɒʂ)Ŏ~܂ď
+//   (傫ob`słAΘbIȃWȗ҂Ԃ̓ubN1񕪂ōς)
+class cJobScheduler
+{
+public:
+	enum ePriority
+	{
+		ePriorityInteractive = 0,
+		ePriorityNormal,
+		ePriorityBatch,
+		ePriorityNum,
+	};
+
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	// Wȕ
+	struct stJobResult
+	{
+		double queue_time; // ǉĂJn܂ł̎(b)
+		double run_time; // JnĂI܂ł̎(ĂԂ܂ށAb)
+		double yield_time; // Dx̍WuɏĂ(b)
+		bool deadline_missed; // ߐ؂܂łɏIȂ
+	};
+
+	// checkpoint: ubN̏̊ԂɌĂԊ֐BDx̍WuΏI܂ő҂
+	//             XPW[~ꍇtrue(f)Ԃ(Waifu2x::waifu2xCancelFuncƂĂ̂܂ܓn)
+	typedef std::function<bool()> Checkpoint;
+	typedef std::function<void(const Checkpoint &checkpoint)> JobFunc;
+	// WuIƂ(sXbh)Ă΂
+	typedef std::function<void(const stJobResult &result)> DoneFunc;
+
+private:
+	struct stJob
+	{
+		uint64_t no; // ǉ
+		TimePoint push_time;
+		TimePoint deadline;
+		bool has_deadline;
+		JobFunc func;
+		DoneFunc done;
+	};
+
+	std::mutex mMutex;
+	std::condition_variable mCond;
+
+	std::vector<stJob> mQueue[ePriorityNum];
+	bool mIsRunning[ePriorityNum];
+	bool mIsBlocked[ePriorityNum]; // s̃WũWȕI҂Ă(Dx̒ႢWu~߂Ȃ)
+	std::thread mThread[ePriorityNum];
+
+	uint64_t mJobNo;
+	bool mIsStop;
+
+private:
+	void RunnerThread(const ePriority priority);
+
+	// priorityDx̍Wu҂Ă邩sȂtrue(mMutexbNČĂԂ)
+	bool HasHigherPriorityJob(const ePriority priority) const;
+
+	// Dx̍WuȂ܂ő҂B҂(b)Ԃ
+	double Yield(const ePriority priority);
+
+public:
+	cJobScheduler();
+	~cJobScheduler();
+
+	// deadline: ߐ؂(ꍇnullptr)
+	void Push(const ePriority priority, const TimePoint *deadline, JobFunc func, DoneFunc done = nullptr);
+
+	// ǉWuSďI܂ő҂
+	void WaitAll();
+
+	// ҂ĂWujAs̃Wũ`FbN|CgŒfāAXbhI
+	void Stop();
+
+	// Dx̖O("interactive", "normal", "batch")ϊBsȖOȂfalse
+	static bool ParsePriority(const std::string &name, ePriority &priority);
+	static const char* GetPriorityName(const ePriority priority);
+
+	// s̃WuDx̒ႢWu̐is҂(\Z̉҂Ȃ)AtrueɂČĂ
+	// ̊Ԃ͗Dx̒ႢWu~߂Ȃ(~߂ƌ݂ɑ҂Ă܂)BsXbhȊOĂ񂾏ꍇ͉Ȃ
+	static void SetCurrentJobBlocked(const bool blocked);
+};
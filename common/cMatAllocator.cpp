@@ -0,0 +1,401 @@
+#include "cMatAllocator.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "cMetrics.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <stdlib.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+struct cMatAllocator::stMapping
+{
+	void *data;
+	size_t size; // }bv傫(q[Wy[W̏ꍇ͐؂グ)
+#ifdef _WIN32
+	HANDLE file; // q[Wy[W̏ꍇNULL
+	HANDLE map;
+#endif
+};
+
+namespace
+{
+	// XgChw肳ĂȂƂ\l(CV_AUTOSTEPƓ)
+	const size_t AutoStep = 0x7fffffff;
+
+#ifndef _WIN32
+	// Transparent Huge Pages̑傫(x86-64, AArch644KBy[W̏ꍇ)
+	const size_t TransparentHugePageSize = 2 * 1024 * 1024;
+
+	// \񂳂ꂽq[Wy[W(MAP_HUGETLB)̑傫B/proc/meminfoHugepagesize(VXẽftHg)ŁAǂ߂Ȃ2MB
+	size_t GetExplicitHugePageSize()
+	{
+		static const size_t pageSize = []() -> size_t
+		{
+			std::ifstream ifs("/proc/meminfo");
+
+			std::string line;
+			while (std::getline(ifs, line))
+			{
+				unsigned long long kb = 0;
+				if (sscanf(line.c_str(), "Hugepagesize: %llu kB", &kb) == 1 && kb > 0)
+					return (size_t)kb * 1024;
+			}
+
+			return TransparentHugePageSize;
+		}();
+
+		return pageSize;
+	}
+#endif
+
+	// modeŊmۂq[Wy[W̑傫(gȂ0)
+	size_t GetHugePageSize(const cMatAllocator::eHugePageMode mode)
+	{
+#ifdef _WIN32
+		return mode == cMatAllocator::eHugePageModeExplicit ? GetLargePageMinimum() : 0;
+#else
+		if (mode == cMatAllocator::eHugePageModeExplicit)
+			return GetExplicitHugePageSize();
+		else if (mode == cMatAllocator::eHugePageModeTransparent)
+			return TransparentHugePageSize;
+
+		return 0;
+#endif
+	}
+
+	std::mutex g_DirMutex;
+	boost::filesystem::path g_Dir;
+
+	std::atomic<size_t> g_Threshold(0);
+
+	std::atomic<int> g_HugePageMode(cMatAllocator::eHugePageModeNone);
+	std::atomic<size_t> g_HugePageThreshold(0);
+
+#ifdef _WIN32
+	// [Wy[W̊mۂɂSeLockMemoryPrivilegev([U[Ɍ蓖ĂĂĂLɂKv)
+	void EnableLockMemoryPrivilege()
+	{
+		HANDLE token = NULL;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+			return;
+
+		TOKEN_PRIVILEGES tp;
+		tp.PrivilegeCount = 1;
+		tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		if (LookupPrivilegeValueW(NULL, L"SeLockMemoryPrivilege", &tp.Privileges[0].Luid))
+			AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL);
+
+		CloseHandle(token);
+	}
+#endif
+}
+
+
+cMatAllocator::cMatAllocator()
+{}
+
+cMatAllocator::stMapping* cMatAllocator::MapFile(const size_t size) const
+{
+	boost::filesystem::path dir;
+	{
+		std::lock_guard<std::mutex> lock(g_DirMutex);
+		dir = g_Dir;
+	}
+
+	if (dir.empty())
+		dir = ".";
+
+#ifdef _WIN32
+	wchar_t tmpName[MAX_PATH];
+	if (GetTempFileNameW(dir.wstring().c_str(), L"w2x", 0, tmpName) == 0)
+		return nullptr;
+
+	// Ƃɍ폜悤ɊJ
+	HANDLE file = CreateFileW(tmpName, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		DeleteFileW(tmpName);
+		return nullptr;
+	}
+
+	const uint64_t size64 = size;
+	HANDLE map = CreateFileMappingW(file, NULL, PAGE_READWRITE, (DWORD)(size64 >> 32), (DWORD)size64, NULL);
+	if (!map)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	void *data = MapViewOfFile(map, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!data)
+	{
+		CloseHandle(map);
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	stMapping *mapping = new stMapping;
+	mapping->data = data;
+	mapping->size = size;
+	mapping->file = file;
+	mapping->map = map;
+#else
+	std::string tmpName = (dir / "waifu2x_scratch_XXXXXX").string();
+
+	const int fd = mkstemp(&tmpName[0]);
+	if (fd < 0)
+		return nullptr;
+
+	// }bvĂԂ͊J܂܂Ȃ̂ŁAO͂ɏĂ
+	unlink(tmpName.c_str());
+
+	if (ftruncate(fd, (off_t)size) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	stMapping *mapping = new stMapping;
+	mapping->data = data;
+	mapping->size = size;
+#endif
+
+	cMetrics::Increment("waifu2x_scratch_allocations_total");
+	cMetrics::Increment("waifu2x_scratch_bytes_total", (int64_t)size);
+
+	return mapping;
+}
+
+cMatAllocator::stMapping* cMatAllocator::MapHugePages(const size_t size, const eHugePageMode mode) const
+{
+#ifdef _WIN32
+	// WindowsɂTransparent Huge Pagesɓ̂
+	if (mode != eHugePageModeExplicit)
+		return nullptr;
+
+	static std::once_flag privilegeFlag;
+	std::call_once(privilegeFlag, EnableLockMemoryPrivilege);
+
+	const size_t pageSize = GetLargePageMinimum();
+	if (pageSize == 0)
+		return nullptr;
+
+	const size_t alignedSize = (size + pageSize - 1) / pageSize * pageSize;
+
+	void *data = VirtualAlloc(NULL, alignedSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	if (!data)
+		return nullptr;
+
+	stMapping *mapping = new stMapping;
+	mapping->data = data;
+	mapping->size = alignedSize;
+	mapping->file = NULL;
+	mapping->map = NULL;
+
+	const char *type = "type=\"explicit\"";
+#else
+	size_t alignedSize = 0;
+
+	void *data = MAP_FAILED;
+	const char *type = "type=\"explicit\"";
+
+#ifdef MAP_HUGETLB
+	// MAP_HUGETLB̓VXẽftHg̑傫̃q[Wy[Wmۂ̂ŁA̔{ɂ
+	if (mode == eHugePageModeExplicit)
+	{
+		const size_t pageSize = GetExplicitHugePageSize();
+		alignedSize = (size + pageSize - 1) / pageSize * pageSize;
+
+		data = mmap(nullptr, alignedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+
+#ifdef MADV_HUGEPAGE
+	if (data == MAP_FAILED) // \񂳂ꂽq[Wy[WȂTransparent Huge Pagesɂ
+	{
+		type = "type=\"transparent\"";
+
+		alignedSize = (size + TransparentHugePageSize - 1) / TransparentHugePageSize * TransparentHugePageSize;
+
+		// Transparent Huge Pages̓q[Wy[W̋EɑĂ͈͂ɂgȂ̂ŁA߂Ɋmۂđ
+		void *raw = mmap(nullptr, alignedSize + TransparentHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED)
+			return nullptr;
+
+		const size_t head = (TransparentHugePageSize - (uintptr_t)raw % TransparentHugePageSize) % TransparentHugePageSize;
+		const size_t tail = TransparentHugePageSize - head;
+
+		data = (unsigned char *)raw + head;
+		if (head > 0)
+			munmap(raw, head);
+		if (tail > 0)
+			munmap((unsigned char *)data + alignedSize, tail);
+
+		madvise(data, alignedSize, MADV_HUGEPAGE);
+	}
+#endif
+
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	stMapping *mapping = new stMapping;
+	mapping->data = data;
+	mapping->size = alignedSize;
+#endif
+
+	cMetrics::Increment("waifu2x_huge_page_allocations_total", 1, type);
+	cMetrics::Increment("waifu2x_huge_page_bytes_total", (int64_t)alignedSize);
+
+	return mapping;
+}
+
+void cMatAllocator::Unmap(stMapping *mapping) const
+{
+#ifdef _WIN32
+	if (!mapping->file)
+		VirtualFree(mapping->data, 0, MEM_RELEASE);
+	else
+	{
+		UnmapViewOfFile(mapping->data);
+		CloseHandle(mapping->map);
+		CloseHandle(mapping->file);
+	}
+#else
+	munmap(mapping->data, mapping->size);
+#endif
+
+	delete mapping;
+}
+
+// cv::StdMatAllocatorƓ菇ŁA傫̂}bv̈q[Wy[Wg
+cv::UMatData* cMatAllocator::allocate(int dims, const int *sizes, int type, void *data0, size_t *step, AccessFlagType flags, cv::UMatUsageFlags usageFlags) const
+{
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; i--)
+	{
+		if (step)
+		{
+			if (data0 && step[i] != AutoStep)
+			{
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			}
+			else
+				step[i] = total;
+		}
+
+		total *= sizes[i];
+	}
+
+	stMapping *mapping = nullptr;
+	if (!data0)
+	{
+		const size_t threshold = g_Threshold;
+		if (threshold > 0 && total >= threshold)
+			mapping = MapFile(total);
+
+		const eHugePageMode hugePageMode = (eHugePageMode)(int)g_HugePageMode;
+		if (!mapping && hugePageMode != eHugePageModeNone && total >= g_HugePageThreshold)
+			mapping = MapHugePages(total, hugePageMode);
+	}
+
+	uchar *data = (uchar *)data0;
+	if (mapping)
+		data = (uchar *)mapping->data;
+	else if (!data0)
+		data = (uchar *)cv::fastMalloc(total);
+
+	cv::UMatData *u = new cv::UMatData(this);
+	u->data = u->origdata = data;
+	u->size = total;
+	u->handle = mapping;
+	if (data0)
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+
+	return u;
+}
+
+bool cMatAllocator::allocate(cv::UMatData *u, AccessFlagType accessflags, cv::UMatUsageFlags usageFlags) const
+{
+	if (!u)
+		return false;
+
+	return true;
+}
+
+void cMatAllocator::deallocate(cv::UMatData *u) const
+{
+	if (!u)
+		return;
+
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+
+	if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+	{
+		if (u->handle)
+			Unmap((stMapping *)u->handle);
+		else
+			cv::fastFree(u->origdata);
+
+		u->origdata = 0;
+	}
+
+	delete u;
+}
+
+void cMatAllocator::UpdateDefaultAllocator()
+{
+	// mۂMatɔjȂ悤ɁAvZX̏I܂Ŏc
+	static cMatAllocator *allocator = new cMatAllocator;
+
+	if (g_Threshold > 0 || g_HugePageMode != eHugePageModeNone)
+		cv::Mat::setDefaultAllocator(allocator);
+	else
+		cv::Mat::setDefaultAllocator(nullptr);
+}
+
+void cMatAllocator::Enable(const boost::filesystem::path &dir, const size_t threshold)
+{
+	{
+		std::lock_guard<std::mutex> lock(g_DirMutex);
+		g_Dir = dir;
+	}
+	g_Threshold = (std::max)(threshold, (size_t)1);
+
+	UpdateDefaultAllocator();
+}
+
+void cMatAllocator::Disable()
+{
+	g_Threshold = 0;
+
+	UpdateDefaultAllocator();
+}
+
+void cMatAllocator::SetHugePages(const eHugePageMode mode, const size_t threshold)
+{
+	g_HugePageMode = mode;
+
+	// q[Wy[W1菬Mat͐؂グʂɂȂ邾Ȃ̂ŁAȂƂ1̑傫ɂ
+	g_HugePageThreshold = (std::max)(threshold, GetHugePageSize(mode));
+
+	UpdateDefaultAllocator();
+}
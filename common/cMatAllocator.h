@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <boost/filesystem.hpp>
+#include <opencv2/core.hpp>
+
+
+// 傫cv::Matꎞt@C}bv̈悩Aq[Wy[WɊmۂ
+// Ecv::Mat::setDefaultAllocator()ŒûŁAOpenCV̊֐̒ōMatΏۂɂȂ
+// El̊mۂAꎞt@Cq[Wy[WmۂłȂꍇ͕ʂɃɊmۂ
+// Eꎞt@C͍ɍ폜̂(Windowsł͕Ƃɍ폜)AُIĂcȂ
+class cMatAllocator : public cv::MatAllocator
+{
+public:
+#if CV_VERSION_MAJOR >= 4
+	typedef cv::AccessFlag AccessFlagType;
+#else
+	typedef int AccessFlagType;
+#endif
+
+	enum eHugePageMode
+	{
+		eHugePageModeNone,
+		eHugePageModeTransparent, // ʂɊmۂTransparent Huge Pagesg悤Ɏw(madviseBLinux̂)
+		eHugePageModeExplicit, // \񂳂ꂽq[Wy[Wmۂ(MAP_HUGETLB, MEM_LARGE_PAGES)BłȂeHugePageModeTransparentƓ
+	};
+
+private:
+	struct stMapping;
+
+private:
+	cMatAllocator();
+
+	// ꎞt@CsizeoCg}bvBłȂnullptr
+	stMapping* MapFile(const size_t size) const;
+	// sizeoCgq[Wy[WŊmۂBłȂnullptr
+	stMapping* MapHugePages(const size_t size, const eHugePageMode mode) const;
+	void Unmap(stMapping *mapping) const;
+
+	// ꎞt@Cq[Wy[WgݒȂ炱̃NXftHgɂ
+	static void UpdateDefaultAllocator();
+
+public:
+	cv::UMatData* allocate(int dims, const int *sizes, int type, void *data, size_t *step, AccessFlagType flags, cv::UMatUsageFlags usageFlags) const;
+	bool allocate(cv::UMatData *data, AccessFlagType accessflags, cv::UMatUsageFlags usageFlags) const;
+	void deallocate(cv::UMatData *data) const;
+
+	// dir: ꎞt@CtH_([JSSD𐄏)
+	// threshold: ̑傫(oCgP)ȏMatꎞt@CɊmۂ
+	// n߂OɌĂԂ
+	static void Enable(const boost::filesystem::path &dir, const size_t threshold);
+	// ʂ̃ɖ߂(mۍς݂Mat͉܂ňꎞt@Ĉ܂)
+	static void Disable();
+
+	// threshold: ̑傫(oCgP)ȏMatq[Wy[WɊmۂ(ꎞt@CɊmۂ̂)
+	// q[Wy[W1(explicit̓VXẽftHg̑傫AWindows̓[Wy[W̍ŏ̑傫)菬΂̑傫ɂ
+	// n߂OɌĂԂ
+	static void SetHugePages(const eHugePageMode mode, const size_t threshold);
+};
@@ -0,0 +1,167 @@
+#include "cMemoryBudget.h"
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "cTrace.h"
+#include "cMetrics.h"
+#include "cJobScheduler.h"
+
+
+namespace
+{
+	// ҂ĂԂcancel_funcmFԊu
+	const auto CancelCheckInterval = std::chrono::milliseconds(100);
+
+	std::mutex g_BudgetMutex;
+	std::condition_variable g_BudgetCond;
+
+	size_t g_Limit = 0;
+	size_t g_Reserved = 0;
+	int g_ReservedNum = 0;
+
+	uint64_t g_NextTicket = 0;
+	std::deque<uint64_t> g_WaitQueue; // \҂ĂWu̔ԍ()
+
+	// 擪̃Wu\ł邩(g_BudgetMutexbNČĂԂ)
+	bool CanAcquire(const size_t size)
+	{
+		if (g_Limit == 0 || g_ReservedNum == 0)
+			return true;
+
+		return g_Reserved + size <= g_Limit;
+	}
+}
+
+
+cMemoryBudget::cReservation::cReservation() : mSize(0), mIsAcquired(false)
+{}
+
+cMemoryBudget::cReservation::~cReservation()
+{
+	Release();
+}
+
+bool cMemoryBudget::cReservation::Acquire(const size_t size, const CancelFunc &cancel_func)
+{
+	Release();
+
+	if (!cMemoryBudget::Acquire(size, cancel_func))
+		return false;
+
+	mSize = size;
+	mIsAcquired = true;
+
+	return true;
+}
+
+void cMemoryBudget::cReservation::Release()
+{
+	if (!mIsAcquired)
+		return;
+
+	cMemoryBudget::Release(mSize);
+
+	mSize = 0;
+	mIsAcquired = false;
+}
+
+void cMemoryBudget::SetLimit(const size_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(g_BudgetMutex);
+		g_Limit = bytes;
+	}
+	g_BudgetCond.notify_all();
+}
+
+size_t cMemoryBudget::GetLimit()
+{
+	std::lock_guard<std::mutex> lock(g_BudgetMutex);
+	return g_Limit;
+}
+
+size_t cMemoryBudget::GetReserved()
+{
+	std::lock_guard<std::mutex> lock(g_BudgetMutex);
+	return g_Reserved;
+}
+
+bool cMemoryBudget::Acquire(const size_t size, const CancelFunc &cancel_func)
+{
+	std::unique_lock<std::mutex> lock(g_BudgetMutex);
+
+	if (g_WaitQueue.empty() && CanAcquire(size))
+	{
+		g_Reserved += size;
+		g_ReservedNum++;
+
+		cMetrics::Observe("waifu2x_memory_admission_wait_seconds", 0.0);
+
+		return true;
+	}
+
+	const uint64_t ticket = g_NextTicket++;
+	g_WaitQueue.push_back(ticket);
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto WaitStartTime = cTrace::Now();
+
+	// Dx̒ႢWu\Ă邱Ƃ̂ŁA҂ĂԂ͏点Ȃ
+	cJobScheduler::SetCurrentJobBlocked(true);
+
+	bool isCancel = false;
+	while (!(g_WaitQueue.front() == ticket && CanAcquire(size)))
+	{
+		if (!cancel_func)
+		{
+			g_BudgetCond.wait(lock);
+			continue;
+		}
+
+		g_BudgetCond.wait_for(lock, CancelCheckInterval);
+
+		// cancel_func͒ő҂Ƃ̂ŃbNOČĂ
+		lock.unlock();
+		isCancel = cancel_func();
+		lock.lock();
+
+		if (isCancel)
+			break;
+	}
+
+	g_WaitQueue.erase(std::find(g_WaitQueue.begin(), g_WaitQueue.end(), ticket));
+
+	if (!isCancel)
+	{
+		g_Reserved += size;
+		g_ReservedNum++;
+	}
+
+	lock.unlock();
+
+	cJobScheduler::SetCurrentJobBlocked(false);
+
+	// ̃Wu擪ɂȂ̂ŋN
+	g_BudgetCond.notify_all();
+
+	cTrace::AddEvent("cMemoryBudget::Wait", WaitStartTime, cTrace::Now());
+
+	const double waitTime = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+	cMetrics::Observe("waifu2x_memory_admission_wait_seconds", waitTime);
+	cMetrics::Increment("waifu2x_memory_admission_waits_total");
+
+	return !isCancel;
+}
+
+void cMemoryBudget::Release(const size_t size)
+{
+	{
+		std::lock_guard<std::mutex> lock(g_BudgetMutex);
+		g_Reserved -= std::min(size, g_Reserved);
+		g_ReservedNum--;
+	}
+	g_BudgetCond.notify_all();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+
+
+// vZXŜ̃\ZœɏWu𐧌
+// EWu͏Oɐ肵s[Ñgpʂ\񂵁A\ZɎ܂ȂΑ̃Wu܂ő҂
+// E\͗ɒʂ(傫WuWuɒǂzꑱȂ悤)
+// E\Z傫WúAɗ\񂪖ȂĂ1ʂ
+class cMemoryBudget
+{
+public:
+	// trueԂƑ҂̂߂(Waifu2x::waifu2xCancelFuncƓ)
+	typedef std::function<bool()> CancelFunc;
+
+	// \AjƂɉ
+	class cReservation
+	{
+	private:
+		size_t mSize;
+		bool mIsAcquired;
+
+	public:
+		cReservation();
+		~cReservation();
+
+		// sizeoCg\񂷂(\ς݂Ȃɉ)Bcancel_funcŒfꍇfalse
+		bool Acquire(const size_t size, const CancelFunc &cancel_func = nullptr);
+		void Release();
+	};
+
+	// bytes: \Z(oCgP)B0Ȃ琧Ȃ
+	static void SetLimit(const size_t bytes);
+	static size_t GetLimit();
+
+	// \񒆂̍v(oCgP)
+	static size_t GetReserved();
+
+	static bool Acquire(const size_t size, const CancelFunc &cancel_func = nullptr);
+	static void Release(const size_t size);
+};
@@ -0,0 +1,332 @@
+#include "cMetrics.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+
+
+namespace
+{
+	enum eMetricType
+	{
+		eMetricTypeCounter,
+		eMetricTypeHistogram,
+	};
+
+	struct stMetricInfo
+	{
+		const char *name;
+		eMetricType type;
+		bool has_labels; // truȅꍇ͈xL^ĂȂΏo͂Ȃ
+		const char *help;
+	};
+
+	// m̃gNX
+	// ɖgNXL^ł邪AHELPo͂Ȃ
+	const stMetricInfo MetricInfoList[] =
+	{
+		{"waifu2x_images_processed_total", eMetricTypeCounter, false, "Number of images processed successfully."},
+		{"waifu2x_errors_total", eMetricTypeCounter, true, "Number of failed images by error code."},
+		{"waifu2x_tiles_processed_total", eMetricTypeCounter, false, "Number of tiles passed through a network."},
+		{"waifu2x_tiles_skipped_total", eMetricTypeCounter, false, "Number of tiles that did not need a network pass."},
+		{"waifu2x_reduced_decodes_total", eMetricTypeCounter, false, "Number of JPEG inputs decoded at a reduced (1/2, 1/4, 1/8) resolution."},
+		{"waifu2x_animation_pixels_reused_total", eMetricTypeCounter, false, "Number of animation frame pixels reused from the previous frame instead of a network pass."},
+		{"waifu2x_forward_batches_total", eMetricTypeCounter, false, "Number of network forward calls."},
+		{"waifu2x_forward_batch_tiles_total", eMetricTypeCounter, false, "Number of tiles in forward calls."},
+		{"waifu2x_forward_batch_slots_total", eMetricTypeCounter, false, "Number of batch slots in forward calls (occupancy = tiles / slots)."},
+		{"waifu2x_cache_requests_total", eMetricTypeCounter, true, "Number of cache lookups by cache and result."},
+		{"waifu2x_stage_seconds", eMetricTypeHistogram, true, "Processing time of each stage in seconds."},
+		{"waifu2x_job_queue_seconds", eMetricTypeHistogram, true, "Time from submission to start of daemon jobs in seconds by priority."},
+		{"waifu2x_job_seconds", eMetricTypeHistogram, true, "Run time of daemon jobs in seconds by priority (including time yielded to higher priorities)."},
+		{"waifu2x_job_deadline_missed_total", eMetricTypeCounter, true, "Number of daemon jobs that finished after their deadline by priority."},
+		{"waifu2x_memory_admission_wait_seconds", eMetricTypeHistogram, false, "Time jobs waited for the memory budget in seconds."},
+		{"waifu2x_memory_admission_waits_total", eMetricTypeCounter, false, "Number of jobs that had to wait for the memory budget."},
+		{"waifu2x_coalesced_requests_total", eMetricTypeCounter, false, "Number of daemon requests that shared the result of an identical in-flight request."},
+		{"waifu2x_write_queue_seconds", eMetricTypeHistogram, false, "Time encoded images waited in the writer queue in seconds."},
+		{"waifu2x_write_errors_total", eMetricTypeCounter, false, "Number of asynchronous output writes that failed."},
+		{"waifu2x_scratch_allocations_total", eMetricTypeCounter, false, "Number of image buffers allocated in memory-mapped scratch files."},
+		{"waifu2x_scratch_bytes_total", eMetricTypeCounter, false, "Bytes allocated in memory-mapped scratch files."},
+		{"waifu2x_huge_page_allocations_total", eMetricTypeCounter, true, "Number of image and output buffers allocated in huge pages by type (explicit or transparent)."},
+		{"waifu2x_huge_page_bytes_total", eMetricTypeCounter, false, "Bytes allocated in huge pages."},
+	};
+
+	const double HistogramBuckets[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0};
+	const int HistogramBucketNum = sizeof(HistogramBuckets) / sizeof(HistogramBuckets[0]);
+
+	struct stHistogram
+	{
+		int64_t buckets[HistogramBucketNum]; // ݐςł͂ȂoPbgƂ̌
+		int64_t count;
+		double sum;
+
+		stHistogram() : count(0), sum(0.0)
+		{
+			std::fill(buckets, buckets + HistogramBucketNum, 0);
+		}
+	};
+
+	typedef std::pair<std::string, std::string> MetricKey; // O, x
+
+	std::mutex g_MetricsMutex;
+	std::map<MetricKey, int64_t> g_CounterMap;
+	std::map<MetricKey, stHistogram> g_HistogramMap;
+
+	const auto g_BaseTime = std::chrono::steady_clock::now();
+
+	std::mutex g_ExporterMutex;
+	std::condition_variable g_ExporterCond;
+	std::thread g_ExporterThread;
+	bool g_ExporterStop = false;
+
+	const stMetricInfo* FindMetricInfo(const std::string &name)
+	{
+		for (const auto &info : MetricInfoList)
+		{
+			if (name == info.name)
+				return &info;
+		}
+
+		return nullptr;
+	}
+
+	// xleǉ
+	std::string AppendLabel(const std::string &labels, const std::string &label)
+	{
+		if (labels.empty())
+			return "{" + label + "}";
+
+		return "{" + labels + "," + label + "}";
+	}
+
+	std::string FormatLabels(const std::string &labels)
+	{
+		if (labels.empty())
+			return "";
+
+		return "{" + labels + "}";
+	}
+}
+
+
+void cMetrics::Increment(const char *name, const int64_t value, const char *labels)
+{
+	std::lock_guard<std::mutex> lock(g_MetricsMutex);
+	g_CounterMap[MetricKey(name, labels)] += value;
+}
+
+void cMetrics::Observe(const char *name, const double value, const char *labels)
+{
+	const int index = (int)(std::lower_bound(HistogramBuckets, HistogramBuckets + HistogramBucketNum, value) - HistogramBuckets);
+
+	std::lock_guard<std::mutex> lock(g_MetricsMutex);
+	auto &h = g_HistogramMap[MetricKey(name, labels)];
+	if (index < HistogramBucketNum)
+		h.buckets[index]++;
+	h.count++;
+	h.sum += value;
+}
+
+double cMetrics::Now()
+{
+	return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - g_BaseTime).count();
+}
+
+int64_t cMetrics::GetCounter(const char *name, const char *labels)
+{
+	std::lock_guard<std::mutex> lock(g_MetricsMutex);
+	const auto it = g_CounterMap.find(MetricKey(name, labels));
+	if (it == g_CounterMap.end())
+		return 0;
+
+	return it->second;
+}
+
+bool cMetrics::GetHistogram(const char *name, const char *labels, int64_t &count, double &sum)
+{
+	std::lock_guard<std::mutex> lock(g_MetricsMutex);
+	const auto it = g_HistogramMap.find(MetricKey(name, labels));
+	if (it == g_HistogramMap.end())
+	{
+		count = 0;
+		sum = 0.0;
+		return false;
+	}
+
+	count = it->second.count;
+	sum = it->second.sum;
+	return true;
+}
+
+void cMetrics::Reset()
+{
+	std::lock_guard<std::mutex> lock(g_MetricsMutex);
+	g_CounterMap.clear();
+	g_HistogramMap.clear();
+}
+
+std::string cMetrics::ToPrometheusText()
+{
+	std::lock_guard<std::mutex> lock(g_MetricsMutex);
+
+	// m̃gNXɁAc͖Oɏo͂
+	std::vector<std::string> nameList;
+	for (const auto &info : MetricInfoList)
+		nameList.push_back(info.name);
+
+	std::set<std::string> otherNameSet;
+	for (const auto &p : g_CounterMap)
+	{
+		if (!FindMetricInfo(p.first.first))
+			otherNameSet.insert(p.first.first);
+	}
+	for (const auto &p : g_HistogramMap)
+	{
+		if (!FindMetricInfo(p.first.first))
+			otherNameSet.insert(p.first.first);
+	}
+	nameList.insert(nameList.end(), otherNameSet.begin(), otherNameSet.end());
+
+	std::ostringstream os;
+
+	for (const auto &name : nameList)
+	{
+		const auto info = FindMetricInfo(name);
+
+		const auto counterBegin = g_CounterMap.lower_bound(MetricKey(name, ""));
+		const auto histogramBegin = g_HistogramMap.lower_bound(MetricKey(name, ""));
+
+		const bool hasCounter = counterBegin != g_CounterMap.end() && counterBegin->first.first == name;
+		const bool hasHistogram = histogramBegin != g_HistogramMap.end() && histogramBegin->first.first == name;
+
+		const bool isHistogram = info ? info->type == eMetricTypeHistogram : !hasCounter;
+
+		if (info && info->help)
+			os << "# HELP " << name << " " << info->help << "\n";
+		os << "# TYPE " << name << (isHistogram ? " histogram" : " counter") << "\n";
+
+		if (!isHistogram)
+		{
+			if (!hasCounter)
+			{
+				if (info && !info->has_labels)
+					os << name << " 0\n";
+				continue;
+			}
+
+			for (auto it = counterBegin; it != g_CounterMap.end() && it->first.first == name; ++it)
+				os << name << FormatLabels(it->first.second) << " " << it->second << "\n";
+		}
+		else
+		{
+			if (!hasHistogram)
+				continue;
+
+			for (auto it = histogramBegin; it != g_HistogramMap.end() && it->first.first == name; ++it)
+			{
+				const auto &labels = it->first.second;
+				const auto &h = it->second;
+
+				int64_t cumulative = 0;
+				for (int i = 0; i < HistogramBucketNum; i++)
+				{
+					cumulative += h.buckets[i];
+
+					std::ostringstream le;
+					le << "le=\"" << HistogramBuckets[i] << "\"";
+					os << name << "_bucket" << AppendLabel(labels, le.str()) << " " << cumulative << "\n";
+				}
+				os << name << "_bucket" << AppendLabel(labels, "le=\"+Inf\"") << " " << h.count << "\n";
+				os << name << "_sum" << FormatLabels(labels) << " " << h.sum << "\n";
+				os << name << "_count" << FormatLabels(labels) << " " << h.count << "\n";
+			}
+		}
+	}
+
+	return os.str();
+}
+
+bool cMetrics::WritePrometheusFile(const boost::filesystem::path &output_file)
+{
+	const std::string text = ToPrometheusText();
+
+	const boost::filesystem::path tmp_file(output_file.native() + boost::filesystem::path(".tmp").native());
+
+	{
+		boost::iostreams::stream<boost::iostreams::file_descriptor> os;
+
+		try
+		{
+			os.open(tmp_file, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		}
+		catch (...)
+		{
+			return false;
+		}
+
+		if (!os)
+			return false;
+
+		os << text;
+
+		os.flush();
+		if (os.fail())
+			return false;
+	}
+
+	boost::system::error_code error;
+	boost::filesystem::rename(tmp_file, output_file, error);
+	if (error)
+	{
+		boost::filesystem::remove(tmp_file, error);
+		return false;
+	}
+
+	return true;
+}
+
+void cMetrics::StartExporter(const boost::filesystem::path &output_file, const int interval_sec)
+{
+	StopExporter();
+
+	{
+		std::lock_guard<std::mutex> lock(g_ExporterMutex);
+		g_ExporterStop = false;
+	}
+
+	g_ExporterThread = std::thread([output_file, interval_sec]()
+	{
+		std::unique_lock<std::mutex> lock(g_ExporterMutex);
+		while (!g_ExporterStop)
+		{
+			lock.unlock();
+			WritePrometheusFile(output_file);
+			lock.lock();
+
+			g_ExporterCond.wait_for(lock, std::chrono::seconds(std::max(interval_sec, 1)), []() { return g_ExporterStop; });
+		}
+
+		lock.unlock();
+		WritePrometheusFile(output_file);
+	});
+}
+
+void cMetrics::StopExporter()
+{
+	if (!g_ExporterThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(g_ExporterMutex);
+		g_ExporterStop = true;
+	}
+	g_ExporterCond.notify_all();
+
+	g_ExporterThread.join();
+}
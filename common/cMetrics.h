@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <boost/filesystem.hpp>
+
+
+// ⏈ԂȂǂ̓vvZXŜŏWv
+// Prometheus̃eLXg`ŏo͂ł(node_exportertextfile collectorŎWł)
+class cMetrics
+{
+public:
+	// name: gNX(Prometheus̖Kɏ])
+	// labels: x(: "stage=\"load\"")Bxꍇ͋󕶎
+	static void Increment(const char *name, const int64_t value = 1, const char *labels = "");
+
+	// qXgOɒlǉ(l͕bPʂz肵oPbgɐU蕪)
+	static void Observe(const char *name, const double value, const char *labels = "");
+
+	// vJňoߎ(b)
+	static double Now();
+
+	// Wvl擾B݂Ȃꍇ0
+	static int64_t GetCounter(const char *name, const char *labels = "");
+	static bool GetHistogram(const char *name, const char *labels, int64_t &count, double &sum);
+
+	// WvlS0ɖ߂
+	static void Reset();
+
+	// Prometheus̃eLXg`ɕϊ
+	static std::string ToPrometheusText();
+
+	// Prometheus̃eLXg`Ńt@Cɏo
+	// ǂݍݑ̃t@Cǂ܂Ȃ悤Ɉꎞt@CɏĂu
+	static bool WritePrometheusFile(const boost::filesystem::path &output_file);
+
+	// interval_secbƂWritePrometheusFile()ĂԃXbhJn
+	static void StartExporter(const boost::filesystem::path &output_file, const int interval_sec);
+	// XbhI(IOɍŐV̒lo)
+	static void StopExporter();
+};
@@ -1,4 +1,6 @@
 #include "cNet.h"
+#include "cTrace.h"
+#include "cMetrics.h"
 #include <caffe/caffe.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
@@ -7,6 +9,9 @@
 #include <google/protobuf/text_format.h>
 #include <rapidjson/document.h>
 #include <opencv2/imgproc.hpp>
+#include <atomic>
+#include <algorithm>
+#include "cTileScheduler.h"
 
 const int kProtoReadBytesLimit = INT_MAX;  // Max size of 2 GB minus 1 byte.
 
@@ -130,6 +135,23 @@ static Waifu2x::eWaifu2xError readProtoBinary(const boost::filesystem::path &pat
 
 namespace
 {
+	// ubNׂ̍(ׂ荇f̍̓敽ς̕Afl0`1)
+	double CalcTileComplexity(const cv::Mat &block)
+	{
+		const int w = block.size().width;
+		const int h = block.size().height;
+
+		if (w < 2 || h < 2)
+			return 0.0;
+
+		const double dx = cv::norm(block(cv::Rect(1, 0, w - 1, h)), block(cv::Rect(0, 0, w - 1, h)), cv::NORM_L2SQR);
+		const double dy = cv::norm(block(cv::Rect(0, 1, w, h - 1)), block(cv::Rect(0, 0, w, h - 1)), cv::NORM_L2SQR);
+
+		const double count = ((double)(w - 1) * h + (double)w * (h - 1)) * block.channels();
+
+		return sqrt((dx + dy) / count);
+	}
+
 	Waifu2x::eWaifu2xError ReadJson(const boost::filesystem::path &info_path, rapidjson::Document &d, std::vector<char> &jsonBuf)
 	{
 		try
@@ -168,7 +190,7 @@ namespace
 };
 
 
-cNet::cNet() : mModelScale(0), mInnerScale(0), mNetOffset(0), mInputPlane(0), mHasNoiseScaleModel(false)
+cNet::cNet() : mModelScale(0), mInnerScale(0), mNetOffset(0), mInputPlane(0), mHasNoiseScaleModel(false), mLoadTime(), mLoadLapTime(0)
 {}
 
 cNet::~cNet()
@@ -265,9 +287,16 @@ Waifu2x::eWaifu2xError cNet::GetInfo(const boost::filesystem::path & info_path,
 // processcudnnw肳ȂꍇcuDNNĂяoȂ悤ɕύX
 Waifu2x::eWaifu2xError cNet::ConstractNet(const Waifu2x::eWaifu2xModelType mode, const boost::filesystem::path &model_path, const boost::filesystem::path &param_path, const Waifu2x::stInfo &info, const std::string &process)
 {
+	TRACE_SCOPE_WAIFU2X("cNet::ConstractNet");
+
 	Waifu2x::eWaifu2xError ret;
 
+	mLoadTime = Waifu2x::stLoadTime();
+	const auto LoadStartTime = cTrace::Now();
+	mLoadLapTime = LoadStartTime;
+
 	mMode = mode;
+	mParamPath = param_path;
 
 	LoadParamFromInfo(mode, info);
 
@@ -282,18 +311,28 @@ Waifu2x::eWaifu2xError cNet::ConstractNet(const Waifu2x::eWaifu2xModelType mode,
 	const auto retModelBin = readProtoBinary(modelbin_path, &param_model);
 	const auto retParamBin = readProtoBinary(caffemodel_path, &param_caffemodel);
 
+	LapLoadTime("cNet::Parse", mLoadTime.parse);
+
 	if ( retParamBin == Waifu2x::eWaifu2xError_OK &&
 		(retModelBin == Waifu2x::eWaifu2xError_OK || retModelBin == Waifu2x::eWaifu2xError_FailedOpenModelFile))
 	{
+		mLoadTime.path = Waifu2x::eWaifu2xModelLoadPath_Protobin;
+
 		if (retModelBin == Waifu2x::eWaifu2xError_FailedOpenModelFile) // protobin݂̂ǂݍ߂ȂƂprototxtǂݍ(łprotobin)
 		{
+			mLoadTime.path = Waifu2x::eWaifu2xModelLoadPath_Prototxt;
+
 			ret = readProtoText(model_path, &param_model);
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
 
+			LapLoadTime("cNet::Parse", mLoadTime.parse);
+
 			ret = writeProtoBinary(param_model, modelbin_path);
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
+
+			LapLoadTime("cNet::Write", mLoadTime.write);
 		}
 
 		ret = SetParameter(param_model, process);
@@ -303,11 +342,20 @@ Waifu2x::eWaifu2xError cNet::ConstractNet(const Waifu2x::eWaifu2xModelType mode,
 		if (!caffe::UpgradeNetAsNeeded(caffemodel_path.string(), &param_caffemodel))
 			return Waifu2x::eWaifu2xError_FailedParseModelFile;
 
+		LapLoadTime("cNet::Parse", mLoadTime.parse);
+
 		mNet = boost::shared_ptr<caffe::Net<float>>(new caffe::Net<float>(param_model));
+
+		LapLoadTime("cNet::Construct", mLoadTime.construct);
+
 		mNet->CopyTrainedLayersFrom(param_caffemodel);
+
+		LapLoadTime("cNet::WeightCopy", mLoadTime.weight_copy);
 	}
 	else
 	{
+		mLoadTime.path = Waifu2x::eWaifu2xModelLoadPath_Json;
+
 		const auto ret = LoadParameterFromJson(model_path, param_path, modelbin_path, caffemodel_path, process);
 		if (ret != Waifu2x::eWaifu2xError_OK)
 			return ret;
@@ -320,9 +368,24 @@ Waifu2x::eWaifu2xError cNet::ConstractNet(const Waifu2x::eWaifu2xModelType mode,
 	if (mInputPlane != inputs[0]->channels())
 		return Waifu2x::eWaifu2xError_FailedConstructModel;
 
+	mLoadTime.total = (cTrace::Now() - LoadStartTime) / 1000000.0;
+
 	return Waifu2x::eWaifu2xError_OK;
 }
 
+void cNet::LapLoadTime(const char *name, double &time)
+{
+	const auto now = cTrace::Now();
+	cTrace::AddEvent(name, mLoadLapTime, now);
+	time += (now - mLoadLapTime) / 1000000.0;
+	mLoadLapTime = now;
+}
+
+const Waifu2x::stLoadTime& cNet::GetLoadTime() const
+{
+	return mLoadTime;
+}
+
 void cNet::LoadParamFromInfo(const Waifu2x::eWaifu2xModelType mode, const Waifu2x::stInfo &info)
 {
 	mModelScale = 2; // TODO: Iɐݒ肷悤ɂ
@@ -412,16 +475,22 @@ Waifu2x::eWaifu2xError cNet::LoadParameterFromJson(const boost::filesystem::path
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
 
+	LapLoadTime("cNet::Parse", mLoadTime.parse);
+
 	ret = writeProtoBinary(param, modelbin_path);
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
 
+	LapLoadTime("cNet::Write", mLoadTime.write);
+
 	ret = SetParameter(param, process);
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
 
 	mNet = boost::shared_ptr<caffe::Net<float>>(new caffe::Net<float>(param));
 
+	LapLoadTime("cNet::Construct", mLoadTime.construct);
+
 	rapidjson::Document d;
 	std::vector<char> jsonBuf;
 
@@ -477,6 +546,8 @@ Waifu2x::eWaifu2xError cNet::LoadParameterFromJson(const boost::filesystem::path
 	if (inputPlane != outputPlane)
 		return Waifu2x::eWaifu2xError_FailedParseModelFile;
 
+	LapLoadTime("cNet::Parse", mLoadTime.parse);
+
 	//if (param.layer_size() < 17)
 	//	return Waifu2x::eWaifu2xError_FailedParseModelFile;
 
@@ -560,11 +631,15 @@ Waifu2x::eWaifu2xError cNet::LoadParameterFromJson(const boost::filesystem::path
 			count++;
 		}
 
+		LapLoadTime("cNet::WeightCopy", mLoadTime.weight_copy);
+
 		mNet->ToProto(&param);
 
 		ret = writeProtoBinary(param, caffemodel_path);
 		if (ret != Waifu2x::eWaifu2xError_OK)
 			return ret;
+
+		LapLoadTime("cNet::Write", mLoadTime.write);
 	}
 	catch (...)
 	{
@@ -620,12 +695,116 @@ int cNet::GetOutputMemorySize(const int crop_w, const int crop_h, const int oute
 	return output_block_plane_size * batch_size * sizeof(float);
 }
 
+size_t cNet::GetBlobMemorySize() const
+{
+	size_t count = 0;
+
+	for (const auto &b : mNet->blobs())
+		count += b->count();
+
+	for (const auto &p : mNet->params())
+		count += p->count();
+
+	return count * sizeof(float);
+}
+
+size_t cNet::GetColBufferMemorySize() const
+{
+	size_t count = 0;
+
+	const auto &layers = mNet->layers();
+	const auto &bottom_vecs = mNet->bottom_vecs();
+	const auto &top_vecs = mNet->top_vecs();
+
+	// im2colpobt@̓C[ƂɊmۂ̂ōv
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		const auto &layer_param = layers[i]->layer_param();
+		const std::string &type = layer_param.type();
+
+		const bool isDeconv = type == "Deconvolution";
+		if (type != "Convolution" && !isDeconv)
+			continue;
+
+		const auto &conv_param = layer_param.convolution_param();
+		if (conv_param.engine() == caffe::ConvolutionParameter_Engine_CUDNN)
+			continue;
+
+		if (bottom_vecs[i].empty() || top_vecs[i].empty())
+			continue;
+
+		const int kernel_h = conv_param.has_kernel_h() ? conv_param.kernel_h() : conv_param.kernel_size(0);
+		const int kernel_w = conv_param.has_kernel_w() ? conv_param.kernel_w() : conv_param.kernel_size(conv_param.kernel_size_size() > 1 ? 1 : 0);
+		const int pad = conv_param.has_pad_h() ? conv_param.pad_h() : (conv_param.pad_size() > 0 ? conv_param.pad(0) : 0);
+		const int stride = conv_param.has_stride_h() ? conv_param.stride_h() : (conv_param.stride_size() > 0 ? conv_param.stride(0) : 1);
+
+		// 1x1ݍ݂im2colgȂ
+		if (kernel_h == 1 && kernel_w == 1 && pad == 0 && stride == 1)
+			continue;
+
+		const auto bottom = bottom_vecs[i][0];
+		const auto top = top_vecs[i][0];
+
+		const int group = conv_param.group();
+
+		// Deconvolution͏ݍ݂tɍŝœo̖͂ւ
+		const auto col_in = isDeconv ? top : bottom;
+		const auto col_out = isDeconv ? bottom : top;
+
+		const size_t kernel_dim = (size_t)col_in->channels() / group * kernel_h * kernel_w;
+		const size_t spatial_dim = (size_t)col_out->height() * col_out->width();
+
+		count += kernel_dim * spatial_dim;
+	}
+
+	return count * sizeof(float);
+}
+
+size_t cNet::EstimateBlobMemorySize(const int crop_w, const int crop_h, const int outer_padding, const int batch_size) const
+{
+	const auto &input = mNet->input_blobs()[0];
+
+	const int InputPadding = mNetOffset + outer_padding;
+	const double ratio_num = (double)batch_size / std::max(input->num(), 1);
+	const double ratio_area = (double)(crop_w + InputPadding * 2) * (crop_h + InputPadding * 2) / std::max(input->width() * input->height(), 1);
+
+	double count = 0.0;
+
+	// ԏo͂(ob`, `l, c, )Ȃ̂Ńob`ƖʐςɔႷ
+	for (const auto &b : mNet->blobs())
+	{
+		if (b->num_axes() == 4)
+			count += b->count() * ratio_num * ratio_area;
+		else
+			count += b->count();
+	}
+
+	for (const auto &p : mNet->params())
+		count += p->count();
+
+	return (size_t)count * sizeof(float);
+}
+
+size_t cNet::EstimateColBufferMemorySize(const int crop_w, const int crop_h, const int outer_padding) const
+{
+	const auto &input = mNet->input_blobs()[0];
+
+	const int InputPadding = mNetOffset + outer_padding;
+	const double ratio_area = (double)(crop_w + InputPadding * 2) * (crop_h + InputPadding * 2) / std::max(input->width() * input->height(), 1);
+
+	// im2colpobt@1̂Ńob`ɂ͈ˑȂ
+	return (size_t)(GetColBufferMemorySize() * ratio_area);
+}
+
 // lbg[Ngĉ摜č\z
-Waifu2x::eWaifu2xError cNet::ReconstructImage(const bool UseTTA, const int crop_w, const int crop_h, const int outer_padding, const int batch_size, float *outputBlockBuf, const cv::Mat &inMat, cv::Mat &outMat)
+Waifu2x::eWaifu2xError cNet::ReconstructImage(const bool UseTTA, const int crop_w, const int crop_h, const int outer_padding, const int batch_size, float *outputBlockBuf,
+	const Waifu2x::waifu2xCancelFunc cancel_func, const double skip_threshold, const cv::Mat &inMat, cv::Mat &outMat, cTileScheduler *scheduler, const std::function<cNet*(const int worker_no)> &get_worker_net,
+	const std::function<void(const cv::Mat &outMat, const cv::Rect &rect)> &tile_func)
 {
+	TRACE_SCOPE_WAIFU2X("cNet::ReconstructImage");
+
 	const auto InputHeight = inMat.size().height;
 	const auto InputWidth = inMat.size().width;
-	const auto InputLine = inMat.step1();
 
 	assert(inMat.channels() == 1 || inMat.channels() == 3);
 
@@ -636,183 +815,398 @@ Waifu2x::eWaifu2xError cNet::ReconstructImage(const bool UseTTA, const int crop_
 
 	cv::Mat outim(NoPaddingInputHeight * mInnerScale, NoPaddingInputWidth * mInnerScale, inMat.type());
 
-	// float *imptr = (float *)im.data;
-	float *imptr = (float *)outim.data;
+	stBlockLayout layout;
+	layout.crop_w = crop_w;
+	layout.crop_h = crop_h;
+	layout.batch_size = batch_size;
 
-	const auto input_block_width = crop_w + InputPadding * 2; // ̓ubNTCY()
-	const auto input_block_height = crop_h + InputPadding * 2; // ̓ubNTCY(c)
+	layout.input_block_width = crop_w + InputPadding * 2; // ̓ubNTCY()
+	layout.input_block_height = crop_h + InputPadding * 2; // ̓ubNTCY(c)
 
-	const auto output_block_width = input_block_width * mInnerScale - mNetOffset * 2; // o̓ubNTCY()
-	const auto output_block_height = input_block_height * mInnerScale - mNetOffset * 2; // o̓ubNTCY(c)
+	layout.output_block_width = layout.input_block_width * mInnerScale - mNetOffset * 2; // o̓ubNTCY()
+	layout.output_block_height = layout.input_block_height * mInnerScale - mNetOffset * 2; // o̓ubNTCY(c)
 
-	const auto output_crop_block_width = crop_w * mInnerScale; // Nbv̏o̓ubNTCY()
-	const auto output_crop_block_height = crop_h * mInnerScale; // Nbv̏o̓ubNTCY(c)
+	layout.output_crop_block_width = crop_w * mInnerScale; // Nbv̏o̓ubNTCY()
+	layout.output_crop_block_height = crop_h * mInnerScale; // Nbv̏o̓ubNTCY(c)
 
-	const auto output_crop_w = (output_block_width - crop_w * mInnerScale) / 2; // o͌̃NbvTCY
-	const auto output_crop_h = (output_block_height - crop_h * mInnerScale) / 2; // o͌̃NbvTCY
+	layout.output_crop_w = (layout.output_block_width - crop_w * mInnerScale) / 2; // o͌̃NbvTCY
+	layout.output_crop_h = (layout.output_block_height - crop_h * mInnerScale) / 2; // o͌̃NbvTCY
 
 	assert(NoPaddingInputWidth % crop_w == 0);
 	assert(NoPaddingInputHeight % crop_h == 0);
 
-	try
+	assert(inMat.channels() == mInputPlane);
+
+	layout.width_num = NoPaddingInputWidth / crop_w;
+	const int HeightNum = NoPaddingInputHeight / crop_h;
+
+	layout.tile_list = nullptr;
+
+	int BlockNum = layout.width_num * HeightNum;
+
+	// RȃubN̓lbgɒʂȂ
+	// lbgɓ͂OɍŋߖT@Ŋg傷郂fł́A͂猳̉摜ԂłȂ̂ōsȂ
+	// mCỸlbgł́A͂̂܂܎gƃlbgɒʂubNƂ̃mCY̍pڂɂȂ̂ōsȂ
+	std::vector<int> netTileList;
+	if (skip_threshold > 0.0 && mModelScale == mInnerScale && mInnerScale > 1)
 	{
-		auto input_blobs = mNet->input_blobs();
+		ReconstructFlatTiles(layout, HeightNum, InputPadding, skip_threshold, inMat, outim, netTileList);
 
-		assert(input_blobs.size() > 0);
+		layout.tile_list = netTileList.data();
+		BlockNum = (int)netTileList.size();
+	}
 
-		auto input_blob = mNet->input_blobs()[0];
+	// 񂾃ubNm点(RȃubN̓oCL[rbNŊg債Ȃ̂Œm点Ȃ)
+	const auto ReportBatch = [&layout, &outim, &tile_func](const int num, const int processNum)
+	{
+		if (!tile_func)
+			return;
 
-		input_blob->Reshape(batch_size, mInputPlane, input_block_height, input_block_width);
+		for (int n = 0; n < processNum; n++)
+		{
+			const int tile = layout.tile_list ? layout.tile_list[num + n] : num + n;
+			const int wn = tile % layout.width_num;
+			const int hn = tile / layout.width_num;
 
-		assert(inMat.channels() == mInputPlane);
-		assert(input_blob->shape(1) == mInputPlane);
+			tile_func(outim, cv::Rect(wn * layout.output_crop_block_width, hn * layout.output_crop_block_height,
+				layout.output_crop_block_width, layout.output_crop_block_height));
+		}
+	};
+
+	// 摜(̓s)block_size*block_sizeɕčč\z
+	if (scheduler && scheduler == cTileScheduler::GetCurrent() && BlockNum > batch_size)
+	{
+		// ob`Pʂ̃^XNɕāÃ[J[ɂĂ炤
+		// e^XN͏o͉摜̏dȂȂ̈ɏނ̂ŁAǂ̃[J[Ăʂ͓
+		const int MyWorkerNo = cTileScheduler::GetCurrentWorkerNo();
+		const int OutputBlockPlaneSize = layout.output_block_width * layout.output_block_height * mInputPlane;
+
+		std::atomic<int> error(Waifu2x::eWaifu2xError_OK);
 
-		const int WidthNum = NoPaddingInputWidth / crop_w;
-		const int HeightNum = NoPaddingInputHeight / crop_h;
+		cTileScheduler::cTaskGroup group;
+		for (int num = 0; num < BlockNum; num += batch_size)
+		{
+			const int processNum = (BlockNum - num) >= batch_size ? batch_size : BlockNum - num;
 
-		const int BlockNum = WidthNum * HeightNum;
+			scheduler->PushTile(group, [this, &layout, &inMat, &outim, &error, &get_worker_net, &cancel_func, &ReportBatch, num, processNum, MyWorkerNo, OutputBlockPlaneSize, outputBlockBuf](const int worker_no)
+			{
+				if (error != Waifu2x::eWaifu2xError_OK)
+					return;
+
+				// cancel_func̓XbhZ[tƂ͌Ȃ̂ŌĂяo[J[Ă
+				if (worker_no == MyWorkerNo && cancel_func && cancel_func())
+				{
+					error = Waifu2x::eWaifu2xError_Cancel;
+					return;
+				}
+
+				cNet *net = this;
+				float *buf = outputBlockBuf;
+
+				// ̃[J[ɓ܂ꂽ^XN͂̃[J[̃lbgƃobt@ŏ
+				if (worker_no != MyWorkerNo)
+				{
+					net = get_worker_net ? get_worker_net(worker_no) : nullptr;
+					if (!net || !IsSameStructure(*net))
+					{
+						error = Waifu2x::eWaifu2xError_FailedProcessCaffe;
+						return;
+					}
+
+					thread_local std::vector<float> StealOutputBlock;
+					if (StealOutputBlock.size() < (size_t)OutputBlockPlaneSize * processNum)
+						StealOutputBlock.resize((size_t)OutputBlockPlaneSize * processNum);
+
+					buf = StealOutputBlock.data();
+				}
+
+				const auto ret = net->ReconstructBatch(layout, num, processNum, buf, inMat, outim);
+				if (ret != Waifu2x::eWaifu2xError_OK)
+				{
+					error = ret;
+					return;
+				}
+
+				ReportBatch(num, processNum);
+			});
+		}
 
-		const int input_block_plane_size = input_block_width * input_block_height * mInputPlane;
-		const int output_block_plane_size = output_block_width * output_block_height * mInputPlane;
+		scheduler->Wait(group);
 
-		// 摜(̓s)block_size*block_sizeɕčč\z
+		if (error != Waifu2x::eWaifu2xError_OK)
+			return (Waifu2x::eWaifu2xError)(int)error;
+	}
+	else
+	{
 		for (int num = 0; num < BlockNum; num += batch_size)
 		{
+			if (cancel_func && cancel_func())
+				return Waifu2x::eWaifu2xError_Cancel;
+
 			const int processNum = (BlockNum - num) >= batch_size ? batch_size : BlockNum - num;
 
-			if (processNum < batch_size)
-				input_blob->Reshape(processNum, mInputPlane, input_block_height, input_block_width);
+			const auto ret = ReconstructBatch(layout, num, processNum, outputBlockBuf, inMat, outim);
+			if (ret != Waifu2x::eWaifu2xError_OK)
+				return ret;
+
+			ReportBatch(num, processNum);
+		}
+	}
+
+	// l0`1ɃNbsO
+	cv::threshold(outim, outim, 1.0, 1.0, cv::THRESH_TRUNC);
+	cv::threshold(outim, outim, 0.0, 0.0, cv::THRESH_TOZERO);
+
+	outMat = outim;
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+void cNet::ReconstructFlatTiles(const stBlockLayout &layout, const int height_num, const int input_padding, const double skip_threshold,
+	const cv::Mat &inMat, cv::Mat &outMat, std::vector<int> &netTileList) const
+{
+	TRACE_SCOPE_WAIFU2X("cNet::ReconstructFlatTiles");
+
+	const int WidthNum = layout.width_num;
+	const int BlockNum = WidthNum * height_num;
 
-			for (int n = 0; n < processNum; n++)
+	// lbg͔͈̓(̃pfBO܂)ōׂ𑪂
+	std::vector<char> isFlat(BlockNum);
+	for (int i = 0; i < BlockNum; i++)
+	{
+		const int w = (i % WidthNum) * layout.crop_w;
+		const int h = (i / WidthNum) * layout.crop_h;
+
+		isFlat[i] = CalcTileComplexity(inMat(cv::Rect(w, h, layout.input_block_width, layout.input_block_height))) < skip_threshold;
+	}
+
+	// 8̃ubNRȃubNlbgɒʂȂ
+	// lbgɒʂubNƂ̋ڂ͕RȃubNm̊ԂɂłȂ̂ŁApڂڗȂ
+	const auto IsSkip = [&](const int wn, const int hn)
+	{
+		for (int y = std::max(hn - 1, 0); y <= std::min(hn + 1, height_num - 1); y++)
+		{
+			for (int x = std::max(wn - 1, 0); x <= std::min(wn + 1, WidthNum - 1); x++)
 			{
-				const int wn = (num + n) % WidthNum;
-				const int hn = (num + n) / WidthNum;
+				if (!isFlat[y * WidthNum + x])
+					return false;
+			}
+		}
 
-				const int w = wn * crop_w;
-				const int h = hn * crop_h;
+		return true;
+	};
 
-				assert(w + input_block_width <= InputWidth && h + input_block_height <= InputHeight);
+	// oCL[rbNQƂ̉f
+	const int Margin = std::min(2, input_padding);
 
-				cv::Mat someimg = inMat(cv::Rect(w, h, input_block_width, input_block_height));
+	netTileList.clear();
+	netTileList.reserve(BlockNum);
 
-				// 摜𒼗ɕϊ
-				{
-					float *fptr = input_blob->mutable_cpu_data() + (input_block_plane_size * n);
-					const float *uptr = (const float *)someimg.data;
+	int skipNum = 0;
+	for (int i = 0; i < BlockNum; i++)
+	{
+		const int wn = i % WidthNum;
+		const int hn = i / WidthNum;
 
-					const auto Line = someimg.step1();
+		if (!IsSkip(wn, hn))
+		{
+			netTileList.push_back(i);
+			continue;
+		}
 
-					if (someimg.channels() == 1)
-					{
-						if (input_block_width == Line)
-							memcpy(fptr, uptr, input_block_width * input_block_height * sizeof(float));
-						else
-						{
-							for (int i = 0; i < input_block_height; i++)
-								memcpy(fptr + i * input_block_width, uptr + i * Line, input_block_width * sizeof(float));
-						}
-					}
+		const cv::Rect src_rect(wn * layout.crop_w + input_padding - Margin, hn * layout.crop_h + input_padding - Margin,
+			layout.crop_w + Margin * 2, layout.crop_h + Margin * 2);
+		const cv::Rect dst_rect(wn * layout.output_crop_block_width, hn * layout.output_crop_block_height,
+			layout.output_crop_block_width, layout.output_crop_block_height);
+
+		cv::Mat zoom;
+		cv::resize(inMat(src_rect), zoom, cv::Size(src_rect.width * mInnerScale, src_rect.height * mInnerScale), 0.0, 0.0, cv::INTER_CUBIC);
+		zoom(cv::Rect(Margin * mInnerScale, Margin * mInnerScale, dst_rect.width, dst_rect.height)).copyTo(outMat(dst_rect));
+
+		skipNum++;
+	}
+
+	cMetrics::Increment("waifu2x_tiles_skipped_total", skipNum);
+}
+
+// numԖڂprocessNum̃ubN1Forward()ŏāAʂoutMatɏ
+Waifu2x::eWaifu2xError cNet::ReconstructBatch(const stBlockLayout &layout, const int num, const int processNum, float *outputBlockBuf, const cv::Mat &inMat, cv::Mat &outMat)
+{
+	TRACE_SCOPE_WAIFU2X("cNet::TileBatch");
+
+	const auto InputHeight = inMat.size().height;
+	const auto InputWidth = inMat.size().width;
+
+	const int crop_w = layout.crop_w;
+	const int crop_h = layout.crop_h;
+	const int WidthNum = layout.width_num;
+
+	const int InputBlockPlaneSize = layout.input_block_width * layout.input_block_height * mInputPlane;
+	const int OutputBlockPlaneSize = layout.output_block_width * layout.output_block_height * mInputPlane;
+
+	float *outptr = (float *)outMat.data;
+
+	try
+	{
+		auto input_blobs = mNet->input_blobs();
+
+		assert(input_blobs.size() > 0);
+
+		auto input_blob = mNet->input_blobs()[0];
+
+		// قƂǂ̃ob`͓`Ȃ̂ŁAςƂύX
+		if (input_blob->num() != processNum || input_blob->channels() != mInputPlane
+			|| input_blob->height() != layout.input_block_height || input_blob->width() != layout.input_block_width)
+			input_blob->Reshape(processNum, mInputPlane, layout.input_block_height, layout.input_block_width);
+
+		assert(input_blob->shape(1) == mInputPlane);
+
+		const auto PackStartTime = cTrace::Now();
+
+		for (int n = 0; n < processNum; n++)
+		{
+			const int tile = layout.tile_list ? layout.tile_list[num + n] : num + n;
+			const int wn = tile % WidthNum;
+			const int hn = tile / WidthNum;
+
+			const int w = wn * crop_w;
+			const int h = hn * crop_h;
+
+			assert(w + layout.input_block_width <= InputWidth && h + layout.input_block_height <= InputHeight);
+
+			cv::Mat someimg = inMat(cv::Rect(w, h, layout.input_block_width, layout.input_block_height));
+
+			// 摜𒼗ɕϊ
+			{
+				float *fptr = input_blob->mutable_cpu_data() + (InputBlockPlaneSize * n);
+				const float *uptr = (const float *)someimg.data;
+
+				const auto Line = someimg.step1();
+
+				if (someimg.channels() == 1)
+				{
+					if (layout.input_block_width == Line)
+						memcpy(fptr, uptr, layout.input_block_width * layout.input_block_height * sizeof(float));
 					else
 					{
-						const auto LinePixel = someimg.step1() / someimg.channels();
-						const auto Channel = someimg.channels();
-						const auto Width = someimg.size().width;
-						const auto Height = someimg.size().height;
+						for (int i = 0; i < layout.input_block_height; i++)
+							memcpy(fptr + i * layout.input_block_width, uptr + i * Line, layout.input_block_width * sizeof(float));
+					}
+				}
+				else
+				{
+					const auto LinePixel = someimg.step1() / someimg.channels();
+					const auto Channel = someimg.channels();
+					const auto Width = someimg.size().width;
+					const auto Height = someimg.size().height;
 
-						for (int i = 0; i < Height; i++)
+					for (int i = 0; i < Height; i++)
+					{
+						for (int j = 0; j < Width; j++)
 						{
-							for (int j = 0; j < Width; j++)
+							for (int ch = 0; ch < Channel; ch++)
 							{
-								for (int ch = 0; ch < Channel; ch++)
-								{
-									const size_t IndexSrc = i * someimg.step1() + j * Channel + ch;
-									const size_t IndexDst = (ch * Height + i) * Width + j;
-									fptr[IndexDst] = uptr[IndexSrc];
-								}
+								const size_t IndexSrc = i * someimg.step1() + j * Channel + ch;
+								const size_t IndexDst = (ch * Height + i) * Width + j;
+								fptr[IndexDst] = uptr[IndexSrc];
 							}
 						}
 					}
 				}
 			}
+		}
 
-			assert(input_blob->count() == input_block_plane_size * processNum);
+		cTrace::AddEvent("cNet::Pack", PackStartTime, cTrace::Now());
 
-			// vZ
-			auto out = mNet->Forward();
+		assert(input_blob->count() == InputBlockPlaneSize * processNum);
 
-			auto b = out[0];
+		// vZ
+		const auto ForwardStartTime = cTrace::Now();
+		auto out = mNet->Forward();
+		const auto ForwardEndTime = cTrace::Now();
+		cTrace::AddEvent("cNet::Forward", ForwardStartTime, ForwardEndTime);
 
-			assert(b->count() == output_block_plane_size * processNum);
+		cMetrics::Observe("waifu2x_stage_seconds", (ForwardEndTime - ForwardStartTime) / 1000000.0, "stage=\"forward\"");
+		cMetrics::Increment("waifu2x_forward_batches_total");
+		cMetrics::Increment("waifu2x_forward_batch_tiles_total", processNum);
+		cMetrics::Increment("waifu2x_forward_batch_slots_total", layout.batch_size);
+		cMetrics::Increment("waifu2x_tiles_processed_total", processNum);
 
-			const float *ptr = nullptr;
+		TRACE_SCOPE_WAIFU2X("cNet::Unpack");
 
-			if (caffe::Caffe::mode() == caffe::Caffe::CPU)
-				ptr = b->cpu_data();
-			else
-				ptr = b->gpu_data();
+		auto b = out[0];
 
-			caffe::caffe_copy(output_block_plane_size * processNum, ptr, outputBlockBuf);
+		assert(b->count() == OutputBlockPlaneSize * processNum);
 
-			for (int n = 0; n < processNum; n++)
-			{
-				const int wn = (num + n) % WidthNum;
-				const int hn = (num + n) / WidthNum;
+		const float *ptr = nullptr;
 
-				const int w = wn * output_crop_block_width;
-				const int h = hn * output_crop_block_height;
+		if (caffe::Caffe::mode() == caffe::Caffe::CPU)
+			ptr = b->cpu_data();
+		else
+			ptr = b->gpu_data();
 
-				const float *fptr = outputBlockBuf + (output_block_plane_size * n);
+		caffe::caffe_copy(OutputBlockPlaneSize * processNum, ptr, outputBlockBuf);
 
-				const auto Line = outim.step1();
+		for (int n = 0; n < processNum; n++)
+		{
+			const int tile = layout.tile_list ? layout.tile_list[num + n] : num + n;
+			const int wn = tile % WidthNum;
+			const int hn = tile / WidthNum;
 
-				// ʂo͉摜ɃRs[
-				if (outim.channels() == 1)
-				{
-					for (int i = 0; i < output_crop_block_height; i++)
-						memcpy(imptr + (h + i) * Line + w, fptr + (i + output_crop_h) * output_block_width + output_crop_w, output_crop_block_width * sizeof(float));
-				}
-				else
-				{
-					const auto LinePixel = Line / outim.channels();
-					const auto Channel = outim.channels();
+			const int w = wn * layout.output_crop_block_width;
+			const int h = hn * layout.output_crop_block_height;
+
+			const float *fptr = outputBlockBuf + (OutputBlockPlaneSize * n);
+
+			const auto Line = outMat.step1();
 
-					for (int i = 0; i < output_crop_block_height; i++)
+			// ʂo͉摜ɃRs[
+			if (outMat.channels() == 1)
+			{
+				for (int i = 0; i < layout.output_crop_block_height; i++)
+					memcpy(outptr + (h + i) * Line + w, fptr + (i + layout.output_crop_h) * layout.output_block_width + layout.output_crop_w, layout.output_crop_block_width * sizeof(float));
+			}
+			else
+			{
+				const auto LinePixel = Line / outMat.channels();
+				const auto Channel = outMat.channels();
+
+				for (int i = 0; i < layout.output_crop_block_height; i++)
+				{
+					for (int j = 0; j < layout.output_crop_block_width; j++)
 					{
-						for (int j = 0; j < output_crop_block_width; j++)
+						for (int ch = 0; ch < Channel; ch++)
 						{
-							for (int ch = 0; ch < Channel; ch++)
-							{
-								const size_t IndexSrc = (ch * output_block_height + i + output_crop_h) * output_block_width + j + output_crop_w;
-								const size_t IndexDst = ((h + i) * LinePixel + (w + j)) * Channel + ch;
+							const size_t IndexSrc = (ch * layout.output_block_height + i + layout.output_crop_h) * layout.output_block_width + j + layout.output_crop_w;
+							const size_t IndexDst = ((h + i) * LinePixel + (w + j)) * Channel + ch;
 
-								imptr[IndexDst] = fptr[IndexSrc];
-							}
+							outptr[IndexDst] = fptr[IndexSrc];
 						}
 					}
 				}
-
-				//{
-				//	cv::Mat testim(output_block_size, output_block_size, CV_32FC1);
-				//	float *p = (float *)testim.data;
-				//	for (int i = 0; i < output_block_size; i++)
-				//	{
-				//		for (int j = 0; j < output_block_size; j++)
-				//		{
-				//			p[testim.step1() * i + j] = fptr[i * output_block_size + j];
-				//		}
-				//	}
-
-				//	const int cv_depth = DepthBitToCVDepth(8);
-				//	const double max_val = GetValumeMaxFromCVDepth(cv_depth);
-				//	const double eps = GetEPS(cv_depth);
-
-				//	cv::Mat write_iamge;
-				//	testim.convertTo(write_iamge, cv_depth, max_val, eps);
-
-				//	cv::imwrite("ti.png", write_iamge);
-				//	testim.release();
-				//}
 			}
+
+			//{
+			//	cv::Mat testim(output_block_size, output_block_size, CV_32FC1);
+			//	float *p = (float *)testim.data;
+			//	for (int i = 0; i < output_block_size; i++)
+			//	{
+			//		for (int j = 0; j < output_block_size; j++)
+			//		{
+			//			p[testim.step1() * i + j] = fptr[i * output_block_size + j];
+			//		}
+			//	}
+
+			//	const int cv_depth = DepthBitToCVDepth(8);
+			//	const double max_val = GetValumeMaxFromCVDepth(cv_depth);
+			//	const double eps = GetEPS(cv_depth);
+
+			//	cv::Mat write_iamge;
+			//	testim.convertTo(write_iamge, cv_depth, max_val, eps);
+
+			//	cv::imwrite("ti.png", write_iamge);
+			//	testim.release();
+			//}
 		}
 	}
 	catch (...)
@@ -820,15 +1214,17 @@ Waifu2x::eWaifu2xError cNet::ReconstructImage(const bool UseTTA, const int crop_
 		return Waifu2x::eWaifu2xError_FailedProcessCaffe;
 	}
 
-	// l0`1ɃNbsO
-	cv::threshold(outim, outim, 1.0, 1.0, cv::THRESH_TRUNC);
-	cv::threshold(outim, outim, 0.0, 0.0, cv::THRESH_TOZERO);
-
-	outMat = outim;
-
 	return Waifu2x::eWaifu2xError_OK;
 }
 
+bool cNet::IsSameStructure(const cNet &net) const
+{
+	// \łd݂ႦΌʂς̂ŁAd݂̃t@Cׂ
+	// (SetTileScheduler()Őݒ̈ႤWaifu2xXPW[LĂA̐ݒ̃lbgŏȂ)
+	return mMode == net.mMode && mModelScale == net.mModelScale && mInnerScale == net.mInnerScale
+		&& mNetOffset == net.mNetOffset && mInputPlane == net.mInputPlane && mParamPath == net.mParamPath;
+}
+
 std::string cNet::GetModelName(const boost::filesystem::path &info_path)
 {
 	Waifu2x::eWaifu2xError ret;
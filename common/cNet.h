@@ -1,11 +1,34 @@
 #pragma once
 
 #include <string>
+#include <functional>
 #include "waifu2x.h"
 
 
+class cTileScheduler;
+
+
 class cNet
 {
+private:
+	// ReconstructImage()ł̃ubN̔zu
+	struct stBlockLayout
+	{
+		int crop_w;
+		int crop_h;
+		int batch_size;
+		int width_num; // ̃ubN
+		int input_block_width; // ̓ubNTCY
+		int input_block_height;
+		int output_block_width; // o̓ubNTCY
+		int output_block_height;
+		int output_crop_block_width; // Nbv̏o̓ubNTCY
+		int output_crop_block_height;
+		int output_crop_w; // o͌̃NbvTCY
+		int output_crop_h;
+		const int *tile_list; // lbgɒʂubN̔ԍ̈ꗗ(nullptrȂSẴubNԍɒʂ)
+	};
+
 private:
 	Waifu2x::eWaifu2xModelType mMode;
 
@@ -16,13 +39,30 @@ private:
 	int mNetOffset; // lbgɓ͂Ƃǂꂭ炢邩
 	int mInputPlane; // lbgւ̓̓`l
 	bool mHasNoiseScaleModel;
+	boost::filesystem::path mParamPath; // d݂̃t@C(fmCYxႦΕʂ̃t@CɂȂ)
+
+	Waifu2x::stLoadTime mLoadTime;
+	int64_t mLoadLapTime;
 
 private:
+	// ǑĂяǒoߎԂtimeɉZ
+	void LapLoadTime(const char *name, double &time);
+
 	void LoadParamFromInfo(const Waifu2x::eWaifu2xModelType mode, const Waifu2x::stInfo &info);
 	Waifu2x::eWaifu2xError LoadParameterFromJson(const boost::filesystem::path &model_path, const boost::filesystem::path &param_path
 		, const boost::filesystem::path &modelbin_path, const boost::filesystem::path &caffemodel_path, const std::string &process);
 	Waifu2x::eWaifu2xError SetParameter(caffe::NetParameter &param, const std::string &process) const;
 
+	Waifu2x::eWaifu2xError ReconstructBatch(const stBlockLayout &layout, const int num, const int processNum, float *outputBlockBuf, const cv::Mat &inMat, cv::Mat &outMat);
+
+	// ׂskip_threshold̃ubNɈ͂܂ꂽRȃubNAlbgɒʂɃoCL[rbNŊg債outMatɏ
+	// lbgɒʂubN̔ԍnetTileListɕԂ
+	void ReconstructFlatTiles(const stBlockLayout &layout, const int height_num, const int input_padding, const double skip_threshold,
+		const cv::Mat &inMat, cv::Mat &outMat, std::vector<int> &netTileList) const;
+
+	// f̓d݂\zlbg(ubN̔zuʂɂȂ)Ȃtrue
+	bool IsSameStructure(const cNet &net) const;
+
 public:
 	cNet();
 	~cNet();
@@ -31,6 +71,9 @@ public:
 
 	Waifu2x::eWaifu2xError ConstractNet(const Waifu2x::eWaifu2xModelType mode, const boost::filesystem::path &model_path, const boost::filesystem::path &param_path, const Waifu2x::stInfo &info, const std::string &process);
 
+	// ConstractNet()ɂ(info͏0AtotalConstractNet()Ŝ̎)
+	const Waifu2x::stLoadTime& GetLoadTime() const;
+
 	int GetInputPlane() const;
 	int GetInnerScale() const;
 	int GetNetOffset() const;
@@ -39,7 +82,26 @@ public:
 	int GetInputMemorySize(const int crop_w, const int crop_h, const int outer_padding, const int batch_size) const;
 	int GetOutputMemorySize(const int crop_w, const int crop_h, const int outer_padding, const int batch_size) const;
 
-	Waifu2x::eWaifu2xError ReconstructImage(const bool UseTTA, const int crop_w, const int crop_h, const int outer_padding, const int batch_size, float *outputBlockBuf, const cv::Mat &inMat, cv::Mat &outMat);
+	// ݊mۂĂblob(ԏo͂Əd)̃TCY
+	size_t GetBlobMemorySize() const;
+	// im2colpobt@̃TCY(cuDNNgC[1x1ݍ݂͊܂܂Ȃ)
+	size_t GetColBufferMemorySize() const;
+
+	// crop_w, crop_h, batch_sizeŏƂblobim2colpobt@̃TCY̐l
+	// ݂̌`blob̓TCY̔Ŋg債ċ߂̂ŁA傫߂̒lɂȂ
+	size_t EstimateBlobMemorySize(const int crop_w, const int crop_h, const int outer_padding, const int batch_size) const;
+	size_t EstimateColBufferMemorySize(const int crop_w, const int crop_h, const int outer_padding) const;
+
+	// cancel_func: ob`Ƃ(ĂяoXbh)Ă΂AtrueԂeWaifu2xError_CancelŒf
+	// skip_threshold: 0傫΁ARȃubN̓lbgɒʂȂ(Waifu2x::SetTileSkipThreshold()Q)
+	// scheduler: [J[̃XbhĂԏꍇɎw肷ƁAob`Pʂ̃^XNɕđ̃[J[ɂ
+	// get_worker_net: ̃[J[ƂɎglbgԂ֐(̃[J[̃XbhŌĂ΂)
+	// tile_func: lbgɒʂubNo͉摜ɏނтɁAo͉摜(NbsOO)Ə񂾔͈͂nČĂ΂
+	//            schedulerw肵ꍇ͑̃[J[̃XbhĂ΂
+	Waifu2x::eWaifu2xError ReconstructImage(const bool UseTTA, const int crop_w, const int crop_h, const int outer_padding, const int batch_size, float *outputBlockBuf,
+		const Waifu2x::waifu2xCancelFunc cancel_func, const double skip_threshold, const cv::Mat &inMat, cv::Mat &outMat,
+		cTileScheduler *scheduler = nullptr, const std::function<cNet*(const int worker_no)> &get_worker_net = nullptr,
+		const std::function<void(const cv::Mat &outMat, const cv::Rect &rect)> &tile_func = nullptr);
 
 	static std::string GetModelName(const boost::filesystem::path &info_path);
 };
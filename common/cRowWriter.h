@@ -0,0 +1,24 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <opencv2/core.hpp>
+
+
+// 摜ォ珇ɑтƂɎ󂯎ďޏo(摜ŜɎȂ)
+class cRowWriter
+{
+public:
+	virtual ~cRowWriter()
+	{}
+
+	// size: 摜Ŝ̃TCY
+	// depth: CV_8U, CV_16U, CV_32F
+	virtual bool Open(const boost::filesystem::path &path, const cv::Size_<int> &size, const int channel, const int depth) = 0;
+	virtual bool IsOpen() const = 0;
+
+	// rows(BGR(A)O[XP[A͉摜Ɠ)Ȏ̍sƂď
+	virtual bool WriteRows(const cv::Mat &rows) = 0;
+
+	// cŕBSĂ̍sȂ߂Ătrue
+	virtual bool Close() = 0;
+};
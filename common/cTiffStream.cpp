@@ -0,0 +1,390 @@
+#include "cTiffStream.h"
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include <tiffio.h>
+#include "cTrace.h"
+
+
+namespace
+{
+	TIFF* OpenTiff(const boost::filesystem::path &path, const char *mode)
+	{
+#ifdef _WIN32
+		return TIFFOpenW(path.wstring().c_str(), mode);
+#else
+		return TIFFOpen(path.string().c_str(), mode);
+#endif
+	}
+}
+
+
+cTiffReader::cTiffReader() : mTiff(nullptr), mChannel(0), mDepth(CV_8U), mIsTiled(false), mBlockWidth(0), mBlockHeight(0)
+{}
+
+cTiffReader::~cTiffReader()
+{
+	Close();
+}
+
+bool cTiffReader::Open(const boost::filesystem::path &path)
+{
+	Close();
+
+	mTiff = OpenTiff(path, "r");
+	if (!mTiff)
+		return false;
+
+	uint32_t width = 0, height = 0;
+	uint16_t spp = 0, bps = 0, format = 0, planar = 0, photometric = 0, orientation = 0;
+
+	if (!TIFFGetField(mTiff, TIFFTAG_IMAGEWIDTH, &width) || !TIFFGetField(mTiff, TIFFTAG_IMAGELENGTH, &height)
+		|| !TIFFGetField(mTiff, TIFFTAG_PHOTOMETRIC, &photometric))
+	{
+		Close();
+		return false;
+	}
+
+	TIFFGetFieldDefaulted(mTiff, TIFFTAG_SAMPLESPERPIXEL, &spp);
+	TIFFGetFieldDefaulted(mTiff, TIFFTAG_BITSPERSAMPLE, &bps);
+	TIFFGetFieldDefaulted(mTiff, TIFFTAG_SAMPLEFORMAT, &format);
+	TIFFGetFieldDefaulted(mTiff, TIFFTAG_PLANARCONFIG, &planar);
+	TIFFGetFieldDefaulted(mTiff, TIFFTAG_ORIENTATION, &orientation);
+
+	// pbgYCbCrA`lƂɕĂ̂ȂǂOpenCVɔC
+	bool isSupported = planar == PLANARCONFIG_CONTIG && orientation == ORIENTATION_TOPLEFT && width > 0 && height > 0;
+
+	if (photometric == PHOTOMETRIC_MINISBLACK && spp == 1)
+		mChannel = 1;
+	else if (photometric == PHOTOMETRIC_RGB && (spp == 3 || spp == 4))
+		mChannel = spp;
+	else
+		isSupported = false;
+
+	if (bps == 8 && format == SAMPLEFORMAT_UINT)
+		mDepth = CV_8U;
+	else if (bps == 16 && format == SAMPLEFORMAT_UINT)
+		mDepth = CV_16U;
+	else if (bps == 32 && format == SAMPLEFORMAT_IEEEFP)
+		mDepth = CV_32F;
+	else
+		isSupported = false;
+
+	mIsTiled = TIFFIsTiled(mTiff) != 0;
+	if (mIsTiled)
+	{
+		uint32_t tw = 0, th = 0;
+		if (!TIFFGetField(mTiff, TIFFTAG_TILEWIDTH, &tw) || !TIFFGetField(mTiff, TIFFTAG_TILELENGTH, &th) || tw == 0 || th == 0)
+			isSupported = false;
+
+		mBlockWidth = (int)tw;
+		mBlockHeight = (int)th;
+	}
+	else
+	{
+		uint32_t rows = 0;
+		TIFFGetFieldDefaulted(mTiff, TIFFTAG_ROWSPERSTRIP, &rows);
+
+		mBlockWidth = (int)width;
+		mBlockHeight = (int)std::min<uint32_t>(std::max<uint32_t>(rows, 1), height);
+	}
+
+	if (!isSupported)
+	{
+		Close();
+		return false;
+	}
+
+	mSize = cv::Size_<int>((int)width, (int)height);
+
+	return true;
+}
+
+void cTiffReader::Close()
+{
+	if (mTiff)
+	{
+		TIFFClose(mTiff);
+		mTiff = nullptr;
+	}
+
+	mCache.clear();
+	mBuf.clear();
+	mBuf.shrink_to_fit();
+}
+
+const cv::Size_<int>& cTiffReader::GetSize() const
+{
+	return mSize;
+}
+
+int cTiffReader::GetChannel() const
+{
+	return mChannel;
+}
+
+int cTiffReader::GetDepth() const
+{
+	return mDepth;
+}
+
+bool cTiffReader::ReadBlockRow(const int row, cv::Mat &im)
+{
+	TRACE_SCOPE_WAIFU2X("cTiffReader::ReadBlockRow");
+
+	const int type = CV_MAKETYPE(mDepth, mChannel);
+	const int y = row * mBlockHeight;
+	const int h = std::min(mBlockHeight, mSize.height - y);
+
+	im.create(h, mSize.width, type);
+
+	if (mIsTiled)
+	{
+		const tmsize_t TileSize = TIFFTileSize(mTiff);
+		mBuf.resize((size_t)TileSize);
+
+		for (int x = 0; x < mSize.width; x += mBlockWidth)
+		{
+			if (TIFFReadEncodedTile(mTiff, TIFFComputeTile(mTiff, (uint32_t)x, (uint32_t)y, 0, 0), mBuf.data(), TileSize) < 0)
+				return false;
+
+			// E[Ɖ[̃^C͉摜̊Ô̕Ă
+			const int w = std::min(mBlockWidth, mSize.width - x);
+			const cv::Mat tile(mBlockHeight, mBlockWidth, type, mBuf.data());
+			tile(cv::Rect(0, 0, w, h)).copyTo(im(cv::Rect(x, 0, w, h)));
+		}
+	}
+	else
+	{
+		const tmsize_t StripSize = TIFFStripSize(mTiff);
+		mBuf.resize((size_t)StripSize);
+
+		if (TIFFReadEncodedStrip(mTiff, TIFFComputeStrip(mTiff, (uint32_t)y, 0), mBuf.data(), StripSize) < 0)
+			return false;
+
+		cv::Mat(h, mSize.width, type, mBuf.data()).copyTo(im);
+	}
+
+	// RGBBGRɂ
+	if (mChannel == 3)
+		cv::cvtColor(im, im, CV_RGB2BGR);
+	else if (mChannel == 4)
+		cv::cvtColor(im, im, CV_RGBA2BGRA);
+
+	return true;
+}
+
+bool cTiffReader::ReadRegion(const cv::Rect &rect, cv::Mat &im)
+{
+	TRACE_SCOPE_WAIFU2X("cTiffReader::ReadRegion");
+
+	if (!mTiff || (rect & cv::Rect(0, 0, mSize.width, mSize.height)) != rect || rect.area() == 0)
+		return false;
+
+	// O͈̔͂ƏdȂĂ(̉f̕)͓WJς݂̂̂gAgȂ̍ŝ͎Ă
+	while (!mCache.empty() && (mCache.front().first + 1) * mBlockHeight <= rect.y)
+		mCache.pop_front();
+
+	im.create(rect.height, rect.width, CV_MAKETYPE(mDepth, mChannel));
+
+	const int FirstRow = rect.y / mBlockHeight;
+	const int LastRow = (rect.y + rect.height - 1) / mBlockHeight;
+
+	for (int row = FirstRow; row <= LastRow; row++)
+	{
+		auto it = std::find_if(mCache.begin(), mCache.end(), [row](const std::pair<int, cv::Mat> &c) { return c.first == row; });
+		if (it == mCache.end())
+		{
+			cv::Mat block;
+			if (!ReadBlockRow(row, block))
+				return false;
+
+			mCache.emplace_back(row, block);
+			it = mCache.end() - 1;
+		}
+
+		const cv::Mat &block = it->second;
+		const int BlockY = row * mBlockHeight;
+
+		const int y0 = std::max(rect.y, BlockY);
+		const int y1 = std::min(rect.y + rect.height, BlockY + block.rows);
+
+		block(cv::Rect(rect.x, y0 - BlockY, rect.width, y1 - y0)).copyTo(im(cv::Rect(0, y0 - rect.y, rect.width, y1 - y0)));
+	}
+
+	return true;
+}
+
+
+cTiffWriter::cTiffWriter(const int tile_size) : mTiff(nullptr), mChannel(0), mDepth(CV_8U), mTileSize(tile_size), mBufferedRows(0), mWrittenRows(0), mIsError(false)
+{}
+
+cTiffWriter::~cTiffWriter()
+{
+	Abort();
+}
+
+void cTiffWriter::Abort()
+{
+	if (mTiff)
+	{
+		TIFFClose(mTiff);
+		mTiff = nullptr;
+
+		boost::system::error_code error;
+		boost::filesystem::remove(mTempPath, error);
+	}
+
+	mRowBuffer.release();
+}
+
+bool cTiffWriter::Open(const boost::filesystem::path &path, const cv::Size_<int> &size, const int channel, const int depth)
+{
+	const int tile_size = mTileSize;
+	if (mTiff || size.area() == 0 || !(channel == 1 || channel == 3 || channel == 4) || tile_size <= 0 || tile_size % 16 != 0)
+		return false;
+
+	if (!(depth == CV_8U || depth == CV_16U || depth == CV_32F))
+		return false;
+
+	// Oς邾Œu悤ɁAꎞt@C͏o̓pXƓtH_ɍ
+	boost::system::error_code error;
+	const boost::filesystem::path temp_path = path.parent_path() / boost::filesystem::unique_path(path.filename().native() + boost::filesystem::path(".%%%%-%%%%-%%%%.tmp").native(), error);
+	if (error)
+		return false;
+
+	// 4GB𒴂ȂBigTIFFɂ
+	const uint64_t RawSize = (uint64_t)size.width * size.height * channel * CV_ELEM_SIZE1(depth);
+	mTiff = OpenTiff(temp_path, RawSize >= (uint64_t)0xF0000000 ? "w8" : "w");
+	if (!mTiff)
+		return false;
+
+	mPath = path;
+	mTempPath = temp_path;
+
+	TIFFSetField(mTiff, TIFFTAG_IMAGEWIDTH, (uint32_t)size.width);
+	TIFFSetField(mTiff, TIFFTAG_IMAGELENGTH, (uint32_t)size.height);
+	TIFFSetField(mTiff, TIFFTAG_SAMPLESPERPIXEL, channel);
+	TIFFSetField(mTiff, TIFFTAG_BITSPERSAMPLE, (int)CV_ELEM_SIZE1(depth) * 8);
+	TIFFSetField(mTiff, TIFFTAG_SAMPLEFORMAT, depth == CV_32F ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+	TIFFSetField(mTiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(mTiff, TIFFTAG_PHOTOMETRIC, channel == 1 ? PHOTOMETRIC_MINISBLACK : PHOTOMETRIC_RGB);
+	TIFFSetField(mTiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+	TIFFSetField(mTiff, TIFFTAG_COMPRESSION, COMPRESSION_LZW); // OpenCVŕۑƂƓ
+	TIFFSetField(mTiff, TIFFTAG_TILEWIDTH, (uint32_t)tile_size);
+	TIFFSetField(mTiff, TIFFTAG_TILELENGTH, (uint32_t)tile_size);
+
+	if (channel == 4)
+	{
+		const uint16_t extra = EXTRASAMPLE_UNASSALPHA;
+		TIFFSetField(mTiff, TIFFTAG_EXTRASAMPLES, 1, &extra);
+	}
+
+	mSize = size;
+	mChannel = channel;
+	mDepth = depth;
+
+	// E[̃^C͉摜̊O̕0Ŗ߂ď
+	const int TileNum = (size.width + tile_size - 1) / tile_size;
+	mRowBuffer = cv::Mat::zeros(tile_size, TileNum * tile_size, CV_MAKETYPE(depth, channel));
+	mBufferedRows = 0;
+	mWrittenRows = 0;
+	mIsError = false;
+
+	return true;
+}
+
+bool cTiffWriter::IsOpen() const
+{
+	return mTiff != nullptr;
+}
+
+bool cTiffWriter::FlushTileRow()
+{
+	TRACE_SCOPE_WAIFU2X("cTiffWriter::FlushTileRow");
+
+	for (int x = 0; x < mSize.width; x += mTileSize)
+	{
+		// ^C̃f[^͘AĂKv̂ŃRs[
+		const cv::Mat tile = mRowBuffer(cv::Rect(x, 0, mTileSize, mTileSize)).clone();
+
+		if (TIFFWriteEncodedTile(mTiff, TIFFComputeTile(mTiff, (uint32_t)x, (uint32_t)mWrittenRows, 0, 0), tile.data, (tmsize_t)(tile.total() * tile.elemSize())) < 0)
+		{
+			mIsError = true;
+			return false;
+		}
+	}
+
+	mWrittenRows += mBufferedRows;
+	mBufferedRows = 0;
+	mRowBuffer.setTo(cv::Scalar::all(0));
+
+	return true;
+}
+
+bool cTiffWriter::WriteRows(const cv::Mat &rows)
+{
+	TRACE_SCOPE_WAIFU2X("cTiffWriter::WriteRows");
+
+	if (!mTiff || mIsError || rows.cols != mSize.width || rows.type() != mRowBuffer.type()
+		|| mWrittenRows + mBufferedRows + rows.rows > mSize.height)
+		return false;
+
+	int y = 0;
+	while (y < rows.rows)
+	{
+		const int n = std::min(rows.rows - y, mTileSize - mBufferedRows);
+
+		const cv::Mat src = rows(cv::Rect(0, y, mSize.width, n));
+		cv::Mat dst = mRowBuffer(cv::Rect(0, mBufferedRows, mSize.width, n));
+
+		// BGRRGBɂ
+		if (mChannel == 3)
+			cv::cvtColor(src, dst, CV_BGR2RGB);
+		else if (mChannel == 4)
+			cv::cvtColor(src, dst, CV_BGRA2RGBA);
+		else
+			src.copyTo(dst);
+
+		mBufferedRows += n;
+		y += n;
+
+		if (mBufferedRows == mTileSize && !FlushTileRow())
+			return false;
+	}
+
+	return true;
+}
+
+bool cTiffWriter::Close()
+{
+	if (!mTiff)
+		return false;
+
+	if (mBufferedRows > 0 && !mIsError)
+		FlushTileRow();
+
+	if (mIsError || mWrittenRows != mSize.height)
+	{
+		Abort();
+		return false;
+	}
+
+	const bool isFlushed = TIFFFlush(mTiff) == 1;
+
+	TIFFClose(mTiff);
+	mTiff = nullptr;
+
+	mRowBuffer.release();
+
+	boost::system::error_code error;
+	if (isFlushed)
+		boost::filesystem::rename(mTempPath, mPath, error);
+
+	if (!isFlushed || error)
+	{
+		boost::filesystem::remove(mTempPath, error);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <utility>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <opencv2/core.hpp>
+#include "cRowWriter.h"
+
+
+struct tiff;
+
+// 傫TIFFꕔǂݍ
+// E^C`ƃXgbv`ɑΉAǂݍޔ͈͂Ɋ|^CXgbvWJ
+// EΉ`̓`lAĕłO[XP[(1ch)RGB(3ch), RGBA(4ch)ŁA8bit, 16bit, 32bit_̂
+class cTiffReader
+{
+private:
+	tiff *mTiff;
+
+	cv::Size_<int> mSize;
+	int mChannel;
+	int mDepth; // CV_8U, CV_16U, CV_32F
+
+	bool mIsTiled;
+	int mBlockWidth; // ^C̕(Xgbv`Ȃ摜̕)
+	int mBlockHeight; // ^C̍(Xgbv`Ȃ1Xgbv̍s)
+
+	std::deque<std::pair<int, cv::Mat>> mCache; // WJς݂̃^CXgbv̍s(s̔ԍƉ摜̉̕摜ABGR(A))
+	std::vector<uint8_t> mBuf;
+
+private:
+	// rowԖڂ̃^C̍sXgbvWJ
+	bool ReadBlockRow(const int row, cv::Mat &im);
+
+public:
+	cTiffReader();
+	~cTiffReader();
+
+	// ΉĂȂ`Ȃfalse
+	bool Open(const boost::filesystem::path &path);
+	void Close();
+
+	const cv::Size_<int>& GetSize() const;
+	int GetChannel() const;
+	int GetDepth() const;
+
+	// rect͈̔͂imɓǂݍ(BGR(A)O[XP[)
+	// ォ珇ɓǂݍޑOŁArectɂWJς݂̃^Ĉ͎Ă
+	bool ReadRegion(const cv::Rect &rect, cv::Mat &im);
+};
+
+// ^C`TIFFォ珇ɏ
+// 摜Ŝ͎A^C1s̍s܂邽тɂ̃^C
+// ݒ͓tH_̈ꎞt@Cɏ݁ASĂ̍s߂Close()ŏo̓pXɖOς
+// (rŎsClose()ɔj肵ꍇ͈ꎞt@ĈŁÃt@C͎cȂ)
+class cTiffWriter : public cRowWriter
+{
+private:
+	tiff *mTiff;
+	boost::filesystem::path mPath; // o̓pX
+	boost::filesystem::path mTempPath; // ݒ̈ꎞt@C
+
+	cv::Size_<int> mSize;
+	int mChannel;
+	int mDepth;
+	int mTileSize;
+
+	cv::Mat mRowBuffer; // ݑ҂̃^C1s(RGB(A))
+	int mBufferedRows; // mRowBufferɗ܂Ăs
+	int mWrittenRows; // ݍς݂̍s
+	bool mIsError;
+
+private:
+	bool FlushTileRow();
+	// TIFFĈꎞt@C
+	void Abort();
+
+public:
+	// tile_size: ^C̕ƍ(16̔{)
+	explicit cTiffWriter(const int tile_size = 256);
+	~cTiffWriter();
+
+	bool Open(const boost::filesystem::path &path, const cv::Size_<int> &size, const int channel, const int depth);
+	bool IsOpen() const;
+	bool WriteRows(const cv::Mat &rows);
+	bool Close();
+};
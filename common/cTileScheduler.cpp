@@ -0,0 +1,417 @@
+#include "cTileScheduler.h"
+#include <assert.h>
+#include <string>
+#include <algorithm>
+#include "cTrace.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <stdio.h>
+#include <sched.h>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#endif
+
+
+namespace
+{
+	thread_local cTileScheduler *g_CurrentScheduler = nullptr;
+	thread_local int g_CurrentWorkerNo = -1;
+
+	// ĂяoXbhNUMAm[hCPUœ
+	// Xbh߂ĐG͂̃m[hmۂ(Windows, LinuxƂɃftHg̓)
+	bool BindCurrentThreadToNumaNode(const int node)
+	{
+#ifdef _WIN32
+		GROUP_AFFINITY affinity = {};
+		if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) || affinity.Mask == 0)
+			return false;
+
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != FALSE;
+#else
+		// cpulist́u0-7,16-23v̂悤Ȍ`
+		std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!std::getline(ifs, list))
+			return false;
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		int count = 0;
+		size_t pos = 0;
+		while (pos < list.size())
+		{
+			const size_t end = std::min(list.find(',', pos), list.size());
+			const std::string range = list.substr(pos, end - pos);
+			pos = end + 1;
+
+			int first = 0, last = 0;
+			const int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+			if (n <= 0)
+				continue;
+			if (n == 1)
+				last = first;
+
+			for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			{
+				CPU_SET(cpu, &set);
+				count++;
+			}
+		}
+
+		if (count == 0)
+			return false;
+
+		return sched_setaffinity(0, sizeof(set), &set) == 0;
+#endif
+	}
+}
+
+
+cTileScheduler::cTileScheduler(const int worker_num, const bool bind_numa_node, const Task &worker_init) : mRunningJobNum(0), mTileTaskNum(0), mIsStop(false)
+{
+	const int num = worker_num > 0 ? worker_num : 1;
+	const int node_num = bind_numa_node ? GetNumaNodeNum() : 1;
+
+	for (int i = 0; i < num; i++)
+	{
+		mWorkerList.emplace_back(new stWorker);
+		if (node_num > 1)
+			mWorkerList[i]->numa_node = i % node_num;
+	}
+
+	// ނƂ͓m[h̃[J[ɒT(̃m[h̃ǂނ̂͒x)
+	for (int i = 0; i < num; i++)
+	{
+		auto &order = mWorkerList[i]->steal_order;
+		for (int j = 1; j < num; j++)
+			order.push_back((i + j) % num);
+
+		std::stable_sort(order.begin(), order.end(), [this, i](const int a, const int b)
+		{
+			const int node = mWorkerList[i]->numa_node;
+			return (mWorkerList[a]->numa_node == node) > (mWorkerList[b]->numa_node == node);
+		});
+	}
+
+	// (lbg̍\z)͍܂Œʂ1s
+	std::exception_ptr error;
+	for (int i = 0; i < num; i++)
+	{
+		std::promise<void> inited;
+		auto future = inited.get_future();
+
+		mWorkerList[i]->thread = std::thread([this, i, &worker_init, &inited]() { WorkerThread(i, worker_init, inited); });
+
+		try
+		{
+			future.get();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+			break;
+		}
+	}
+
+	// RXgN^O𓊂ƃfXgN^͌Ă΂Ȃ̂ŁAŃ[J[I
+	if (error)
+	{
+		StopWorkers();
+		std::rethrow_exception(error);
+	}
+}
+
+cTileScheduler::~cTileScheduler()
+{
+	StopWorkers();
+}
+
+void cTileScheduler::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mIsStop = true;
+	}
+	mCond.notify_all();
+
+	for (auto &w : mWorkerList)
+	{
+		if (w->thread.joinable())
+			w->thread.join();
+	}
+}
+
+int cTileScheduler::GetWorkerNum() const
+{
+	return (int)mWorkerList.size();
+}
+
+int cTileScheduler::GetWorkerNumaNode(const int worker_no) const
+{
+	assert(0 <= worker_no && worker_no < (int)mWorkerList.size());
+
+	return mWorkerList[worker_no]->numa_node;
+}
+
+int cTileScheduler::GetNumaNodeNum()
+{
+#ifdef _WIN32
+	ULONG highest = 0;
+	if (!GetNumaHighestNodeNumber(&highest))
+		return 1;
+
+	return (int)highest + 1;
+#else
+	int num = 0;
+
+	try
+	{
+		const boost::filesystem::path node_dir("/sys/devices/system/node");
+		while (boost::filesystem::exists(node_dir / ("node" + std::to_string(num))))
+			num++;
+	}
+	catch (...)
+	{}
+
+	return std::max(num, 1);
+#endif
+}
+
+void cTileScheduler::SetWorkerContext(const int worker_no, void *context)
+{
+	assert(0 <= worker_no && worker_no < (int)mWorkerList.size());
+
+	auto &w = *mWorkerList[worker_no];
+
+	std::lock_guard<std::mutex> lock(w.mutex);
+	w.context = context;
+}
+
+void* cTileScheduler::GetWorkerContext(const int worker_no) const
+{
+	assert(0 <= worker_no && worker_no < (int)mWorkerList.size());
+
+	auto &w = *mWorkerList[worker_no];
+
+	std::lock_guard<std::mutex> lock(w.mutex);
+	return w.context;
+}
+
+void cTileScheduler::WorkerThread(const int worker_no, const Task &worker_init, std::promise<void> &inited)
+{
+	g_CurrentScheduler = this;
+	g_CurrentWorkerNo = worker_no;
+
+	auto &worker = *mWorkerList[worker_no];
+
+	if (worker.numa_node >= 0 && !BindCurrentThreadToNumaNode(worker.numa_node))
+		worker.numa_node = -1;
+
+	std::string name = "worker " + std::to_string(worker_no);
+	if (worker.numa_node >= 0)
+		name += " (node " + std::to_string(worker.numa_node) + ")";
+	cTrace::SetThreadName(name.c_str());
+
+	// m[hɊ蓖ĂĂ珉̂ŁAŊmۂ͂̃m[ĥ̂ɂȂ
+	if (worker_init)
+	{
+		try
+		{
+			worker_init(worker_no);
+		}
+		catch (...)
+		{
+			// łȂ[J[͓ɁARXgN^ɗOn
+			g_CurrentScheduler = nullptr;
+			g_CurrentWorkerNo = -1;
+
+			inited.set_exception(std::current_exception());
+			return;
+		}
+	}
+
+	inited.set_value();
+
+	while (true)
+	{
+		// ̉摜𑁂I点邽߁AVWũ[J[̃^CD悷
+		stTileTask tile;
+		if (PopTileTask(worker_no, tile))
+		{
+			RunTileTask(worker_no, tile);
+			continue;
+		}
+
+		Task job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			if (mJobQueue.empty())
+			{
+				if (mIsStop)
+					break;
+
+				if (mTileTaskNum == 0)
+					mCond.wait(lock);
+
+				continue;
+			}
+
+			job = std::move(mJobQueue.front());
+			mJobQueue.pop_front();
+			mRunningJobNum++;
+		}
+
+		try
+		{
+			job(worker_no);
+		}
+		catch (...)
+		{}
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mRunningJobNum--;
+		}
+		mCond.notify_all();
+	}
+
+	g_CurrentScheduler = nullptr;
+	g_CurrentWorkerNo = -1;
+}
+
+bool cTileScheduler::PopTileTask(const int worker_no, stTileTask &task)
+{
+	bool isGet = false;
+
+	{
+		auto &w = *mWorkerList[worker_no];
+
+		std::lock_guard<std::mutex> lock(w.mutex);
+		if (!w.deque.empty())
+		{
+			task = std::move(w.deque.back());
+			w.deque.pop_back();
+			isGet = true;
+		}
+	}
+
+	for (const int victim : mWorkerList[worker_no]->steal_order)
+	{
+		if (isGet)
+			break;
+
+		auto &w = *mWorkerList[victim];
+
+		std::lock_guard<std::mutex> lock(w.mutex);
+		if (!w.deque.empty())
+		{
+			task = std::move(w.deque.front());
+			w.deque.pop_front();
+			isGet = true;
+		}
+	}
+
+	if (isGet)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTileTaskNum--;
+	}
+
+	return isGet;
+}
+
+void cTileScheduler::RunTileTask(const int worker_no, stTileTask &task)
+{
+	try
+	{
+		task.task(worker_no);
+	}
+	catch (...)
+	{}
+
+	// ҂Ă鑤groupj邩Ȃ̂ŁAgroupɐĜ͂ꂪŌ
+	if (--task.group->mRemain == 0)
+	{
+		{
+			// Wait()mFĂ҂܂ł̊ԂɒʒmȂ悤ɃbN
+			std::lock_guard<std::mutex> lock(mMutex);
+		}
+		mCond.notify_all();
+	}
+}
+
+void cTileScheduler::PushJob(Task job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobQueue.push_back(std::move(job));
+	}
+	mCond.notify_one();
+}
+
+void cTileScheduler::WaitJobs()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mCond.wait(lock, [this]() { return mJobQueue.empty() && mRunningJobNum == 0; });
+}
+
+void cTileScheduler::PushTile(cTaskGroup &group, Task task)
+{
+	assert(g_CurrentScheduler == this);
+
+	const int worker_no = g_CurrentWorkerNo;
+
+	group.mRemain++;
+
+	{
+		auto &w = *mWorkerList[worker_no];
+
+		std::lock_guard<std::mutex> lock(w.mutex);
+		w.deque.push_back(stTileTask{std::move(task), &group});
+
+		// L[ɐςł琔𑝂₷(ɑ₷ƁÃL[Ȃ[J[҂ɉ葱)
+		// L[̃bN܂܂Ȃ̂ŁA₷OɎĐɂȂ邱Ƃ͖
+		std::lock_guard<std::mutex> countLock(mMutex);
+		mTileTaskNum++;
+	}
+
+	mCond.notify_all();
+}
+
+void cTileScheduler::Wait(cTaskGroup &group)
+{
+	assert(g_CurrentScheduler == this);
+
+	const int worker_no = g_CurrentWorkerNo;
+
+	// ̉摜̃Wu͎Ȃ(Ƃ̉摜̊̃Wů܂Œx)
+	while (!group.IsDone())
+	{
+		stTileTask tile;
+		if (PopTileTask(worker_no, tile))
+		{
+			RunTileTask(worker_no, tile);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		if (group.IsDone())
+			break;
+
+		if (mTileTaskNum == 0)
+			mCond.wait(lock);
+	}
+}
+
+cTileScheduler* cTileScheduler::GetCurrent()
+{
+	return g_CurrentScheduler;
+}
+
+int cTileScheduler::GetCurrentWorkerNo()
+{
+	return g_CurrentWorkerNo;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// ̃[J[Xbhŉ摜ƃ^CXPW[
+// E摜Pʂ̃Wu͋L̃L[ɓA󂢂[J[ԂɎ
+// EWu̒Œǉ^CPʂ̃^XN̓[J[Ƃ̗[L[ɓ
+//   ̃L[͌납Aɂȃ[J[͑̃[J[̃L[̑O瓐
+//   (傫摜Ă郏[J[ĂÃ[J[V΂Ȃ悤ɂ)
+// ENUMAm[hɊ蓖ĂꍇA[J[i̓m[h(i % m[h)CPUłAނƂ͓m[h̃[J[D悷
+//   [J[̏֐̒Ŋmۂ(lbg̏d݂Ȃ)͂̃m[h̃ɂȂ
+class cTileScheduler
+{
+public:
+	// worker_no: ^XNs郏[J[̔ԍ
+	typedef std::function<void(const int worker_no)> Task;
+
+	// ^CPʂ̃^XN̂܂Ƃ܂BWait()őSďÎ҂
+	class cTaskGroup
+	{
+	private:
+		friend class cTileScheduler;
+
+		std::atomic<int> mRemain;
+
+	public:
+		cTaskGroup() : mRemain(0)
+		{}
+
+		bool IsDone() const
+		{
+			return mRemain == 0;
+		}
+	};
+
+private:
+	struct stTileTask
+	{
+		Task task;
+		cTaskGroup *group;
+	};
+
+	struct stWorker
+	{
+		std::mutex mutex;
+		std::deque<stTileTask> deque; // L[J[͌납Ã[J[͑O
+		void *context;
+		int numa_node; // 蓖ĂNUMAm[h(蓖ĂĂȂ-1)
+		std::vector<int> steal_order; // ݂ɍs[J[̏
+		std::thread thread;
+
+		stWorker() : context(nullptr), numa_node(-1)
+		{}
+	};
+
+	std::vector<std::unique_ptr<stWorker>> mWorkerList;
+
+	std::mutex mMutex;
+	std::condition_variable mCond; // Wu^CǉꂽAWu^XN̂܂Ƃ܂肪I
+	std::deque<Task> mJobQueue;
+	int mRunningJobNum;
+	int mTileTaskNum; // L[ɓĂ^CPʂ̃^XN̐
+	bool mIsStop;
+
+private:
+	void WorkerThread(const int worker_no, const Task &worker_init, std::promise<void> &inited);
+	// SẴ[J[Iđ҂
+	void StopWorkers();
+
+	// ̃L[̌납Ã[J[̃L[̑O^XN
+	bool PopTileTask(const int worker_no, stTileTask &task);
+	void RunTileTask(const int worker_no, stTileTask &task);
+
+public:
+	// bind_numa_node: [J[NUMAm[hɊ蓖Ă(m[h1ł͉Ȃ)
+	// worker_init: [J[̃Xbh̊JnɌĂ΂(lbg̍\zȂǃ[J[Ƃ̏p)
+	//              [J[0珇ԂɌĂ΂ASďI܂ŃRXgN^͖߂Ȃ
+	//              O𓊂ƁAJn[J[IĂRXgN^̗O𓊂
+	explicit cTileScheduler(const int worker_num, const bool bind_numa_node = false, const Task &worker_init = nullptr);
+	~cTileScheduler();
+
+	int GetWorkerNum() const;
+
+	// [J[蓖ĂNUMAm[h(蓖ĂĂȂ-1)
+	int GetWorkerNumaNode(const int worker_no) const;
+
+	// NUMAm[h̐(擾łȂ1)
+	static int GetNumaNodeNum();
+
+	// [J[Ƃ̃f[^(̃[J[瓐񂾃^XNŎglbgȂ)
+	void SetWorkerContext(const int worker_no, void *context);
+	void* GetWorkerContext(const int worker_no) const;
+
+	// 摜Pʂ̃Wuǉ
+	void PushJob(Task job);
+	// ǉWuSďI܂ő҂
+	void WaitJobs();
+
+	// ^CPʂ̃^XNĂяo[J[̃L[ɒǉ([J[̃XbhĂԂ)
+	void PushTile(cTaskGroup &group, Task task);
+	// group̃^XNSďI܂ŁA⑼̃[J[̃^CȂ҂([J[̃XbhĂԂ)
+	void Wait(cTaskGroup &group);
+
+	// ĂяoXbh[J[Ȃ炻̃XPW[ƃ[J[̔ԍԂB[J[łȂnullptr-1
+	static cTileScheduler* GetCurrent();
+	static int GetCurrentWorkerNo();
+};
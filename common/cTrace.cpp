@@ -0,0 +1,226 @@
+#include "cTrace.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+
+
+namespace
+{
+	struct stEvent
+	{
+		const char *name;
+		int64_t start;
+		int64_t end;
+	};
+
+	struct stCounter
+	{
+		const char *name;
+		int64_t time;
+		std::vector<std::pair<const char *, int64_t>> values;
+	};
+
+	// XbhƂ̃Cxgobt@
+	// XbhIo悤ɏLg_BufferList
+	struct stThreadBuffer
+	{
+		std::mutex mutex; // ނ̂͏LXbhȂ̂ŁASave()̎ȊOȂ
+		std::vector<stEvent> events;
+		std::vector<stCounter> counters;
+		std::string thread_name;
+		int tid;
+	};
+
+	std::atomic<bool> g_IsEnabled(false);
+
+	std::mutex g_BufferListMutex;
+	std::vector<std::shared_ptr<stThreadBuffer>> g_BufferList;
+
+	const auto g_BaseTime = std::chrono::steady_clock::now();
+
+	stThreadBuffer& GetThreadBuffer()
+	{
+		thread_local std::shared_ptr<stThreadBuffer> buffer;
+		if (!buffer)
+		{
+			buffer = std::make_shared<stThreadBuffer>();
+			buffer->events.reserve(4096);
+
+			std::lock_guard<std::mutex> lock(g_BufferListMutex);
+			buffer->tid = (int)g_BufferList.size() + 1;
+			g_BufferList.push_back(buffer);
+		}
+
+		return *buffer;
+	}
+
+	// Cxg̓enȂAÔJSONŖɂȂ镶GXP[v
+	std::string EscapeJson(const char *str)
+	{
+		std::string ret;
+		for (const char *p = str; *p; p++)
+		{
+			if (*p == '"' || *p == '\\')
+				ret += '\\';
+			ret += *p;
+		}
+
+		return ret;
+	}
+}
+
+
+cTrace::cScope::cScope(const char *name) : mName(name), mStartTime(-1)
+{
+	if (g_IsEnabled.load(std::memory_order_relaxed))
+		mStartTime = Now();
+}
+
+cTrace::cScope::~cScope()
+{
+	if (mStartTime >= 0)
+		AddEvent(mName, mStartTime, Now());
+}
+
+void cTrace::Enable()
+{
+	g_IsEnabled = true;
+}
+
+void cTrace::Disable()
+{
+	g_IsEnabled = false;
+}
+
+bool cTrace::IsEnabled()
+{
+	return g_IsEnabled.load(std::memory_order_relaxed);
+}
+
+void cTrace::Clear()
+{
+	std::lock_guard<std::mutex> lock(g_BufferListMutex);
+	for (auto &b : g_BufferList)
+	{
+		std::lock_guard<std::mutex> block(b->mutex);
+		b->events.clear();
+		b->counters.clear();
+	}
+}
+
+void cTrace::SetThreadName(const char *name)
+{
+	auto &buffer = GetThreadBuffer();
+
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.thread_name = name;
+}
+
+int64_t cTrace::Now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_BaseTime).count();
+}
+
+void cTrace::AddEvent(const char *name, const int64_t start_time, const int64_t end_time)
+{
+	if (!g_IsEnabled.load(std::memory_order_relaxed))
+		return;
+
+	auto &buffer = GetThreadBuffer();
+
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.events.push_back({name, start_time, end_time});
+}
+
+void cTrace::AddCounter(const char *name, const char * const *keys, const int64_t *values, const int num)
+{
+	if (!g_IsEnabled.load(std::memory_order_relaxed))
+		return;
+
+	stCounter counter;
+	counter.name = name;
+	counter.time = Now();
+	for (int i = 0; i < num; i++)
+		counter.values.emplace_back(keys[i], values[i]);
+
+	auto &buffer = GetThreadBuffer();
+
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.counters.push_back(std::move(counter));
+}
+
+bool cTrace::Save(const boost::filesystem::path &output_file)
+{
+	boost::iostreams::stream<boost::iostreams::file_descriptor> os;
+
+	try
+	{
+		os.open(output_file, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	if (!os)
+		return false;
+
+	os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	bool isFirst = true;
+	const auto WriteSeparator = [&os, &isFirst]()
+	{
+		if (!isFirst)
+			os << ",\n";
+		isFirst = false;
+	};
+
+	std::lock_guard<std::mutex> lock(g_BufferListMutex);
+	for (auto &b : g_BufferList)
+	{
+		std::lock_guard<std::mutex> block(b->mutex);
+
+		if (!b->thread_name.empty())
+		{
+			WriteSeparator();
+			os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"args\":{\"name\":\"" << EscapeJson(b->thread_name.c_str()) << "\"}}";
+		}
+
+		for (const auto &e : b->events)
+		{
+			WriteSeparator();
+			os << "{\"name\":\"" << EscapeJson(e.name) << "\",\"cat\":\"waifu2x\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"ts\":" << e.start << ",\"dur\":" << (e.end - e.start) << "}";
+		}
+
+		for (const auto &c : b->counters)
+		{
+			WriteSeparator();
+			os << "{\"name\":\"" << EscapeJson(c.name) << "\",\"ph\":\"C\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"ts\":" << c.time << ",\"args\":{";
+
+			for (size_t i = 0; i < c.values.size(); i++)
+			{
+				if (i > 0)
+					os << ",";
+				os << "\"" << EscapeJson(c.values[i].first) << "\":" << c.values[i].second;
+			}
+
+			os << "}}";
+		}
+	}
+
+	os << "\n]}\n";
+
+	os.flush();
+	if (os.fail())
+		return false;
+
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <boost/filesystem.hpp>
+
+
+// ̃^CCChrome trace-event`ŋL^
+// chrome://tracing  Perfetto ŕ\ł
+class cTrace
+{
+public:
+	// XR[v̊JnI܂ł1CxgƂċL^
+	class cScope
+	{
+	private:
+		const char *mName;
+		int64_t mStartTime;
+
+	public:
+		// name: 񃊃eȂǃvOI܂ő݂镶ł邱
+		explicit cScope(const char *name);
+		~cScope();
+	};
+
+public:
+	static void Enable();
+	static void Disable();
+	static bool IsEnabled();
+
+	// L^ς݂̃Cxgj
+	static void Clear();
+
+	// ĂяoXbh̕\ݒ
+	static void SetThreadName(const char *name);
+
+	// L^CxgJSONŏo
+	static bool Save(const boost::filesystem::path &output_file);
+
+	// L^Jňoߎ(}CNb)
+	static int64_t Now();
+
+	static void AddEvent(const char *name, const int64_t start_time, const int64_t end_time);
+
+	// JE^lL^(^CCɃOtƂĕ\)
+	// keys: en̖OBnameƓ񃊃eȂǂł邱
+	static void AddCounter(const char *name, const char * const *keys, const int64_t *values, const int num);
+};
+
+#define TRACE_WAIFU2X_CONCAT_(a, b) a##b
+#define TRACE_WAIFU2X_CONCAT(a, b) TRACE_WAIFU2X_CONCAT_(a, b)
+
+// ݂̃XR[vCxgƂċL^(g[XȂƂ͂قڃRXgȂ)
+#define TRACE_SCOPE_WAIFU2X(name) cTrace::cScope TRACE_WAIFU2X_CONCAT(trace_scope_, __LINE__)(name)
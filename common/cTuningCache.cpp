@@ -0,0 +1,316 @@
+#include "cTuningCache.h"
+#include <string.h>
+#include <zlib.h>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+
+
+namespace
+{
+	const char FileMagic[8] = {'W', '2', 'X', 'T', 'U', 'N', 'E', '\0'};
+	const uint32_t FileFormatVersion = 1;
+
+	// t@C̃wb_[(l͑SăgGfBA)
+	// magic[8], format_version, data_version, entry_num, payload_size, payload_crc32
+	const size_t HeaderSize = sizeof(FileMagic) + sizeof(uint32_t) * 5;
+
+	// 1̃L[l̏(𒴂ĂĂƂ݂Ȃ)
+	const uint32_t MaxElementSize = 16 * 1024 * 1024;
+
+	void WriteU32(std::vector<char> &buf, const uint32_t v)
+	{
+		for (int i = 0; i < 4; i++)
+			buf.push_back((char)((v >> (8 * i)) & 0xff));
+	}
+
+	bool ReadU32(const std::vector<char> &buf, size_t &pos, uint32_t &v)
+	{
+		if (pos + 4 > buf.size())
+			return false;
+
+		v = 0;
+		for (int i = 0; i < 4; i++)
+			v |= (uint32_t)(uint8_t)buf[pos + i] << (8 * i);
+
+		pos += 4;
+		return true;
+	}
+
+	bool ReadBytes(const std::vector<char> &buf, size_t &pos, const uint32_t size, const char *&ptr)
+	{
+		if (size > MaxElementSize || pos + size > buf.size())
+			return false;
+
+		ptr = buf.data() + pos;
+		pos += size;
+		return true;
+	}
+
+	uint32_t CalcCRC32(const char *data, const size_t size)
+	{
+		uLong crc = crc32(0L, Z_NULL, 0);
+		return (uint32_t)crc32(crc, (const Bytef *)data, (uInt)size);
+	}
+
+	boost::filesystem::path AddExtension(const boost::filesystem::path &path, const char *ext)
+	{
+		return boost::filesystem::path(path.native() + boost::filesystem::path(ext).native());
+	}
+}
+
+
+cTuningCache::cTuningCache(const uint32_t data_version) : mDataVersion(data_version), mIsLoaded(false)
+{}
+
+cTuningCache::~cTuningCache()
+{
+	Save();
+}
+
+void cTuningCache::SetDataPath(const boost::filesystem::path &path)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mDataPath == path)
+		return;
+
+	mDataPath = path;
+	mValueMap.clear();
+	mModifiedKeySet.clear();
+	mIsLoaded = false;
+}
+
+bool cTuningCache::ReadFile(ValueMap &map) const
+{
+	std::vector<char> buf;
+
+	try
+	{
+		boost::iostreams::stream<boost::iostreams::file_descriptor_source> is;
+		is.open(mDataPath, std::ios_base::in | std::ios_base::binary);
+		if (!is)
+			return false;
+
+		const auto size = is.seekg(0, std::ios::end).tellg();
+		is.seekg(0, std::ios::beg);
+		if (size < (std::streamoff)HeaderSize)
+			return false;
+
+		buf.resize((size_t)size);
+		is.read(buf.data(), buf.size());
+		if (is.gcount() != (std::streamsize)size)
+			return false;
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	if (memcmp(buf.data(), FileMagic, sizeof(FileMagic)) != 0)
+		return false;
+
+	size_t pos = sizeof(FileMagic);
+
+	uint32_t format_version, data_version, entry_num, payload_size, payload_crc;
+	if (!ReadU32(buf, pos, format_version) || !ReadU32(buf, pos, data_version) || !ReadU32(buf, pos, entry_num)
+		|| !ReadU32(buf, pos, payload_size) || !ReadU32(buf, pos, payload_crc))
+		return false;
+
+	if (format_version != FileFormatVersion || data_version != mDataVersion)
+		return false;
+
+	if (pos + payload_size != buf.size())
+		return false;
+
+	if (CalcCRC32(buf.data() + pos, payload_size) != payload_crc)
+		return false;
+
+	ValueMap tmpMap;
+	for (uint32_t i = 0; i < entry_num; i++)
+	{
+		uint32_t key_size, value_size;
+		const char *key_ptr, *value_ptr;
+
+		if (!ReadU32(buf, pos, key_size) || !ReadBytes(buf, pos, key_size, key_ptr))
+			return false;
+		if (!ReadU32(buf, pos, value_size) || !ReadBytes(buf, pos, value_size, value_ptr))
+			return false;
+
+		tmpMap[std::string(key_ptr, key_size)] = std::vector<char>(value_ptr, value_ptr + value_size);
+	}
+
+	if (pos != buf.size())
+		return false;
+
+	map.swap(tmpMap);
+
+	return true;
+}
+
+bool cTuningCache::WriteFile(const ValueMap &map) const
+{
+	std::vector<char> payload;
+	for (const auto &p : map)
+	{
+		WriteU32(payload, (uint32_t)p.first.size());
+		payload.insert(payload.end(), p.first.begin(), p.first.end());
+		WriteU32(payload, (uint32_t)p.second.size());
+		payload.insert(payload.end(), p.second.begin(), p.second.end());
+	}
+
+	std::vector<char> buf(FileMagic, FileMagic + sizeof(FileMagic));
+	WriteU32(buf, FileFormatVersion);
+	WriteU32(buf, mDataVersion);
+	WriteU32(buf, (uint32_t)map.size());
+	WriteU32(buf, (uint32_t)payload.size());
+	WriteU32(buf, CalcCRC32(payload.data(), payload.size()));
+	buf.insert(buf.end(), payload.begin(), payload.end());
+
+	// ǂݍݑ̃t@Cǂ܂Ȃ悤Ɉꎞt@CɏĂu
+	const boost::filesystem::path tmp_path(AddExtension(mDataPath, ".tmp"));
+
+	try
+	{
+		boost::iostreams::stream<boost::iostreams::file_descriptor_sink> os;
+		os.open(tmp_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!os)
+			return false;
+
+		os.write(buf.data(), buf.size());
+		os.flush();
+		if (os.fail())
+			return false;
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	boost::system::error_code error;
+	boost::filesystem::rename(tmp_path, mDataPath, error);
+	if (error)
+	{
+		boost::filesystem::remove(tmp_path, error);
+		return false;
+	}
+
+	return true;
+}
+
+boost::filesystem::path cTuningCache::GetLockPath(const bool create) const
+{
+	// bNt@Cfile_lock̓sŏɎc
+	const boost::filesystem::path lock_path(AddExtension(mDataPath, ".lock"));
+	if (create && !boost::filesystem::exists(lock_path))
+	{
+		boost::iostreams::stream<boost::iostreams::file_descriptor_sink> os;
+		os.open(lock_path, std::ios_base::out | std::ios_base::binary | std::ios_base::app);
+	}
+
+	return lock_path;
+}
+
+void cTuningCache::Load()
+{
+	if (mIsLoaded || mDataPath.empty())
+		return;
+
+	mIsLoaded = true;
+
+	ValueMap fileMap;
+	try
+	{
+		// ۑ̃vZXΏI܂ő҂(bNt@C΂܂NۑĂȂ)
+		const boost::filesystem::path lock_path(GetLockPath(false));
+		if (boost::filesystem::exists(lock_path))
+		{
+			boost::interprocess::file_lock flock(lock_path.string().c_str());
+			boost::interprocess::sharable_lock<boost::interprocess::file_lock> flock_guard(flock);
+
+			if (!ReadFile(fileMap))
+				return;
+		}
+		else if (!ReadFile(fileMap))
+			return;
+	}
+	catch (...)
+	{
+		return;
+	}
+
+	// ǂݍޑOSet()ꂽlD悷
+	for (auto &p : fileMap)
+		mValueMap.insert(std::move(p));
+}
+
+bool cTuningCache::GetRaw(const std::string &key, std::vector<char> &value)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Load();
+
+	const auto it = mValueMap.find(key);
+	if (it == mValueMap.end())
+		return false;
+
+	value = it->second;
+	return true;
+}
+
+void cTuningCache::SetRaw(const std::string &key, std::vector<char> &&value)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Load();
+
+	auto &v = mValueMap[key];
+	if (v == value)
+		return;
+
+	v = std::move(value);
+	mModifiedKeySet.insert(key);
+}
+
+bool cTuningCache::Save()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mModifiedKeySet.empty() || mDataPath.empty())
+		return true;
+
+	try
+	{
+		// ̃vZXƓɏ܂Ȃ悤ɃbN
+		const boost::filesystem::path lock_path(GetLockPath(true));
+
+		boost::interprocess::file_lock flock(lock_path.string().c_str());
+		boost::interprocess::scoped_lock<boost::interprocess::file_lock> flock_guard(flock);
+
+		// ̃vZXۑeɎ̕ύX㏑
+		ValueMap fileMap;
+		ReadFile(fileMap);
+
+		for (const auto &key : mModifiedKeySet)
+		{
+			const auto it = mValueMap.find(key);
+			if (it != mValueMap.end())
+				fileMap[key] = it->second;
+		}
+
+		if (!WriteFile(fileMap))
+			return false;
+
+		// ̃vZXǉlg悤ɂ
+		mValueMap.swap(fileMap);
+		mModifiedKeySet.clear();
+	}
+	catch (...)
+	{
+		return false;
+	}
+
+	return true;
+}
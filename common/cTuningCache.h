@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <boost/filesystem.hpp>
+#include <msgpack.hpp>
+
+
+// ̌ʂȂǂt@CɕۑLbV
+// Et@Cɂ̓tH[}bg̃o[WAf[^̃o[WA`FbNTwb_[t
+// Eǂݍ߂Ȃt@C(ĂAo[WႤ)͖ċ̃LbVƂĈ
+// Eۑ̓t@CbNĂAt@C̓eƎύXe}[WAꎞt@CɏĂu
+//   (̃vZXɕۑĂÃvZXǉe͏Ȃ)
+// Eǂݍݎ͋LbNāAۑ̃vZXΏÎ҂
+// lmsgpackŃVACYł^Ȃ牽łۑł
+class cTuningCache
+{
+private:
+	typedef std::unordered_map<std::string, std::vector<char>> ValueMap;
+
+	const uint32_t mDataVersion;
+
+	ValueMap mValueMap;
+	std::unordered_set<std::string> mModifiedKeySet; // ۑĂȂύX̂L[
+	boost::filesystem::path mDataPath;
+	bool mIsLoaded;
+	mutable std::mutex mMutex;
+
+private:
+	// t@CǂݍmapɓBǂݍ߂Ȃfalse(map͕ύXȂ)
+	bool ReadFile(ValueMap &map) const;
+	bool WriteFile(const ValueMap &map) const;
+
+	// ̃vZXƔr邽߂̃bNt@C̃pX(create: ΍)
+	boost::filesystem::path GetLockPath(const bool create) const;
+
+	void Load();
+
+	bool GetRaw(const std::string &key, std::vector<char> &value);
+	void SetRaw(const std::string &key, std::vector<char> &&value);
+
+public:
+	// data_version: ۑf[^̃o[WBt@C̃o[Wƈt@C̓e͖
+	explicit cTuningCache(const uint32_t data_version);
+	~cTuningCache();
+
+	// ۑݒ肷BۑĂȂύX͔j
+	void SetDataPath(const boost::filesystem::path &path);
+
+	template<typename T>
+	bool Get(const std::string &key, T &value)
+	{
+		std::vector<char> buf;
+		if (!GetRaw(key, buf))
+			return false;
+
+		try
+		{
+			msgpack::unpack(buf.data(), buf.size()).get().convert(value);
+		}
+		catch (...)
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	template<typename T>
+	void Set(const std::string &key, const T &value)
+	{
+		msgpack::sbuffer sbuf;
+		msgpack::pack(sbuf, value);
+
+		SetRaw(key, std::vector<char>(sbuf.data(), sbuf.data() + sbuf.size()));
+	}
+
+	// ύX΃t@Cɕۑ
+	bool Save();
+};
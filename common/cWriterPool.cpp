@@ -0,0 +1,369 @@
+#include "cWriterPool.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "cTrace.h"
+#include "cMetrics.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+	// 1ɏޑ傫(LbVʂȂꍇDirectIOAlign̔{ł邱)
+	const size_t WriteBlockSize = 4 * 1024 * 1024;
+	// LbVʂɏނƂ̃obt@AʒuA傫̋E
+	const size_t DirectIOAlign = 4096;
+
+	struct stWriteJob
+	{
+		boost::filesystem::path path;
+		std::vector<unsigned char> buf;
+		double push_time;
+	};
+
+	std::mutex g_PoolMutex;
+	std::condition_variable g_JobCond; // L[ɓA܂͏I
+	std::condition_variable g_SpaceCond; // L[󂢂
+
+	std::deque<stWriteJob> g_JobQueue;
+	std::vector<std::thread> g_ThreadList;
+	size_t g_QueueSize = 1;
+	bool g_IsStop = false;
+	size_t g_ErrorNum = 0;
+	cWriterPool::ErrorFunc g_ErrorFunc;
+
+	std::atomic<int> g_FsyncPolicy(cWriterPool::eFsyncPolicyNone);
+	std::atomic<bool> g_IsDirectIO(false);
+
+	// ݃XbhĂ΂Ă邩
+	thread_local bool g_IsWriterThread = false;
+
+	// bufsizeȍ~align̔{܂0Ŗ߂ubNɓn(LbVʂȂ݂̓obt@̈ʒu)
+	template<typename WriteFunc>
+	bool WriteAlignedBlocks(const std::vector<unsigned char> &buf, const WriteFunc &write_func)
+	{
+		std::vector<unsigned char> block(WriteBlockSize + DirectIOAlign);
+		unsigned char *ptr = block.data() + (DirectIOAlign - (uintptr_t)block.data() % DirectIOAlign) % DirectIOAlign;
+
+		for (size_t pos = 0; pos < buf.size(); pos += WriteBlockSize)
+		{
+			const size_t size = std::min(WriteBlockSize, buf.size() - pos);
+			const size_t alignedSize = (size + DirectIOAlign - 1) / DirectIOAlign * DirectIOAlign;
+
+			memcpy(ptr, buf.data() + pos, size);
+			memset(ptr + size, 0, alignedSize - size);
+
+			if (!write_func(ptr, alignedSize))
+				return false;
+		}
+
+		return true;
+	}
+
+#ifdef _WIN32
+	bool WriteBuffer(const boost::filesystem::path &path, const std::vector<unsigned char> &buf, const bool is_direct, const bool is_sync)
+	{
+		bool isDirect = is_direct;
+
+		HANDLE h = CreateFileW(path.wstring().c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | (isDirect ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+		if (h == INVALID_HANDLE_VALUE && isDirect)
+		{
+			isDirect = false;
+			h = CreateFileW(path.wstring().c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		}
+
+		if (h == INVALID_HANDLE_VALUE)
+			return false;
+
+		const auto WriteAll = [h](const unsigned char *data, const size_t size)
+		{
+			DWORD written = 0;
+			return ::WriteFile(h, data, (DWORD)size, &written, NULL) && written == size;
+		};
+
+		bool isOK = true;
+		if (isDirect)
+		{
+			isOK = WriteAlignedBlocks(buf, WriteAll);
+
+			// ߂؂l߂
+			LARGE_INTEGER size;
+			size.QuadPart = (LONGLONG)buf.size();
+			isOK = isOK && SetFilePointerEx(h, size, NULL, FILE_BEGIN) && SetEndOfFile(h);
+		}
+		else
+		{
+			for (size_t pos = 0; isOK && pos < buf.size(); pos += WriteBlockSize)
+				isOK = WriteAll(buf.data() + pos, std::min(WriteBlockSize, buf.size() - pos));
+		}
+
+		if (isOK && is_sync)
+			isOK = FlushFileBuffers(h) != 0;
+
+		CloseHandle(h);
+
+		return isOK;
+	}
+
+	bool SyncDir(const boost::filesystem::path &dir)
+	{
+		// Windowsł̓tH_fBXNɏoȂ̂ŉȂ
+		return true;
+	}
+
+	// ̃vZXJĂt@CɒuȂ
+	bool IsSharingViolation(const boost::system::error_code &error)
+	{
+		return error.value() == ERROR_SHARING_VIOLATION || error.value() == ERROR_LOCK_VIOLATION;
+	}
+#else
+	bool WriteBuffer(const boost::filesystem::path &path, const std::vector<unsigned char> &buf, const bool is_direct, const bool is_sync)
+	{
+		bool isDirect = false;
+
+		int fd = -1;
+#ifdef O_DIRECT
+		if (is_direct)
+		{
+			fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+			isDirect = fd >= 0;
+		}
+#endif
+		if (fd < 0)
+			fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (fd < 0)
+			return false;
+
+		const auto WriteAll = [fd](const unsigned char *data, const size_t size)
+		{
+			size_t pos = 0;
+			while (pos < size)
+			{
+				const ssize_t written = write(fd, data + pos, size - pos);
+				if (written <= 0)
+					return false;
+
+				pos += written;
+			}
+
+			return true;
+		};
+
+		bool isOK = true;
+		if (isDirect)
+		{
+			// ߂؂l߂
+			isOK = WriteAlignedBlocks(buf, WriteAll) && ftruncate(fd, (off_t)buf.size()) == 0;
+		}
+		else
+		{
+			for (size_t pos = 0; isOK && pos < buf.size(); pos += WriteBlockSize)
+				isOK = WriteAll(buf.data() + pos, std::min(WriteBlockSize, buf.size() - pos));
+		}
+
+		if (isOK && is_sync)
+			isOK = fsync(fd) == 0;
+
+		if (close(fd) != 0)
+			isOK = false;
+
+		return isOK;
+	}
+
+	bool SyncDir(const boost::filesystem::path &dir)
+	{
+		const int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		const bool isOK = fsync(fd) == 0;
+		close(fd);
+
+		return isOK;
+	}
+
+	bool IsSharingViolation(const boost::system::error_code &error)
+	{
+		// JĂt@CɂûŋNȂ
+		return false;
+	}
+#endif
+
+	void WriterThread()
+	{
+		cTrace::SetThreadName("writer");
+
+		std::unique_lock<std::mutex> lock(g_PoolMutex);
+		while (true)
+		{
+			g_JobCond.wait(lock, []() { return g_IsStop || !g_JobQueue.empty(); });
+			if (g_JobQueue.empty())
+				break;
+
+			stWriteJob job(std::move(g_JobQueue.front()));
+			g_JobQueue.pop_front();
+			g_SpaceCond.notify_one();
+
+			lock.unlock();
+
+			cMetrics::Observe("waifu2x_write_queue_seconds", cMetrics::Now() - job.push_time);
+
+			const double startTime = cMetrics::Now();
+			bool isOK = false;
+			{
+				TRACE_SCOPE_WAIFU2X("cWriterPool::Write(async)");
+				isOK = cWriterPool::Write(job.path, job.buf);
+			}
+			cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - startTime, "stage=\"write\"");
+
+			lock.lock();
+
+			if (!isOK)
+			{
+				g_ErrorNum++;
+
+				const auto func = g_ErrorFunc;
+				lock.unlock();
+
+				cMetrics::Increment("waifu2x_write_errors_total");
+				if (func)
+					func(job.path);
+
+				lock.lock();
+			}
+		}
+	}
+
+}
+
+
+void cWriterPool::Start(const int thread_num, const int queue_size)
+{
+	Stop();
+
+	std::lock_guard<std::mutex> lock(g_PoolMutex);
+
+	g_QueueSize = std::max(queue_size, 1);
+	g_IsStop = false;
+	g_ErrorNum = 0;
+
+	for (int i = 0; i < thread_num; i++)
+	{
+		g_ThreadList.emplace_back([]()
+		{
+			g_IsWriterThread = true;
+			WriterThread();
+		});
+	}
+}
+
+size_t cWriterPool::Stop()
+{
+	std::vector<std::thread> threadList;
+	{
+		std::lock_guard<std::mutex> lock(g_PoolMutex);
+		g_IsStop = true;
+		threadList.swap(g_ThreadList);
+	}
+
+	g_JobCond.notify_all();
+
+	for (auto &t : threadList)
+		t.join();
+
+	std::lock_guard<std::mutex> lock(g_PoolMutex);
+	return g_ErrorNum;
+}
+
+void cWriterPool::SetFsyncPolicy(const eFsyncPolicy policy)
+{
+	g_FsyncPolicy = policy;
+}
+
+void cWriterPool::SetDirectIO(const bool enable)
+{
+	g_IsDirectIO = enable;
+}
+
+void cWriterPool::SetErrorFunc(const ErrorFunc &func)
+{
+	std::lock_guard<std::mutex> lock(g_PoolMutex);
+	g_ErrorFunc = func;
+}
+
+bool cWriterPool::WriteFile(const boost::filesystem::path &path, const std::vector<unsigned char> &buf)
+{
+	const eFsyncPolicy policy = (eFsyncPolicy)(int)g_FsyncPolicy;
+	const bool isSync = policy != eFsyncPolicyNone;
+
+	// ̃t@CȂ悤ɁAtH_̈ꎞt@CɏĂu
+	// (O͏݂Ƃɕς̂ŁAo͐ւ݂̏dȂĂꎞt@C荇Ȃ)
+	boost::system::error_code error;
+	const boost::filesystem::path tmp_file = path.parent_path() / boost::filesystem::unique_path(path.filename().native() + boost::filesystem::path(".%%%%-%%%%-%%%%.tmp").native(), error);
+	if (error)
+		return false;
+
+	if (!WriteBuffer(tmp_file, buf, g_IsDirectIO, isSync))
+	{
+		boost::filesystem::remove(tmp_file, error);
+		return false;
+	}
+
+	boost::filesystem::rename(tmp_file, path, error);
+	if (error)
+	{
+		const bool isSharingViolation = IsSharingViolation(error);
+
+		boost::filesystem::remove(tmp_file, error);
+
+		// Windowsł͑̃vZXJĂt@C͒uȂAL[hɂĂ͏㏑͂ł̂ŏ㏑
+		if (!isSharingViolation || !WriteBuffer(path, buf, g_IsDirectIO, isSync))
+			return false;
+	}
+
+	if (policy == eFsyncPolicyFileAndDir && !SyncDir(path.parent_path()))
+		return false;
+
+	return true;
+}
+
+bool cWriterPool::Write(const boost::filesystem::path &path, std::vector<unsigned char> &buf)
+{
+	if (!g_IsWriterThread)
+	{
+		std::unique_lock<std::mutex> lock(g_PoolMutex);
+		if (!g_ThreadList.empty() && !g_IsStop)
+		{
+			// L[tȂ珑݂iނ܂ő҂
+			g_SpaceCond.wait(lock, []() { return g_JobQueue.size() < g_QueueSize; });
+
+			stWriteJob job;
+			job.path = path;
+			job.buf.swap(buf);
+			job.push_time = cMetrics::Now();
+			g_JobQueue.push_back(std::move(job));
+
+			g_JobCond.notify_one();
+
+			return true;
+		}
+	}
+
+	std::vector<unsigned char> data;
+	data.swap(buf);
+
+	return WriteFile(path, data);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include <functional>
+#include <boost/filesystem.hpp>
+
+
+// o̓t@C݂̏Xbh؂藣
+// EStart()ŃXbhJnƁAWrite()̓L[ɓĂɖ߂(L[tȂ󂭂܂ő҂)
+// EJnĂȂWrite()Ă񂾃Xbhł̂܂܏
+// EtH_̈ꎞt@C(݂Ƃɕʂ̖O)ɏĂûŁÃt@Co͂̃pXɌȂ
+//   (̃vZXJĂĒuȂꍇAo͂̃pXɂ̂܂܏㏑)
+// EDZĨ^C(cDziWriter)ƑтƂɏTIFF(cTiffWriter)͉摜ŜɎȂ悤ɒڏނ̂ŁA͒ʂȂ
+//   (DZI͑SẴ^C߂Ă.dziATIFF͎ňꎞt@CɏĂu)
+class cWriterPool
+{
+public:
+	enum eFsyncPolicy
+	{
+		eFsyncPolicyNone, // OSɔC(ftHg)
+		eFsyncPolicyFile, // uOɈꎞt@CfBXNɏo
+		eFsyncPolicyFileAndDir, // ɒuɃtH_fBXNɏo(Windowsł̓t@Ĉ)
+	};
+
+	// 񓯊݂̏ɎsƂɌĂ΂(݃XbhĂ΂)
+	typedef std::function<void(const boost::filesystem::path &path)> ErrorFunc;
+
+private:
+	// ꎞt@Cɏpathɒu
+	static bool WriteFile(const boost::filesystem::path &path, const std::vector<unsigned char> &buf);
+
+public:
+	// thread_num: ݃Xbh̐(0Ȃ񓯊ɂȂ)
+	// queue_size: ݑ҂ɂłt@C̐
+	static void Start(const int thread_num, const int queue_size);
+	// L[ɂSẴt@CłXbhIB񓯊݂̏ɎsԂ
+	static size_t Stop();
+
+	static void SetFsyncPolicy(const eFsyncPolicy policy);
+
+	// LȂLbVʂ(O_DIRECT, FILE_FLAG_NO_BUFFERING)傫ubNPʂŏ(ftHg͖)
+	// gȂt@CVXeł͕ʂɏ
+	static void SetDirectIO(const bool enable);
+
+	static void SetErrorFunc(const ErrorFunc &func);
+
+	// bufpathɏ(buf̒ĝ͈ŋɂȂ)
+	// 񓯊̏ꍇ̓L[ɓtrue(܂܂ĂȂ)
+	// 񓯊݂̏̎s͌Ăяoɖ߂lł͕ԂȂ̂ŁAErrorFuncݒ肷邩Stop()̖߂lmF邱
+	static bool Write(const boost::filesystem::path &path, std::vector<unsigned char> &buf);
+};
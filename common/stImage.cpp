@@ -1,4 +1,12 @@
 #include "stImage.h"
+#include "cTrace.h"
+#include "cWriterPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <string>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/file_descriptor.hpp>
 #include <boost/algorithm/string.hpp>
@@ -6,6 +14,11 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 
+// JPEG̐F̊Ԉ(IMWRITE_JPEG_SAMPLING_FACTOR)OpenCV 4.5.5ȍ~Ŏwł
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 5)))
+#define WAIFU2X_JPEG_SAMPLING_SUPPORTED
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -35,8 +48,18 @@ const std::vector<stImage::stOutputExtentionElement> stImage::OutputExtentionLis
 	{L".ppm",{8, 16}, boost::optional<int>(), boost::optional<int>(), boost::optional<int>(), boost::optional<int>()},
 	{L".webp",{8}, 1, 100, 100, cv::IMWRITE_WEBP_QUALITY},
 	{L".tga",{8}, 0, 1, 0, 0},
+	{L".dzi",{8}, 0, 100, 95, cv::IMWRITE_JPEG_QUALITY}, // DeepZoom̃^C̃s~bh(掿JPEG̃^Ĉ)
+	{L".pfm",{32}, boost::optional<int>(), boost::optional<int>(), boost::optional<int>(), boost::optional<int>()},
+	{L".npy",{32}, boost::optional<int>(), boost::optional<int>(), boost::optional<int>(), boost::optional<int>()},
 };
 
+// SetNpyPlanar()Őݒ肵ANPY(C, H, W)̌`ŕۑ邩
+static std::atomic<bool> g_IsNpyPlanar(false);
+
+// SetEncodeOption()Őݒ肵AGR[h̐ݒ
+static std::mutex g_EncodeOptionMutex;
+static stImage::stEncodeOption g_EncodeOption = stImage::GetEncodePreset(stImage::eEncodePresetDefault);
+
 
 template<typename BufType>
 static bool readFile(boost::iostreams::stream<boost::iostreams::file_descriptor_source> &is, std::vector<BufType> &buf)
@@ -72,41 +95,10 @@ static bool readFile(const boost::filesystem::path &path, std::vector<BufType> &
 	return readFile(is, buf);
 }
 
-template<typename BufType>
-static bool writeFile(boost::iostreams::stream<boost::iostreams::file_descriptor> &os, const std::vector<BufType> &buf)
-{
-	if (!os)
-		return false;
-
-	const auto WriteSize = sizeof(BufType) * buf.size();
-	os.write((const char *)buf.data(), WriteSize);
-	if (os.fail())
-		return false;
-
-	return true;
-}
-
-template<typename BufType>
-static bool writeFile(const boost::filesystem::path &path, std::vector<BufType> &buf)
-{
-	boost::iostreams::stream<boost::iostreams::file_descriptor> os;
-
-	try
-	{
-		os.open(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
-	}
-	catch (...)
-	{
-		return false;
-	}
-
-	return writeFile(os, buf);
-}
-
 static void Waifu2x_stbi_write_func(void *context, void *data, int size)
 {
-	boost::iostreams::stream<boost::iostreams::file_descriptor> *osp = (boost::iostreams::stream<boost::iostreams::file_descriptor> *)context;
-	osp->write((const char *)data, size);
+	std::vector<unsigned char> *bufp = (std::vector<unsigned char> *)context;
+	bufp->insert(bufp->end(), (const unsigned char *)data, (const unsigned char *)data + size);
 }
 
 int stImage::DepthBitToCVDepth(const int depth_bit)
@@ -219,8 +211,10 @@ Waifu2x::eWaifu2xError stImage::AlphaMakeBorder(std::vector<cv::Mat> &planes, co
 }
 
 // 摜ǂݍŒl0.0f`1.0f͈̔͂ɕϊ
-Waifu2x::eWaifu2xError stImage::LoadMat(cv::Mat &im, const boost::filesystem::path &input_file)
+Waifu2x::eWaifu2xError stImage::LoadMat(cv::Mat &im, const boost::filesystem::path &input_file, const ReduceFunc &reduce_func)
 {
+	TRACE_SCOPE_WAIFU2X("stImage::LoadMat");
+
 	cv::Mat original_image;
 
 	{
@@ -229,10 +223,21 @@ Waifu2x::eWaifu2xError stImage::LoadMat(cv::Mat &im, const boost::filesystem::pa
 			return Waifu2x::eWaifu2xError_FailedOpenInputFile;
 
 		const boost::filesystem::path ipext(input_file.extension());
-		if (!boost::iequals(ipext.string(), ".bmp")) // ̃t@C`̏ꍇOpenCVœǂނƃoO邱Ƃ̂STBID悳
+
+		if (IsRawFloatFile(input_file)) // _̐f[^OpenCVʂɂ̂܂ܓǂ
 		{
+			const Waifu2x::eWaifu2xError ret = boost::iequals(ipext.string(), ".pfm") ? LoadMatByPFM(original_image, img_data) : LoadMatByNPY(original_image, img_data);
+			if (ret != Waifu2x::eWaifu2xError_OK)
+				return ret;
+		}
+		else if (!boost::iequals(ipext.string(), ".bmp")) // ̃t@C`̏ꍇOpenCVœǂނƃoO邱Ƃ̂STBID悳
+		{
+			if (reduce_func && (boost::iequals(ipext.string(), ".jpg") || boost::iequals(ipext.string(), ".jpeg")))
+				original_image = DecodeReducedJpeg(img_data, reduce_func);
+
 			cv::Mat im(img_data.size(), 1, CV_8U, img_data.data());
-			original_image = cv::imdecode(im, cv::IMREAD_UNCHANGED);
+			if (original_image.empty())
+				original_image = cv::imdecode(im, cv::IMREAD_UNCHANGED);
 
 			if (original_image.empty())
 			{
@@ -315,6 +320,439 @@ Waifu2x::eWaifu2xError stImage::LoadMatBySTBI(cv::Mat &im, const std::vector<cha
 	return Waifu2x::eWaifu2xError_OK;
 }
 
+cv::Mat stImage::DecodeReducedJpeg(const std::vector<char> &img_data, const ReduceFunc &reduce_func)
+{
+	cv::Size_<int> size;
+	int channel = 0;
+	if (!GetJpegInfo(img_data, size, channel))
+		return cv::Mat();
+
+	// libjpegDCT̒iKł̏k(1/2, 1/4, 1/8)g
+	int flags = 0;
+	switch (reduce_func(size))
+	{
+	case 2:
+		flags = channel == 1 ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+		break;
+
+	case 4:
+		flags = channel == 1 ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+		break;
+
+	case 8:
+		flags = channel == 1 ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+		break;
+
+	default:
+		return cv::Mat();
+	}
+
+	// IMREAD_UNCHANGEDœǂ񂾏ꍇƓ悤EXIF͖̌
+	cv::Mat im(img_data.size(), 1, CV_8U, (void *)img_data.data());
+	return cv::imdecode(im, flags | cv::IMREAD_IGNORE_ORIENTATION);
+}
+
+bool stImage::GetJpegInfo(const std::vector<char> &img_data, cv::Size_<int> &size, int &channel)
+{
+	const auto Byte = [&img_data](const size_t i)
+	{
+		return (int)(unsigned char)img_data[i];
+	};
+
+	// SOI
+	if (img_data.size() < 4 || Byte(0) != 0xFF || Byte(1) != 0xD8)
+		return false;
+
+	size_t pos = 2;
+	while (pos + 4 <= img_data.size())
+	{
+		if (Byte(pos) != 0xFF)
+			return false;
+
+		const int marker = Byte(pos + 1);
+		if (marker == 0xFF) // ߍ
+		{
+			pos++;
+			continue;
+		}
+
+		if (marker == 0xDA || marker == 0xD9) // SOSEOI܂łSOF
+			return false;
+
+		const size_t len = (Byte(pos + 2) << 8) | Byte(pos + 3);
+
+		// SOF0`SOF15(DHT, JPG, DAC)
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+		{
+			if (pos + 10 > img_data.size())
+				return false;
+
+			size.height = (Byte(pos + 5) << 8) | Byte(pos + 6);
+			size.width = (Byte(pos + 7) << 8) | Byte(pos + 8);
+			channel = Byte(pos + 9);
+
+			return size.width > 0 && size.height > 0;
+		}
+
+		pos += 2 + len;
+	}
+
+	return false;
+}
+
+Waifu2x::eWaifu2xError stImage::LoadMatByPFM(cv::Mat &im, const std::vector<char> &img_data)
+{
+	// wb_"PF"(RGB)"Pf"(O[XP[)AAAXP[(Ȃ烊gGfBA)󔒂ŋ؂
+	size_t pos = 0;
+	const auto NextToken = [&img_data, &pos]()
+	{
+		while (pos < img_data.size() && isspace((unsigned char)img_data[pos]))
+			pos++;
+
+		std::string token;
+		while (pos < img_data.size() && !isspace((unsigned char)img_data[pos]))
+			token += img_data[pos++];
+
+		return token;
+	};
+
+	const std::string magic = NextToken();
+	const std::string width = NextToken();
+	const std::string height = NextToken();
+	const std::string scale = NextToken();
+	pos++; // XP[̌̋1
+
+	if (!(magic == "PF" || magic == "Pf") || pos > img_data.size())
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	int w = 0, h = 0;
+	double s = 0.0;
+	try
+	{
+		w = std::stoi(width);
+		h = std::stoi(height);
+		s = std::stod(scale);
+	}
+	catch (...)
+	{
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+	}
+
+	if (w <= 0 || h <= 0 || s == 0.0)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	const int Channel = magic == "PF" ? 3 : 1;
+	const size_t LineSize = (size_t)w * Channel * sizeof(float);
+	if ((img_data.size() - pos) / LineSize < (size_t)h)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	im = cv::Mat(cv::Size(w, h), CV_MAKETYPE(CV_32F, Channel));
+
+	// s͉珇ɕł
+	for (int i = 0; i < h; i++)
+		memcpy(im.ptr(h - 1 - i), img_data.data() + pos + LineSize * i, LineSize);
+
+	if (s > 0.0) // rbOGfBAȂ̂ŃoCgւ
+	{
+		for (int i = 0; i < h; i++)
+		{
+			auto ptr = im.ptr<uchar>(i);
+			for (size_t j = 0; j < LineSize; j += sizeof(float))
+			{
+				std::swap(ptr[j + 0], ptr[j + 3]);
+				std::swap(ptr[j + 1], ptr[j + 2]);
+			}
+		}
+	}
+
+	cv::patchNaNs(im, 0.0);
+
+	if (Channel == 3) // RGBBGRɕϊ
+		cv::cvtColor(im, im, cv::COLOR_RGB2BGR);
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+Waifu2x::eWaifu2xError stImage::LoadMatByNPY(cv::Mat &im, const std::vector<char> &img_data)
+{
+	// "\x93NUMPY"Ao[W(2oCg)Awb_̒(1.02oCgA2.0ȍ~4oCg)Awb_(Python̎̕)Af[^̏ɕł
+	if (img_data.size() < 10 || memcmp(img_data.data(), "\x93NUMPY", 6) != 0)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	const auto Byte = [&img_data](const size_t i)
+	{
+		return (size_t)(unsigned char)img_data[i];
+	};
+
+	size_t pos = 0;
+	size_t headerSize = 0;
+	if (Byte(6) == 1)
+	{
+		headerSize = Byte(8) | (Byte(9) << 8);
+		pos = 10;
+	}
+	else
+	{
+		if (img_data.size() < 12)
+			return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+		headerSize = Byte(8) | (Byte(9) << 8) | (Byte(10) << 16) | (Byte(11) << 24);
+		pos = 12;
+	}
+
+	if (img_data.size() - pos < headerSize)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	const std::string header(img_data.data() + pos, headerSize);
+	pos += headerSize;
+
+	// key̒l̕(':'̌ォ)
+	const auto GetValue = [&header](const char *key) -> std::string
+	{
+		const auto p = header.find(key);
+		if (p == std::string::npos)
+			return std::string();
+
+		const auto c = header.find(':', p);
+		if (c == std::string::npos)
+			return std::string();
+
+		return boost::trim_left_copy(header.substr(c + 1));
+	};
+
+	// ^
+	std::string descr = GetValue("'descr'");
+	if (descr.size() < 2 || !(descr[0] == '\'' || descr[0] == '"') || descr.find(descr[0], 1) == std::string::npos)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+	descr = descr.substr(1, descr.find(descr[0], 1) - 1);
+
+	int depth = 0;
+	if (descr == "<f4")
+		depth = CV_32F;
+	else if (descr == "<f8")
+		depth = CV_64F;
+	else if (descr == "|u1" || descr == "<u1")
+		depth = CV_8U;
+	else if (descr == "<u2")
+		depth = CV_16U;
+	else
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	// D̕тɂ͑ΉȂ
+	if (GetValue("'fortran_order'").compare(0, 5, "False") != 0)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	// `
+	const std::string shapeStr = GetValue("'shape'");
+	if (shapeStr.empty() || shapeStr[0] != '(' || shapeStr.find(')') == std::string::npos)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	std::vector<int> shape;
+	{
+		const std::string dims = shapeStr.substr(1, shapeStr.find(')') - 1);
+
+		std::vector<std::string> list;
+		boost::split(list, dims, boost::is_any_of(","));
+
+		try
+		{
+			for (auto str : list)
+			{
+				boost::trim(str);
+				if (!str.empty())
+					shape.push_back(std::stoi(str));
+			}
+		}
+		catch (...)
+		{
+			return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+		}
+	}
+
+	// (H, W), (H, W, C)A`lƂ̖ʂׂ(C, H, W)
+	const auto IsChannel = [](const int c)
+	{
+		return c == 1 || c == 3 || c == 4;
+	};
+
+	int w = 0, h = 0, Channel = 1;
+	bool isPlanar = false;
+	if (shape.size() == 2)
+	{
+		h = shape[0];
+		w = shape[1];
+	}
+	else if (shape.size() == 3 && IsChannel(shape[2]))
+	{
+		h = shape[0];
+		w = shape[1];
+		Channel = shape[2];
+	}
+	else if (shape.size() == 3 && IsChannel(shape[0]))
+	{
+		Channel = shape[0];
+		h = shape[1];
+		w = shape[2];
+		isPlanar = true;
+	}
+	else
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	if (w <= 0 || h <= 0)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	const size_t PlaneSize = (size_t)w * h * CV_ELEM_SIZE1(depth);
+	if ((img_data.size() - pos) / PlaneSize < (size_t)Channel)
+		return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+
+	void *data = (void *)(img_data.data() + pos);
+	if (!isPlanar)
+		im = cv::Mat(cv::Size(w, h), CV_MAKETYPE(depth, Channel), data).clone();
+	else
+	{
+		std::vector<cv::Mat> planes;
+		for (int i = 0; i < Channel; i++)
+			planes.push_back(cv::Mat(cv::Size(w, h), depth, (uchar *)data + PlaneSize * i));
+
+		cv::merge(planes, im);
+	}
+
+	if (depth == CV_64F)
+		im.convertTo(im, CV_32F);
+
+	if (im.depth() == CV_32F)
+		cv::patchNaNs(im, 0.0);
+
+	// RGBBGRɕϊ
+	if (Channel == 3)
+		cv::cvtColor(im, im, cv::COLOR_RGB2BGR);
+	else if (Channel == 4)
+		cv::cvtColor(im, im, cv::COLOR_RGBA2BGRA);
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+bool stImage::IsRawFloatFile(const boost::filesystem::path &path)
+{
+	const std::string ext = path.extension().string();
+
+	return boost::iequals(ext, ".pfm") || boost::iequals(ext, ".npy");
+}
+
+void stImage::SetNpyPlanar(const bool planar)
+{
+	g_IsNpyPlanar = planar;
+}
+
+stImage::stEncodeOption stImage::GetEncodePreset(const eEncodePreset preset)
+{
+	stEncodeOption option;
+	option.png_compression = -1;
+	option.png_strategy = -1;
+	option.jpeg_optimize = false;
+	option.jpeg_progressive = false;
+	option.jpeg_sampling = eJpegSamplingDefault;
+
+	switch (preset)
+	{
+	case eEncodePresetFast:
+		// g債摜͓l₷̂ŁARLEłȂɏk
+		option.png_compression = 1;
+		option.png_strategy = cv::IMWRITE_PNG_STRATEGY_RLE;
+		break;
+
+	case eEncodePresetBalanced:
+		option.png_compression = 6;
+		option.png_strategy = cv::IMWRITE_PNG_STRATEGY_FILTERED;
+		option.jpeg_optimize = true;
+		break;
+
+	case eEncodePresetSmall:
+		option.png_compression = 9;
+		option.png_strategy = cv::IMWRITE_PNG_STRATEGY_DEFAULT;
+		option.jpeg_optimize = true;
+		option.jpeg_progressive = true;
+		break;
+	}
+
+	return option;
+}
+
+bool stImage::IsJpegSamplingSupported()
+{
+#ifdef WAIFU2X_JPEG_SAMPLING_SUPPORTED
+	return true;
+#else
+	return false;
+#endif
+}
+
+void stImage::SetEncodeOption(const stEncodeOption &option)
+{
+	std::lock_guard<std::mutex> lock(g_EncodeOptionMutex);
+	g_EncodeOption = option;
+}
+
+void stImage::AppendEncodeParams(const std::string &ext, std::vector<int> &params)
+{
+	stEncodeOption option;
+	{
+		std::lock_guard<std::mutex> lock(g_EncodeOptionMutex);
+		option = g_EncodeOption;
+	}
+
+	if (boost::iequals(ext, ".png"))
+	{
+		if (option.png_compression >= 0)
+		{
+			params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+			params.push_back(option.png_compression);
+		}
+
+		if (option.png_strategy >= 0)
+		{
+			params.push_back(cv::IMWRITE_PNG_STRATEGY);
+			params.push_back(option.png_strategy);
+		}
+	}
+	else if (boost::iequals(ext, ".jpg") || boost::iequals(ext, ".jpeg"))
+	{
+		if (option.jpeg_optimize)
+		{
+			params.push_back(cv::IMWRITE_JPEG_OPTIMIZE);
+			params.push_back(1);
+		}
+
+		if (option.jpeg_progressive)
+		{
+			params.push_back(cv::IMWRITE_JPEG_PROGRESSIVE);
+			params.push_back(1);
+		}
+
+#ifdef WAIFU2X_JPEG_SAMPLING_SUPPORTED
+		int sampling = -1;
+		switch (option.jpeg_sampling)
+		{
+		case eJpegSampling420:
+			sampling = cv::IMWRITE_JPEG_SAMPLING_FACTOR_420;
+			break;
+		case eJpegSampling422:
+			sampling = cv::IMWRITE_JPEG_SAMPLING_FACTOR_422;
+			break;
+		case eJpegSampling444:
+			sampling = cv::IMWRITE_JPEG_SAMPLING_FACTOR_444;
+			break;
+		}
+
+		if (sampling >= 0)
+		{
+			params.push_back(cv::IMWRITE_JPEG_SAMPLING_FACTOR);
+			params.push_back(sampling);
+		}
+#endif
+	}
+}
+
 cv::Mat stImage::ConvertToFloat(const cv::Mat &im)
 {
 	cv::Mat convert;
@@ -337,7 +775,7 @@ cv::Mat stImage::ConvertToFloat(const cv::Mat &im)
 }
 
 
-stImage::stImage() : mIsRequestDenoise(false), pad_w1(0), pad_h1(0), pad_w2(0), pad_h2(0)
+stImage::stImage() : mIsRequestDenoise(false), mIsOrgRGB(false), pad_w1(0), pad_h1(0), pad_w2(0), pad_h2(0)
 {
 }
 
@@ -354,14 +792,16 @@ void stImage::Clear()
 	mEndImage.release();
 }
 
-Waifu2x::eWaifu2xError stImage::Load(const boost::filesystem::path &input_file)
+Waifu2x::eWaifu2xError stImage::Load(const boost::filesystem::path &input_file, const ReduceFunc &reduce_func)
 {
+	TRACE_SCOPE_WAIFU2X("stImage::Load");
+
 	Clear();
 
 	Waifu2x::eWaifu2xError ret;
 
 	cv::Mat im;
-	ret = LoadMat(im, input_file);
+	ret = LoadMat(im, input_file, reduce_func);
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
 
@@ -369,6 +809,8 @@ Waifu2x::eWaifu2xError stImage::Load(const boost::filesystem::path &input_file)
 	mOrgChannel = im.channels();
 	mOrgSize = im.size();
 
+	mIsOrgRGB = false;
+
 	const boost::filesystem::path ip(input_file);
 	const boost::filesystem::path ipext(ip.extension());
 
@@ -379,31 +821,49 @@ Waifu2x::eWaifu2xError stImage::Load(const boost::filesystem::path &input_file)
 	return Waifu2x::eWaifu2xError_OK;
 }
 
-Waifu2x::eWaifu2xError stImage::Load(const void* source, const int width, const int height, const int channel, const int stride)
+Waifu2x::eWaifu2xError stImage::Load(const void* source, const int width, const int height, const int channel, const int stride, const int depth)
 {
-	Clear();
-
-	cv::Mat original_image(cv::Size(width, height), CV_MAKETYPE(CV_8U, channel), (void *)source, stride);
+	TRACE_SCOPE_WAIFU2X("stImage::Load(buffer)");
 
-	if (original_image.channels() >= 3) // RGBȂ̂BGRɂ
-	{
-		std::vector<cv::Mat> planes;
-		cv::split(original_image, planes);
+	Clear();
 
-		std::swap(planes[0], planes[2]);
+	if (depth != 8 && depth != 16 && depth != 32)
+		return Waifu2x::eWaifu2xError_InvalidParameter;
 
-		cv::merge(planes, original_image);
-	}
+	// Rs[ɂ̂܂܎g(RGB̕т̓lbǧ`ɕϊƂɍ킹)
+	cv::Mat original_image(cv::Size(width, height), CV_MAKETYPE(DepthBitToCVDepth(depth), channel), (void *)source, stride);
 
 	mOrgFloatImage = original_image;
 	mOrgChannel = original_image.channels();
 	mOrgSize = original_image.size();
 
 	mIsRequestDenoise = false;
+	mIsOrgRGB = original_image.channels() >= 3;
 
 	return Waifu2x::eWaifu2xError_OK;
 }
 
+Waifu2x::eWaifu2xError stImage::Load(const cv::Mat &im)
+{
+	TRACE_SCOPE_WAIFU2X("stImage::Load(mat)");
+
+	Clear();
+
+	mOrgFloatImage = im;
+	mOrgChannel = im.channels();
+	mOrgSize = im.size();
+
+	mIsRequestDenoise = false;
+	mIsOrgRGB = false;
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+const cv::Size_<int>& stImage::GetOrgSize() const
+{
+	return mOrgSize;
+}
+
 Factor stImage::GetScaleFromWidth(const int width) const
 {
 	return Factor((double)width, (double)mOrgSize.width);
@@ -421,6 +881,8 @@ bool stImage::RequestDenoise() const
 
 void stImage::Preprocess(const int input_plane, const int net_offset)
 {
+	TRACE_SCOPE_WAIFU2X("stImage::Preprocess");
+
 	mOrgFloatImage = ConvertToFloat(mOrgFloatImage);
 
 	ConvertToNetFormat(input_plane, net_offset);
@@ -474,7 +936,7 @@ void stImage::ConvertToNetFormat(const int input_plane, const int alpha_offset)
 
 				AlphaMakeBorder(planes, mTmpImageA, alpha_offset); // ȃsNZƕsȃsNZ̋E̐FL
 
-				// CreateBrightnessImage()BGRYɕϊ̂œRGBɕς͂Ȃ
+				// CreateBrightnessImage()BGR(RGB)Yɕϊ̂œRGBɕς͂Ȃ
 				cv::merge(planes, mTmpImageRGB);
 			}
 
@@ -514,7 +976,8 @@ void stImage::ConvertToNetFormat(const int input_plane, const int alpha_offset)
 			}
 
 			// BGRRGBɂ
-			std::swap(planes[0], planes[2]);
+			if (!mIsOrgRGB)
+				std::swap(planes[0], planes[2]);
 
 			cv::merge(planes, mTmpImageRGB);
 		}
@@ -529,7 +992,7 @@ Waifu2x::eWaifu2xError stImage::CreateBrightnessImage(const cv::Mat &float_image
 	if (float_image.channels() > 1)
 	{
 		cv::Mat converted_color;
-		cv::cvtColor(float_image, converted_color, BGRToYConvertMode);
+		cv::cvtColor(float_image, converted_color, mIsOrgRGB ? CV_RGB2YUV : BGRToYConvertMode);
 
 		std::vector<cv::Mat> planes;
 		cv::split(converted_color, planes);
@@ -621,6 +1084,8 @@ void stImage::SetReconstructedImage(cv::Mat &dst, cv::Mat &src, const cv::Size_<
 
 void stImage::Postprocess(const int input_plane, const Factor scale, const int depth)
 {
+	TRACE_SCOPE_WAIFU2X("stImage::Postprocess");
+
 	DeconvertFromNetFormat(input_plane);
 	ShrinkImage(scale);
 
@@ -635,6 +1100,8 @@ void stImage::Postprocess(const int input_plane, const Factor scale, const int d
 
 void stImage::Postprocess(const int input_plane, const int width, const int height, const int depth)
 {
+	TRACE_SCOPE_WAIFU2X("stImage::Postprocess");
+
 	DeconvertFromNetFormat(input_plane);
 	ShrinkImage(width, height);
 
@@ -670,7 +1137,7 @@ void stImage::DeconvertFromNetFormat(const int input_plane)
 			cv::merge(color_planes, converted_image);
 			color_planes.clear();
 
-			cv::cvtColor(converted_image, mEndImage, BGRToConvertInverseMode);
+			cv::cvtColor(converted_image, mEndImage, mIsOrgRGB ? CV_YUV2RGB : BGRToConvertInverseMode);
 			converted_image.release();
 
 			if (!mTmpImageA.empty()) // Âō
@@ -735,24 +1202,54 @@ void stImage::DeconvertFromNetFormat(const int input_plane)
 			}
 
 			// RGBBGRɂ
-			std::swap(planes[0], planes[2]);
+			if (!mIsOrgRGB)
+				std::swap(planes[0], planes[2]);
 
 			cv::merge(planes, mEndImage);
 		}
 	}
 }
 
+cv::Size_<int> stImage::GetScaledSize(const Factor scale) const
+{
+	const auto Width = scale.MultiNumerator(mOrgSize.width);
+	const auto Height = scale.MultiNumerator(mOrgSize.height);
+
+	//const cv::Size_<int> ns(mOrgSize.width * scale, mOrgSize.height * scale);
+	return cv::Size_<int>((int)Width.toDouble(), (int)Height.toDouble());
+}
+
+cv::Mat stImage::CreatePreview(const cv::Size_<int> &size) const
+{
+	TRACE_SCOPE_WAIFU2X("stImage::CreatePreview");
+
+	cv::Mat zoom;
+	cv::resize(mOrgFloatImage, zoom, size, 0.0, 0.0, cv::INTER_CUBIC);
+
+	if (mIsOrgRGB) // ro߂̉摜BGR(A)
+		cv::cvtColor(zoom, zoom, zoom.channels() == 4 ? CV_RGBA2BGRA : CV_RGB2BGR);
+
+	return ConvertTo8bit(zoom);
+}
+
+cv::Mat stImage::ConvertTo8bit(const cv::Mat &im)
+{
+	if (im.depth() == CV_8U)
+		return im;
+
+	cv::Mat ret;
+	im.convertTo(ret, CV_8U, GetValumeMaxFromCVDepth(CV_8U) / GetValumeMaxFromCVDepth(im.depth()));
+
+	return ret;
+}
+
 void stImage::ShrinkImage(const Factor scale)
 {
 	// TODO: scale = 1.0 łeyڂȂׂ
 
 	const int scaleBase = 2; // TODO: f̊g嗦ɂĉςł悤ɂ
 
-	const auto Width = scale.MultiNumerator(mOrgSize.width);
-	const auto Height = scale.MultiNumerator(mOrgSize.height);
-
-	//const cv::Size_<int> ns(mOrgSize.width * scale, mOrgSize.height * scale);
-	const cv::Size_<int> ns((int)Width.toDouble(), (int)Height.toDouble());
+	const cv::Size_<int> ns = GetScaledSize(scale);
 	if (mEndImage.size().width != ns.width || mEndImage.size().height != ns.height)
 	{
 		int argo = cv::INTER_CUBIC;
@@ -865,7 +1362,7 @@ Waifu2x::eWaifu2xError stImage::CreateZoomColorImage(const cv::Mat &float_image,
 	cv::resize(float_image, zoom_cubic_image, zoom_size, 0.0, 0.0, cv::INTER_CUBIC);
 
 	cv::Mat converted_cubic_image;
-	cv::cvtColor(zoom_cubic_image, converted_cubic_image, BGRToYConvertMode);
+	cv::cvtColor(zoom_cubic_image, converted_cubic_image, mIsOrgRGB ? CV_RGB2YUV : BGRToYConvertMode);
 	zoom_cubic_image.release();
 
 	cv::split(converted_cubic_image, cubic_planes);
@@ -882,8 +1379,65 @@ cv::Mat stImage::GetEndImage() const
 	return mEndImage;
 }
 
+size_t stImage::GetMemorySize() const
+{
+	const cv::Mat *list[] = {&mOrgFloatImage, &mTmpImageRGB, &mTmpImageA, &mTmpImageAOneColor, &mEndImage};
+
+	// obt@LĂMat̂ŏdĐȂ悤ɂ
+	std::vector<const cv::UMatData *> counted;
+	size_t size = 0;
+
+	for (const auto m : list)
+	{
+		if (!m->u) // Onꂽobt@
+			continue;
+
+		if (std::find(counted.begin(), counted.end(), m->u) != counted.end())
+			continue;
+
+		counted.push_back(m->u);
+		size += m->u->size;
+	}
+
+	return size;
+}
+
+size_t stImage::EstimateMemorySize(const int input_plane, const int net_offset, const int outer_padding,
+	const int crop_w, const int crop_h, const int scale_num, const bool use_tta, const int depth) const
+{
+	const size_t width = mOrgSize.width;
+	const size_t height = mOrgSize.height;
+	const size_t channel = mOrgChannel;
+
+	const size_t scale = (size_t)1 << std::max(scale_num, 0);
+	const size_t scale_width = width * scale;
+	const size_t scale_height = height * scale;
+
+	// 摜float(Yfł͐F̕ɍŌ܂Ŏg)
+	const size_t org = width * height * channel * sizeof(float);
+
+	// Ō̊g(܂̓mCY)̍Ɨp摜BubNTCY̔{ƃpfBO̕傫Ȃ
+	// lbg̓͂Əo͂1ATTȀꍇ͂ɕϊ̉摜ƍvp̉摜(ReconstructByNet()Q)
+	const size_t padding = (net_offset + outer_padding) * 2;
+	const size_t work_width = (scale_width + crop_w - 1) / crop_w * crop_w + padding;
+	const size_t work_height = (scale_height + crop_h - 1) / crop_h * crop_h + padding;
+	const size_t work = work_width * work_height * input_plane * sizeof(float) * (use_tta ? 4 : 2);
+
+	// `l͕ʂɊg傷̂ŁARGB̏͊gς݂̂̂Ă
+	const size_t alpha = channel == 4 ? scale_width * scale_height * sizeof(float) : 0;
+
+	const size_t reconstruct = org + work + alpha;
+
+	// ㏈ł͊g債float̉摜Əo͂[x̉摜ɂ
+	const size_t postprocess = org + scale_width * scale_height * channel * (sizeof(float) + std::max(depth, 8) / 8);
+
+	return std::max(reconstruct, postprocess);
+}
+
 Waifu2x::eWaifu2xError stImage::Save(const boost::filesystem::path &output_file, const boost::optional<int> &output_quality)
 {
+	TRACE_SCOPE_WAIFU2X("stImage::Save");
+
 	return WriteMat(mEndImage, output_file, output_quality);
 }
 
@@ -892,6 +1446,12 @@ Waifu2x::eWaifu2xError stImage::WriteMat(const cv::Mat &im, const boost::filesys
 	const boost::filesystem::path ip(output_file);
 	const std::string ext = ip.extension().string();
 
+	if (boost::iequals(ext, ".pfm"))
+		return WriteMatAsPFM(im, output_file);
+
+	if (boost::iequals(ext, ".npy"))
+		return WriteMatAsNPY(im, output_file);
+
 	if (boost::iequals(ext, ".tga"))
 	{
 		unsigned char *data = im.data;
@@ -928,20 +1488,6 @@ Waifu2x::eWaifu2xError stImage::WriteMat(const cv::Mat &im, const boost::filesys
 			}
 		}
 
-		boost::iostreams::stream<boost::iostreams::file_descriptor> os;
-
-		try
-		{
-			os.open(output_file, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
-		}
-		catch (...)
-		{
-			return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
-		}
-
-		if (!os)
-			return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
-
 		// RLEk̐ݒ
 		bool isSet = false;
 		const auto &OutputExtentionList = stImage::OutputExtentionList;
@@ -963,7 +1509,12 @@ Waifu2x::eWaifu2xError stImage::WriteMat(const cv::Mat &im, const boost::filesys
 		if (!isSet)
 			stbi_write_tga_with_rle = 1;
 
-		if (!stbi_write_tga_to_func(Waifu2x_stbi_write_func, &os, im.size().width, im.size().height, im.channels(), data))
+		// ̌`Ɠ悤ɁAɏoĂcWriterPoolŏ
+		std::vector<unsigned char> buf;
+		if (!stbi_write_tga_to_func(Waifu2x_stbi_write_func, &buf, im.size().width, im.size().height, im.channels(), data))
+			return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+
+		if (!cWriterPool::Write(output_file, buf))
 			return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
 
 		return Waifu2x::eWaifu2xError_OK;
@@ -991,10 +1542,12 @@ Waifu2x::eWaifu2xError stImage::WriteMat(const cv::Mat &im, const boost::filesys
 			}
 		}
 
+		AppendEncodeParams(ext, params);
+
 		std::vector<uchar> buf;
 		cv::imencode(ext, im, buf, params);
 
-		if (writeFile(output_file, buf))
+		if (cWriterPool::Write(output_file, buf))
 			return Waifu2x::eWaifu2xError_OK;
 
 	}
@@ -1004,3 +1557,106 @@ Waifu2x::eWaifu2xError stImage::WriteMat(const cv::Mat &im, const boost::filesys
 
 	return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
 }
+
+Waifu2x::eWaifu2xError stImage::WriteMatAsPFM(const cv::Mat &im, const boost::filesystem::path &output_file)
+{
+	// _̂܂܏(8bit, 16bit̉摜0`1ɂ)
+	const cv::Mat float_image = ConvertToFloat(im);
+
+	// PFM̓`lĂȂ̂RGB
+	cv::Mat rgb;
+	if (float_image.channels() == 4)
+		cv::cvtColor(float_image, rgb, cv::COLOR_BGRA2RGB);
+	else if (float_image.channels() == 3)
+		cv::cvtColor(float_image, rgb, cv::COLOR_BGR2RGB);
+	else if (float_image.channels() == 1)
+		rgb = float_image;
+	else
+		return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+
+	// XP[Ȃ烊gGfBA
+	const std::string header = std::string(rgb.channels() == 3 ? "PF" : "Pf") + "\n" + std::to_string(rgb.size().width) + " " + std::to_string(rgb.size().height) + "\n" + "-1.0\n";
+
+	const size_t LineSize = rgb.size().width * rgb.elemSize();
+
+	std::vector<unsigned char> buf;
+	buf.reserve(header.size() + LineSize * rgb.size().height);
+	buf.insert(buf.end(), header.begin(), header.end());
+
+	// s͉珇ɕׂ
+	for (int i = rgb.size().height - 1; i >= 0; i--)
+		buf.insert(buf.end(), rgb.ptr(i), rgb.ptr(i) + LineSize);
+
+	if (!cWriterPool::Write(output_file, buf))
+		return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+Waifu2x::eWaifu2xError stImage::WriteMatAsNPY(const cv::Mat &im, const boost::filesystem::path &output_file)
+{
+	// _̂܂܏(8bit, 16bit̉摜0`1ɂ)
+	const cv::Mat float_image = ConvertToFloat(im);
+
+	const int Channel = float_image.channels();
+	const int Width = float_image.size().width;
+	const int Height = float_image.size().height;
+
+	// BGRRGBɕёւ
+	cv::Mat rgb;
+	if (Channel == 3)
+		cv::cvtColor(float_image, rgb, cv::COLOR_BGR2RGB);
+	else if (Channel == 4)
+		cv::cvtColor(float_image, rgb, cv::COLOR_BGRA2RGBA);
+	else if (Channel == 1)
+		rgb = float_image;
+	else
+		return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+
+	const bool isPlanar = g_IsNpyPlanar && Channel > 1;
+
+	std::string shape;
+	if (Channel == 1)
+		shape = "(" + std::to_string(Height) + ", " + std::to_string(Width) + ")";
+	else if (isPlanar)
+		shape = "(" + std::to_string(Channel) + ", " + std::to_string(Height) + ", " + std::to_string(Width) + ")";
+	else
+		shape = "(" + std::to_string(Height) + ", " + std::to_string(Width) + ", " + std::to_string(Channel) + ")";
+
+	// wb_̓o[W1.0B擪10oCgƍ킹64oCg̔{ɂȂ悤ɋ󔒂Ŗ߂ĉsŏI点
+	std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': " + shape + ", }";
+	const size_t HeaderSize = (10 + header.size() + 1 + 63) / 64 * 64 - 10;
+	header.append(HeaderSize - header.size() - 1, ' ');
+	header += '\n';
+
+	const char prefix[10] = { '\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0, (char)(HeaderSize & 0xff), (char)((HeaderSize >> 8) & 0xff) };
+
+	std::vector<unsigned char> buf;
+	buf.reserve(sizeof(prefix) + header.size() + (size_t)Width * Height * Channel * sizeof(float));
+	buf.insert(buf.end(), prefix, prefix + sizeof(prefix));
+	buf.insert(buf.end(), header.begin(), header.end());
+
+	if (!isPlanar)
+	{
+		const size_t LineSize = Width * rgb.elemSize();
+		for (int i = 0; i < Height; i++)
+			buf.insert(buf.end(), rgb.ptr(i), rgb.ptr(i) + LineSize);
+	}
+	else
+	{
+		// `lƂ̖ʂɕׂ
+		cv::Mat plane;
+		const size_t LineSize = Width * sizeof(float);
+		for (int c = 0; c < Channel; c++)
+		{
+			cv::extractChannel(rgb, plane, c);
+			for (int i = 0; i < Height; i++)
+				buf.insert(buf.end(), plane.ptr(i), plane.ptr(i) + LineSize);
+		}
+	}
+
+	if (!cWriterPool::Write(output_file, buf))
+		return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+
+	return Waifu2x::eWaifu2xError_OK;
+}
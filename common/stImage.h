@@ -11,6 +11,7 @@ private:
 	cv::Size_<int> mOrgSize;
 
 	bool mIsRequestDenoise;
+	bool mIsOrgRGB; // mOrgFloatImageBGR(A)ł͂ȂRGB(A)̏ɕł(obt@ǂݍ񂾏ꍇBo͂ɂȂ)
 
 	cv::Mat mTmpImageRGB; // RGB(邢Y)
 	cv::Mat mTmpImageA; // `l
@@ -36,8 +37,44 @@ public:
 
 	const static std::vector<stOutputExtentionElement> OutputExtentionList;
 
+	enum eJpegSampling
+	{
+		eJpegSamplingDefault, // OpenCṼftHg(4:2:0)
+		eJpegSampling420,
+		eJpegSampling422,
+		eJpegSampling444,
+	};
+
+	// PNG, JPEG̃GR[h̐ݒ
+	struct stEncodeOption
+	{
+		int png_compression; // zlib̈kx(0`9B-1ȂOpenCṼftHg)
+		int png_strategy; // zlib̈k@(cv::IMWRITE_PNG_STRATEGY_*B-1ȂOpenCṼftHg)
+		bool jpeg_optimize; // nt}摜ƂɍœK(掿͕ςȂ)
+		bool jpeg_progressive; // vObVuJPEGɂ(掿͕ςȂ)
+		eJpegSampling jpeg_sampling; // F̊Ԉ(OpenCV 4.5.5ȍ~̂)
+	};
+
+	enum eEncodePreset
+	{
+		eEncodePresetDefault, // OpenCṼftHg
+		eEncodePresetFast, // GR[hԑ(ԃt@C)
+		eEncodePresetBalanced,
+		eEncodePresetSmall, // t@Cԏ(ۑp)
+	};
+
+	// ̉摜TCY󂯎āAfR[hƂ̏k(1, 2, 4, 8)Ԃ֐
+	typedef std::function<int(const cv::Size_<int> &org_size)> ReduceFunc;
+
 private:
 	static Waifu2x::eWaifu2xError LoadMatBySTBI(cv::Mat &im, const std::vector<char> &img_data);
+	static Waifu2x::eWaifu2xError LoadMatByPFM(cv::Mat &im, const std::vector<char> &img_data);
+	static Waifu2x::eWaifu2xError LoadMatByNPY(cv::Mat &im, const std::vector<char> &img_data);
+
+	// JPEG̃wb_(SOF)摜TCYƃ`l擾
+	static bool GetJpegInfo(const std::vector<char> &img_data, cv::Size_<int> &size, int &channel);
+	// reduce_funcԂkJPEGfR[h(kȂꍇ͋)
+	static cv::Mat DecodeReducedJpeg(const std::vector<char> &img_data, const ReduceFunc &reduce_func);
 
 	static cv::Mat ConvertToFloat(const cv::Mat &im);
 
@@ -47,6 +84,8 @@ private:
 	static void AlphaCleanImage(cv::Mat &im);
 
 	static Waifu2x::eWaifu2xError WriteMat(const cv::Mat &im, const boost::filesystem::path &output_file, const boost::optional<int> &output_quality);
+	static Waifu2x::eWaifu2xError WriteMatAsPFM(const cv::Mat &im, const boost::filesystem::path &output_file);
+	static Waifu2x::eWaifu2xError WriteMatAsNPY(const cv::Mat &im, const boost::filesystem::path &output_file);
 
 	// im(1ch)PFō\Ă邩
 	static bool IsOneColor(const cv::Mat &im);
@@ -81,9 +120,27 @@ public:
 
 	void Clear();
 
-	static Waifu2x::eWaifu2xError LoadMat(cv::Mat &im, const boost::filesystem::path &input_file);
+	// reduce_func: w肳Ă΁AJPEGDCT̒iKŏk̕kăfR[h(̌`͏kȂ)
+	static Waifu2x::eWaifu2xError LoadMat(cv::Mat &im, const boost::filesystem::path &input_file, const ReduceFunc &reduce_func = nullptr);
+
+	// PFM, NPY(_̐f[^)̌`̃t@C
+	static bool IsRawFloatFile(const boost::filesystem::path &path);
 
-	Waifu2x::eWaifu2xError Load(const boost::filesystem::path &input_file);
+	// NPYŕۑƂA`lƂ̖ʂׂ(C, H, W)̌`ɂ(falseȂ(H, W, C)BftHgfalse)
+	static void SetNpyPlanar(const bool planar);
+
+	static stEncodeOption GetEncodePreset(const eEncodePreset preset);
+
+	// stEncodeOption::jpeg_samplingg邩(OpenCV 4.5.5ȍ~Ńrhꍇ̂)BgȂjpeg_sampling͖
+	static bool IsJpegSamplingSupported();
+
+	// o͉摜(DZĨ^CAAPNG̃t[܂)̃GR[h̐ݒ(ftHgeEncodePresetDefault)
+	static void SetEncodeOption(const stEncodeOption &option);
+
+	// ext(".png"Ȃ)̌`ŃGR[hƂ̐ݒparamsɒǉ
+	static void AppendEncodeParams(const std::string &ext, std::vector<int> &params);
+
+	Waifu2x::eWaifu2xError Load(const boost::filesystem::path &input_file, const ReduceFunc &reduce_func = nullptr);
 
 	// source: (4`l̏ꍇ)RGBAȉfz
 	// dest: (4`l̏ꍇ)RGBAȉfz
@@ -91,12 +148,28 @@ public:
 	// height: height̉
 	// channel: sourcẽ`l
 	// stride: sourcẽXgCh(oCgP)
+	// depth: source1`l̃rbg(8, 16, 32(_A0`1)̂ǂꂩ)
 	// sourcePostprocess()I܂ő݂ĂKv
-	Waifu2x::eWaifu2xError Load(const void* source, const int width, const int height, const int channel, const int stride);
+	// BGRɕёւRGB(A)̏̂܂܏̂ŁAGetEndImage()RGB(A)̏ɂȂ
+	Waifu2x::eWaifu2xError Load(const void* source, const int width, const int height, const int channel, const int stride, const int depth = 8);
+
+	// BGR(A)O[XP[̉摜ǂݍ(8bit, 16bit, 32bit_)
+	Waifu2x::eWaifu2xError Load(const cv::Mat &im);
+
+	const cv::Size_<int>& GetOrgSize() const;
 
 	Factor GetScaleFromWidth(const int width) const;
 	Factor GetScaleFromHeight(const int width) const;
 
+	// scale{Ƃ̉摜TCY(Postprocess()̏o̓TCYƓ)
+	cv::Size_<int> GetScaledSize(const Factor scale) const;
+
+	// Load()摜oCL[rbNsizeɊg債8bit̉摜(BGR(A)O[XP[)BPreprocess()̑OɌĂԂ
+	cv::Mat CreatePreview(const cv::Size_<int> &size) const;
+
+	// 8bitɕϊ摜(\p)
+	static cv::Mat ConvertTo8bit(const cv::Mat &im);
+
 	bool RequestDenoise() const;
 
 	// O
@@ -130,5 +203,13 @@ public:
 
 	cv::Mat GetEndImage() const;
 
+	// ێĂ摜obt@̍vTCY(Onꂽobt@͊܂܂Ȃ)
+	size_t GetMemorySize() const;
+
+	// Load()摜Ƃ̉摜obt@̃s[N̐l(Onꂽobt@͊܂܂Ȃ)
+	// scale_num: 2{̊gs(mCYȂ0)
+	size_t EstimateMemorySize(const int input_plane, const int net_offset, const int outer_padding,
+		const int crop_w, const int crop_h, const int scale_num, const bool use_tta, const int depth) const;
+
 	Waifu2x::eWaifu2xError Save(const boost::filesystem::path &output_file, const boost::optional<int> &output_quality);
 };
@@ -1,9 +1,18 @@
 #include "waifu2x.h"
 #include "stImage.h"
 #include "cNet.h"
+#include "cTrace.h"
+#include "cMetrics.h"
+#include "cTuningCache.h"
+#include "cTileScheduler.h"
+#include "cMemoryBudget.h"
+#include "cTiffStream.h"
+#include "cDziWriter.h"
+#include "cAnimation.h"
 #include <caffe/caffe.hpp>
 #include <cudnn.h>
 #include <mutex>
+#include <algorithm>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <tclap/CmdLine.h>
@@ -11,6 +20,7 @@
 #include <boost/algorithm/string.hpp>
 #include <chrono>
 #include <unordered_map>
+#include <memory>
 #include <cuda_runtime.h>
 
 #include <boost/iostreams/stream.hpp>
@@ -19,8 +29,16 @@
 
 #include <fcntl.h>
 #include <zlib.h>
+#include <cblas.h>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cfloat>
 #ifdef _MSC_VER
 #include <io.h>
+#include <intrin.h>
+#else
+#include <cpuid.h>
 #endif
 
 //#if defined(WIN32) || defined(WIN64)
@@ -178,239 +196,249 @@ namespace
 	};
 }
 
-class CcuDNNAlgorithmElement
+// cuDNÑASY̎I
+// GPUƁAconv/deconvƂ1t@CŁAg̓C[̐ݒ育Ƃ̌
+// ASY̔ԍ̈ӖcuDNÑo[Wŕς̂ŁAcuDNÑo[WႤt@C͓ǂ܂Ȃ
+class CcuDNNAlgorithm
 {
 private:
-	typedef std::unordered_map<uint64_t, uint8_t> AlgoMap;
-
-	AlgoMap mAlgo;
-	bool mIsModefy;
-
-	uint8_t kernel_w;
-	uint8_t kernel_h;
-	uint8_t pad_w;
-	uint8_t pad_h;
-	uint8_t stride_w;
-	uint8_t stride_h;
-	uint16_t batch_size;
+	cTuningCache mCache;
 
 private:
-	static uint64_t InfoToKey(uint16_t num_input, uint16_t num_output, uint16_t width, uint16_t height)
+	static std::string InfoToKey(uint16_t num_input, uint16_t num_output, uint16_t batch_size,
+		uint16_t width, uint16_t height, uint16_t kernel_w, uint16_t kernel_h, uint16_t pad_w, uint16_t pad_h, uint16_t stride_w, uint16_t stride_h)
 	{
-		return (uint64_t)num_input << 8 * 3 | (uint64_t)num_output << 8 * 2 | (uint64_t)width << 8 * 1 | (uint64_t)height << 8 * 0;
+		char buf[160];
+		sprintf(buf, "k%ux%u p%ux%u s%ux%u b%u i%u o%u w%u h%u",
+			(unsigned int)kernel_w, (unsigned int)kernel_h, (unsigned int)pad_w, (unsigned int)pad_h, (unsigned int)stride_w, (unsigned int)stride_h,
+			(unsigned int)batch_size, (unsigned int)num_input, (unsigned int)num_output, (unsigned int)width, (unsigned int)height);
+
+		return buf;
 	}
 
 public:
-	CcuDNNAlgorithmElement() : mIsModefy(false)
+	CcuDNNAlgorithm() : mCache(CUDNN_VERSION)
 	{}
-	~CcuDNNAlgorithmElement()
-	{}
-
-	void SetLayerData(uint8_t kernel_w, uint8_t kernel_h, uint8_t pad_w, uint8_t pad_h, uint8_t stride_w, uint8_t stride_h, uint16_t batch_size)
-	{
-		this->kernel_w = kernel_w;
-		this->kernel_h = kernel_h;
-		this->pad_w = pad_w;
-		this->pad_h = pad_h;
-		this->stride_w = stride_w;
-		this->stride_h = stride_h;
-		this->batch_size = batch_size;
-	}
 
-	void GetLayerData(uint8_t &kernel_w, uint8_t &kernel_h, uint8_t &pad_w, uint8_t &pad_h, uint8_t &stride_w, uint8_t &stride_h, uint16_t &batch_size)
+	int GetAlgorithm(uint16_t num_input, uint16_t num_output, uint16_t batch_size,
+		uint16_t width, uint16_t height, uint16_t kernel_w, uint16_t kernel_h, uint16_t pad_w, uint16_t pad_h, uint16_t stride_w, uint16_t stride_h)
 	{
-		kernel_w = this->kernel_w;
-		kernel_h = this->kernel_h;
-		pad_w = this->pad_w;
-		pad_h = this->pad_h;
-		stride_w = this->stride_w;
-		stride_h = this->stride_h;
-		batch_size = this->batch_size;
-	}
+		int algo = -1;
+		if (!mCache.Get(InfoToKey(num_input, num_output, batch_size, width, height, kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h), algo))
+			algo = -1;
 
-	int GetAlgorithm(uint16_t num_input, uint16_t num_output, uint16_t width, uint16_t height) const
-	{
-		const uint64_t key = InfoToKey(num_input, num_output, width, height);
-		const auto it = mAlgo.find(key);
-		if (it != mAlgo.end())
-			return it->second;
+		cMetrics::Increment("waifu2x_cache_requests_total", 1, algo >= 0 ? "cache=\"cudnn_algorithm\",result=\"hit\"" : "cache=\"cudnn_algorithm\",result=\"miss\"");
 
-		return -1;
+		return algo;
 	}
 
-	void SetAlgorithm(uint8_t algo, uint16_t num_input, uint16_t num_output, uint16_t width, uint16_t height)
+	void SetAlgorithm(int algo, uint16_t num_input, uint16_t num_output, uint16_t batch_size,
+		uint16_t width, uint16_t height, uint16_t kernel_w, uint16_t kernel_h, uint16_t pad_w, uint16_t pad_h, uint16_t stride_w, uint16_t stride_h)
 	{
-		const uint64_t key = InfoToKey(num_input, num_output, width, height);
-		auto it = mAlgo.find(key);
-		if (it == mAlgo.end() || it->second != algo)
-			mIsModefy = true;
+		if (algo < 0 || algo > 255)
+			return;
 
-		mAlgo[key] = algo;
+		mCache.Set(InfoToKey(num_input, num_output, batch_size, width, height, kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h), algo);
 	}
 
-	bool IsModefy() const
+	void Save()
 	{
-		return mIsModefy;
+		mCache.Save();
 	}
 
-	void Saved()
+	void SetDataPath(const boost::filesystem::path &path)
 	{
-		mIsModefy = false;
+		mCache.SetDataPath(path);
 	}
-
-	MSGPACK_DEFINE(mAlgo, kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
 };
 
-class CcuDNNAlgorithm
+CcuDNNAlgorithm g_ConvCcuDNNAlgorithm;
+CcuDNNAlgorithm g_DeconvCcuDNNAlgorithm;
+
+
+class CCPUTuneElement
 {
-private:
-	typedef std::unordered_map<uint64_t, CcuDNNAlgorithmElement> AlgoEmlMap;
+public:
+	int crop_size;
+	int batch_size;
+	int threads;
 
-	AlgoEmlMap mAlgoEmlMap;
-	std::string mDataPath;
+	CCPUTuneElement() : crop_size(0), batch_size(0), threads(0)
+	{}
 
-private:
-	static uint64_t InfoToKey(uint8_t kernel_w, uint8_t kernel_h, uint8_t pad_w, uint8_t pad_h, uint8_t stride_w, uint8_t stride_h, uint16_t batch_size)
-	{
-		return
-			(uint64_t)kernel_w << 8 * 7 | (uint64_t)kernel_h << 8 * 6 |
-			(uint64_t)pad_w << 8 * 5 | (uint64_t)pad_h << 8 * 4 |
-			(uint64_t)stride_w << 8 * 3 | (uint64_t)stride_h << 8 * 2 |
-			(uint64_t)batch_size;
-	}
+	MSGPACK_DEFINE(crop_size, batch_size, threads);
+};
 
-	std::string GetDataPath(uint8_t kernel_w, uint8_t kernel_h, uint8_t pad_w, uint8_t pad_h, uint8_t stride_w, uint8_t stride_h, uint16_t batch_size) const
-	{
-		std::string SavePath = mDataPath;
-		SavePath +=
-			std::to_string(kernel_w) + "x" + std::to_string(kernel_h) + " " +
-			std::to_string(pad_w) + "x" + std::to_string(pad_w) + " " +
-			std::to_string(stride_w) + "x" + std::to_string(stride_w) + " " +
-			std::to_string(batch_size);
-		SavePath += ".dat";
-
-		return SavePath;
-	}
+// CPUŏƂ̕TCYAob`TCYAXbh̎
+// CPU̎ނƃRAƂ1t@CŁAg̓fƃ[hƂ̌
+const uint32_t CPUTuneDataVersion = 1;
+cTuningCache g_CPUTuneData(CPUTuneDataVersion);
 
-	bool Load(uint8_t kernel_w, uint8_t kernel_h, uint8_t pad_w, uint8_t pad_h, uint8_t stride_w, uint8_t stride_h, uint16_t batch_size)
-	{
-		const std::string SavePath = GetDataPath(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
+static std::atomic<bool> g_IsCPUAutoTuneEnabled(false);
 
-		std::vector<char> sbuf;
+// SetThreadBudget()Őݒ肵vZXŜ̃Xbh(0Ȃ琧Ȃ)ƁA𕪂[J[̐
+static std::atomic<int> g_ThreadBudget(0);
+static std::atomic<int> g_ThreadBudgetWorkerNum(1);
 
-		FILE *fp = fopen(SavePath.c_str(), "rb");
-		if (!fp)
-			return false;
+// SetTileSkipThreshold()Őݒ肵AlbgɒʂȂubNׂ̍̂l(0ȂSălbgɒʂ)
+static std::atomic<double> g_TileSkipThreshold(0.0);
 
-		fseek(fp, 0, SEEK_END);
-		const auto size = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
+// SetTiffStreamRows()Őݒ肵ATIFFяɕďƂ1̑т̍s(0Ȃ番Ȃ)
+static std::atomic<int> g_TiffStreamRows(0);
 
-		sbuf.resize(size);
+// SetReducedDecode()Őݒ肵AJPEGkăfR[h邩
+static std::atomic<bool> g_IsReducedDecodeEnabled(true);
 
-		if (fread(sbuf.data(), 1, sbuf.size(), fp) != sbuf.size())
-		{
-			fclose(fp);
-			return false;
-		}
+static bool IsTiffFile(const boost::filesystem::path &path)
+{
+	const std::string ext = path.extension().string();
 
-		fclose(fp);
+	return boost::iequals(ext, ".tif") || boost::iequals(ext, ".tiff");
+}
 
-		try
-		{
-			CcuDNNAlgorithmElement elm;
-			msgpack::unpack(sbuf.data(), sbuf.size()).get().convert(elm);
-			sbuf.clear();
+static bool IsDziFile(const boost::filesystem::path &path)
+{
+	return boost::iequals(path.extension().string(), ".dzi");
+}
 
-			const uint64_t key = InfoToKey(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
-			mAlgoEmlMap[key] = std::move(elm);
-		}
-		catch (...)
-		{
-			boost::filesystem::remove(SavePath);
-		}
+static bool IsPngFile(const boost::filesystem::path &path)
+{
+	return boost::iequals(path.extension().string(), ".png");
+}
 
-		return true;
-	}
+static bool IsGifFile(const boost::filesystem::path &path)
+{
+	return boost::iequals(path.extension().string(), ".gif");
+}
 
-public:
-	CcuDNNAlgorithm()
-	{}
+// [J[1񏈗(BLAS, OpenCV)ɎgXbh
+static int CalcWorkerThreadNum()
+{
+	const int cores = std::max(1, (int)std::thread::hardware_concurrency());
 
-	~CcuDNNAlgorithm()
-	{
-		Save();
-	}
+	const int budget = g_ThreadBudget;
+	if (budget <= 0)
+		return cores;
 
-	int GetAlgorithm(uint16_t num_input, uint16_t num_output, uint16_t batch_size,
-		uint16_t width, uint16_t height, uint16_t kernel_w, uint16_t kernel_h, uint16_t pad_w, uint16_t pad_h, uint16_t stride_w, uint16_t stride_h)
+	// S[J[̍vXbh̏ƃRÂǂȂ悤ɂ
+	return std::max(1, std::min(budget, cores) / std::max(1, (int)g_ThreadBudgetWorkerNum));
+}
+
+
+namespace
+{
+	// exẽfBNg(擾łȂ΃JgfBNg)dir_namẽfBNg쐬ĕԂ
+	// 쐬łȂꍇ͋̃pXԂ
+	boost::filesystem::path GetDataDirPath(const char *dir_name)
 	{
-		const uint64_t key = InfoToKey(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
-		const auto it = mAlgoEmlMap.find(key);
-		if (it != mAlgoEmlMap.end())
+		boost::filesystem::path data_base_dir_path(Waifu2x::ExeDir);
+		if (data_base_dir_path.is_relative())
+			data_base_dir_path = boost::filesystem::system_complete(data_base_dir_path);
+
+		if (!boost::filesystem::is_directory(data_base_dir_path))
+			data_base_dir_path = data_base_dir_path.branch_path();
+
+		if (!boost::filesystem::exists(data_base_dir_path))
 		{
-			const auto &elm = it->second;
-			return elm.GetAlgorithm(num_input, num_output, width, height);
+			// exẽfBNg擾łȂ΃JgfBNgɕۑ
+
+			data_base_dir_path = boost::filesystem::current_path();
+
+			if (data_base_dir_path.is_relative())
+				data_base_dir_path = boost::filesystem::system_complete(data_base_dir_path);
+
+			if (!boost::filesystem::exists(data_base_dir_path))
+				data_base_dir_path = "./";
 		}
 
-		if (Load(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size))
-			return mAlgoEmlMap[key].GetAlgorithm(num_input, num_output, width, height);
+		if (!boost::filesystem::exists(data_base_dir_path))
+			return boost::filesystem::path();
 
-		return -1;
-	}
+		const boost::filesystem::path data_dir_path(data_base_dir_path / dir_name);
 
-	void SetAlgorithm(int algo, uint16_t num_input, uint16_t num_output, uint16_t batch_size,
-		uint16_t width, uint16_t height, uint16_t kernel_w, uint16_t kernel_h, uint16_t pad_w, uint16_t pad_h, uint16_t stride_w, uint16_t stride_h)
-	{
-		if (algo < 0 || algo > 255)
-			return;
+		if (boost::filesystem::exists(data_dir_path))
+			return data_dir_path;
+
+		boost::system::error_code error;
+		const bool result = boost::filesystem::create_directory(data_dir_path, error);
+		if (result && !error)
+			return data_dir_path;
 
-		const uint64_t key = InfoToKey(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
-		auto &eml = mAlgoEmlMap[key];
-		eml.SetAlgorithm(algo, num_input, num_output, width, height);
-		eml.SetLayerData(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
+		return boost::filesystem::path();
 	}
 
-	void Save()
+	// CPŨuh(t@CɎgȂ͒u)
+	std::string GetCPUName()
 	{
-		for (auto &p : mAlgoEmlMap)
+		unsigned int regs[12] = {0};
+
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0x80000000);
+		const bool hasBrand = (unsigned int)info[0] >= 0x80000004;
+		if (hasBrand)
 		{
-			auto &eml = p.second;
-			if (eml.IsModefy())
+			for (int i = 0; i < 3; i++)
 			{
-				try
-				{
-					msgpack::sbuffer sbuf;
-					msgpack::pack(sbuf, eml);
+				__cpuid(info, 0x80000002 + i);
+				memcpy(regs + i * 4, info, sizeof(info));
+			}
+		}
+#else
+		const bool hasBrand = __get_cpuid_max(0x80000000, nullptr) >= 0x80000004;
+		if (hasBrand)
+		{
+			for (int i = 0; i < 3; i++)
+				__get_cpuid(0x80000002 + i, &regs[i * 4 + 0], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]);
+		}
+#endif
 
-					uint8_t kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h;
-					uint16_t batch_size;
-					eml.GetLayerData(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
+		std::string name;
+		if (hasBrand)
+			name.assign((const char *)regs, strnlen((const char *)regs, sizeof(regs)));
 
-					const std::string SavePath = GetDataPath(kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h, batch_size);
-					FILE *fp = fopen(SavePath.c_str(), "wb");
-					if (fp)
-					{
-						fwrite(sbuf.data(), 1, sbuf.size(), fp);
-						fclose(fp);
+		boost::algorithm::trim(name);
+		if (name.empty())
+			name = "unknown";
 
-						eml.Saved();
-					}
-				}
-				catch(...)
-				{}
-			}
+		for (auto &c : name)
+		{
+			if (!(isalnum((unsigned char)c) || c == ' ' || c == '-' || c == '_' || c == '.' || c == '(' || c == ')'))
+				c = '_';
 		}
+
+		return name;
 	}
 
-	void SetDataPath(std::string path)
+	// crop_size_list.txt̕TCYꗗ(ΕWIȃTCY)
+	std::vector<int> GetCropSizeList()
 	{
-		mDataPath = path;
-	}
-};
+		std::vector<int> list;
 
-CcuDNNAlgorithm g_ConvCcuDNNAlgorithm;
-CcuDNNAlgorithm g_DeconvCcuDNNAlgorithm;
+		boost::filesystem::path list_path(Waifu2x::ExeDir);
+		if (!boost::filesystem::is_directory(list_path))
+			list_path = list_path.branch_path();
+		list_path /= "crop_size_list.txt";
+
+		std::ifstream ifs(list_path.string());
+		if (ifs)
+		{
+			std::string str;
+			while (getline(ifs, str))
+			{
+				char *ptr = nullptr;
+				const long n = strtol(str.c_str(), &ptr, 10);
+				if (ptr && *ptr == '\0' && n > 0)
+					list.push_back(n);
+			}
+		}
+
+		if (list.empty())
+			list = {64, 128, 256};
+
+		return list;
+	}
+}
 
 
 // CUDAg邩`FbN
@@ -519,6 +547,7 @@ void Waifu2x::quit_liblary()
 {
 	g_ConvCcuDNNAlgorithm.Save();
 	g_DeconvCcuDNNAlgorithm.Save();
+	g_CPUTuneData.Save();
 
 	//caffe::GlobalFinalize();
 }
@@ -528,8 +557,10 @@ void Waifu2x::quit_thread_liblary()
 	//caffe::ThreadFinalize();
 }
 
-Waifu2x::Waifu2x() : mIsInited(false), mNoiseLevel(0), mIsCuda(false), mOutputBlock(nullptr), mOutputBlockSize(0), mGPUNo(0)
-{}
+Waifu2x::Waifu2x() : mIsInited(false), mNoiseLevel(0), mIsCuda(false), mOutputBlock(nullptr), mOutputBlockSize(0), mGPUNo(0), mLoadTime(), mCPUTuneCropSize(0), mCPUTuneBatchSize(0), mCPUTuneThreads(0), mTileScheduler(nullptr), mTileWorkerNo(-1), mImageMemoryBase(0), mIsProgressPass(false)
+{
+	ResetMemoryUsage();
+}
 
 Waifu2x::~Waifu2x()
 {
@@ -539,11 +570,26 @@ Waifu2x::~Waifu2x()
 Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noise_level,
 	const boost::filesystem::path &model_dir, const std::string &process, const int GPUNo)
 {
+	TRACE_SCOPE_WAIFU2X("Waifu2x::Init");
+
 	Waifu2x::eWaifu2xError ret;
 
 	if (mIsInited)
 		return Waifu2x::eWaifu2xError_OK;
 
+	mLoadTime = stLoadTime();
+	const auto InitStartTime = cTrace::Now();
+
+	// lbgƂ̓ǂݍݎԂv
+	const auto AddLoadTime = [this](const stLoadTime &t)
+	{
+		mLoadTime.path = std::max(mLoadTime.path, t.path);
+		mLoadTime.parse += t.parse;
+		mLoadTime.construct += t.construct;
+		mLoadTime.weight_copy += t.weight_copy;
+		mLoadTime.write += t.write;
+	};
+
 	try
 	{
 		std::string Process = process;
@@ -568,62 +614,36 @@ Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noi
 		if (Process == "cudnn")
 		{
 			// exẽfBNgcuDNÑASYf[^ۑ
-			boost::filesystem::path cudnn_data_base_dir_path(ExeDir);
-			if (cudnn_data_base_dir_path.is_relative())
-				cudnn_data_base_dir_path = boost::filesystem::system_complete(cudnn_data_base_dir_path);
-
-			if (!boost::filesystem::is_directory(cudnn_data_base_dir_path))
-				cudnn_data_base_dir_path = cudnn_data_base_dir_path.branch_path();
-
-			if (!boost::filesystem::exists(cudnn_data_base_dir_path))
+			const boost::filesystem::path cudnn_data_dir_path(GetDataDirPath("cudnn_data"));
+			if (!cudnn_data_dir_path.empty())
 			{
-				// exẽfBNg擾łȂ΃JgfBNgɕۑ
-
-				cudnn_data_base_dir_path = boost::filesystem::current_path();
-
-				if (cudnn_data_base_dir_path.is_relative())
-					cudnn_data_base_dir_path = boost::filesystem::system_complete(cudnn_data_base_dir_path);
-
-				if (!boost::filesystem::exists(cudnn_data_base_dir_path))
-					cudnn_data_base_dir_path = "./";
-			}
-
-			if (boost::filesystem::exists(cudnn_data_base_dir_path))
-			{
-				const boost::filesystem::path cudnn_data_dir_path(cudnn_data_base_dir_path / "cudnn_data");
-
-				bool isOK = false;
-				if (boost::filesystem::exists(cudnn_data_dir_path))
-					isOK = true;
-
-				if (!isOK)
+				cudaDeviceProp prop;
+				if (cudaGetDeviceProperties(&prop, mGPUNo) == cudaSuccess)
 				{
-					boost::system::error_code error;
-					const bool result = boost::filesystem::create_directory(cudnn_data_dir_path, error);
-					if (result && !error)
-						isOK = true;
-				}
-
-				if (isOK)
-				{
-					cudaDeviceProp prop;
-					if (cudaGetDeviceProperties(&prop, mGPUNo) == cudaSuccess)
-					{
-						std::string conv_filename(prop.name);
-						conv_filename += " conv ";
+					std::string conv_filename(prop.name);
+					conv_filename += " conv.dat";
 
-						std::string deconv_filename(prop.name);
-						deconv_filename += " deconv ";
+					std::string deconv_filename(prop.name);
+					deconv_filename += " deconv.dat";
 
-						const boost::filesystem::path conv_data_path = cudnn_data_dir_path / conv_filename;
-						const boost::filesystem::path deconv_data_path = cudnn_data_dir_path / deconv_filename;
+					const boost::filesystem::path conv_data_path = cudnn_data_dir_path / conv_filename;
+					const boost::filesystem::path deconv_data_path = cudnn_data_dir_path / deconv_filename;
 
-						g_ConvCcuDNNAlgorithm.SetDataPath(conv_data_path.string());
-						g_DeconvCcuDNNAlgorithm.SetDataPath(deconv_data_path.string());
-					}
+					g_ConvCcuDNNAlgorithm.SetDataPath(conv_data_path);
+					g_DeconvCcuDNNAlgorithm.SetDataPath(deconv_data_path);
 				}
 			}
 		}
+		else if (Process == "cpu")
+		{
+			// exẽfBNgCPU̎ʂۑ
+			const boost::filesystem::path cpu_data_dir_path(GetDataDirPath("cpu_tune_data"));
+			if (!cpu_data_dir_path.empty())
+			{
+				const std::string filename = GetCPUName() + " " + std::to_string(std::thread::hardware_concurrency()) + "cores.dat";
+				g_CPUTuneData.SetDataPath(cpu_data_dir_path / filename);
+			}
+		}
 
 		const boost::filesystem::path mode_dir_path(GetModeDirPath(model_dir));
 		if (!boost::filesystem::exists(mode_dir_path))
@@ -631,16 +651,8 @@ Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noi
 
 		CudaDeviceSet devset(process, mGPUNo);
 
-		if (mProcess == "cpu")
-		{
-			caffe::Caffe::set_mode(caffe::Caffe::CPU);
-			mIsCuda = false;
-		}
-		else
-		{
-			caffe::Caffe::set_mode(caffe::Caffe::GPU);
-			mIsCuda = true;
-		}
+		mIsCuda = mProcess != "cpu";
+		SetCaffeMode();
 
 		caffe::Caffe::SetGetcuDNNAlgorithmFunc(GetcuDNNAlgorithm);
 		caffe::Caffe::SetSetcuDNNAlgorithmFunc(SetcuDNNAlgorithm);
@@ -650,11 +662,15 @@ Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noi
 
 		const boost::filesystem::path info_path = GetInfoPath(mode_dir_path);
 
+		const auto InfoStartTime = cTrace::Now();
+
 		stInfo info;
 		ret = cNet::GetInfo(info_path, info);
 		if (ret != Waifu2x::eWaifu2xError_OK)
 			return ret;
 
+		mLoadTime.info = (cTrace::Now() - InfoStartTime) / 1000000.0;
+
 		mHasNoiseScale = info.has_noise_scale;
 		mInputPlane = info.channels;
 
@@ -684,6 +700,8 @@ Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noi
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
 
+			AddLoadTime(mNoiseNet->GetLoadTime());
+
 			mMaxNetOffset = mNoiseNet->GetNetOffset();
 		}
 
@@ -701,6 +719,8 @@ Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noi
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
 
+			AddLoadTime(mScaleNet->GetLoadTime());
+
 			assert(mInputPlane == 0 || mInputPlane == mScaleNet->GetInputPlane());
 
 			mMaxNetOffset = std::max(mScaleNet->GetNetOffset(), mMaxNetOffset);
@@ -710,6 +730,9 @@ Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noi
 			
 		}
 
+		if (!mIsCuda)
+			ApplyCPUTuneParam(mode_dir_path.filename().string());
+
 		mIsInited = true;
 	}
 	catch (...)
@@ -717,6 +740,9 @@ Waifu2x::eWaifu2xError Waifu2x::Init(const eWaifu2xModelType mode, const int noi
 		return Waifu2x::eWaifu2xError_InvalidParameter;
 	}
 
+	mLoadTime.total = (cTrace::Now() - InitStartTime) / 1000000.0;
+	cMetrics::Observe("waifu2x_stage_seconds", mLoadTime.total, "stage=\"model_load\"");
+
 	return Waifu2x::eWaifu2xError_OK;
 }
 
@@ -751,139 +777,616 @@ Waifu2x::eWaifu2xError Waifu2x::waifu2x(const boost::filesystem::path &input_fil
 	const boost::optional<int> output_quality, const int output_depth, const bool use_tta,
 	const int batch_size)
 {
-	Waifu2x::eWaifu2xError ret;
+	const auto ret = ProcessFile(input_file, output_file, scale_ratio, scale_width, scale_height, cancel_func, crop_w, crop_h,
+		output_quality, output_depth, use_tta, batch_size);
 
-	if (!mIsInited)
-		return Waifu2x::eWaifu2xError_NotInitialized;
+	RecordResultMetrics(ret);
 
-	stImage image;
-	ret = image.Load(input_file);
-	if (ret != Waifu2x::eWaifu2xError_OK)
-		return ret;
+	return ret;
+}
 
-	image.Preprocess(mInputPlane, mMaxNetOffset);
+Waifu2x::eWaifu2xError Waifu2x::waifu2x(const double factor, const void* source, void* dest, const int width, const int height,
+	const int in_channel, const int in_stride, const int out_channel, const int out_stride,
+	const int crop_w, const int crop_h, const bool use_tta, const int batch_size, const int in_depth, const int out_depth)
+{
+	const auto ret = ProcessBuffer(factor, source, dest, width, height, in_channel, in_stride, out_channel, out_stride,
+		crop_w, crop_h, use_tta, batch_size, in_depth, out_depth);
 
-	const bool isReconstructNoise = mMode == eWaifu2xModelTypeNoise || mMode == eWaifu2xModelTypeNoiseScale || (mMode == eWaifu2xModelTypeAutoScale && image.RequestDenoise());
-	const bool isReconstructScale = mMode == eWaifu2xModelTypeScale || mMode == eWaifu2xModelTypeNoiseScale || mMode == eWaifu2xModelTypeAutoScale;
+	RecordResultMetrics(ret);
 
-	auto factor = CalcScaleRatio(scale_ratio, scale_width, scale_height, image);
+	return ret;
+}
 
-	if (!isReconstructScale)
-		factor = Factor(1.0, 1.0);
+const char* Waifu2x::GetErrorName(const Waifu2x::eWaifu2xError ret)
+{
+	// eWaifu2xErroȑԂƓł邱
+	static const char * const ErrorNameList[] =
+	{
+		"OK",
+		"Cancel",
+		"NotInitialized",
+		"InvalidParameter",
+		"FailedOpenInputFile",
+		"FailedOpenOutputFile",
+		"FailedOpenModelFile",
+		"FailedParseModelFile",
+		"FailedWriteModelFile",
+		"FailedConstructModel",
+		"FailedProcessCaffe",
+		"FailedCudaCheck",
+		"FailedUnknownType",
+	};
 
-	cv::Mat reconstruct_image;
-	ret = ReconstructImage(factor, crop_w, crop_h, use_tta, batch_size, isReconstructNoise, isReconstructScale, cancel_func, image);
-	if (ret != Waifu2x::eWaifu2xError_OK)
-		return ret;
+	const int index = (int)ret;
+	if (index >= 0 && index < (int)(sizeof(ErrorNameList) / sizeof(ErrorNameList[0])))
+		return ErrorNameList[index];
 
-	if(!scale_width || !scale_height)
-		image.Postprocess(mInputPlane, factor, output_depth);
-	else
-		image.Postprocess(mInputPlane, *scale_width, *scale_height, output_depth);
+	return "Unknown";
+}
 
-	ret = image.Save(output_file, output_quality);
-	if (ret != Waifu2x::eWaifu2xError_OK)
-		return ret;
+void Waifu2x::RecordResultMetrics(const Waifu2x::eWaifu2xError ret)
+{
+	if (ret == Waifu2x::eWaifu2xError_OK)
+	{
+		cMetrics::Increment("waifu2x_images_processed_total");
+		return;
+	}
 
-	return Waifu2x::eWaifu2xError_OK;
+	const std::string label = std::string("error=\"") + GetErrorName(ret) + "\"";
+	cMetrics::Increment("waifu2x_errors_total", 1, label.c_str());
 }
 
-Waifu2x::eWaifu2xError Waifu2x::waifu2x(const double factor, const void* source, void* dest, const int width, const int height,
-	const int in_channel, const int in_stride, const int out_channel, const int out_stride,
-	const int crop_w, const int crop_h, const bool use_tta, const int batch_size)
+Waifu2x::eWaifu2xError Waifu2x::ProcessFile(const boost::filesystem::path &input_file, const boost::filesystem::path &output_file,
+	const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+	const waifu2xCancelFunc cancel_func, const int crop_w, const int crop_h,
+	const boost::optional<int> output_quality, const int output_depth, const bool use_tta,
+	const int batch_size)
 {
+	TRACE_SCOPE_WAIFU2X("Waifu2x::waifu2x");
+
 	Waifu2x::eWaifu2xError ret;
 
 	if (!mIsInited)
 		return Waifu2x::eWaifu2xError_NotInitialized;
 
-	int cvrSetting = -1;
-	if (in_channel == 3 && out_channel == 3)
-		cvrSetting = CV_BGR2RGB;
-	else if (in_channel == 4 && out_channel == 4)
-		cvrSetting = CV_BGRA2RGBA;
-	else if (in_channel == 3 && out_channel == 4)
-		cvrSetting = CV_BGR2RGBA;
-	else if (in_channel == 4 && out_channel == 3)
-		cvrSetting = CV_BGRA2RGB;
-	else if (!(in_channel == 1 && out_channel == 1))
-		return Waifu2x::eWaifu2xError_InvalidParameter;
+	// ͂TIFFŏo͂TIFFDZIȂяɕď(ΉĂȂ`{Ȃ摜Ŝ)
+	if (g_TiffStreamRows > 0 && IsTiffFile(input_file) && (IsTiffFile(output_file) || IsDziFile(output_file)))
+	{
+		bool isProcessed = false;
+		ret = ProcessTiffStream(input_file, output_file, scale_ratio, scale_width, scale_height, cancel_func, crop_w, crop_h,
+			output_quality, output_depth, use_tta, batch_size, isProcessed);
+		if (isProcessed)
+			return ret;
+	}
+
+	// ͂Aj[V(GIF, APNG)ŏo͂PNGȂAPNGɂ(Aj[VłȂΕʂɏ)
+	if ((IsGifFile(input_file) || IsPngFile(input_file)) && IsPngFile(output_file))
+	{
+		bool isProcessed = false;
+		ret = ProcessAnimation(input_file, output_file, scale_ratio, scale_width, scale_height, cancel_func, crop_w, crop_h,
+			output_depth, use_tta, batch_size, isProcessed);
+		if (isProcessed)
+			return ret;
+	}
+
+	ResetMemoryUsage();
+
+	// PFM, NPY͗ʎqɕ_̂܂ܕۑ
+	const int end_depth = stImage::IsRawFloatFile(output_file) ? 32 : output_depth;
+
+	const bool isReconstructScale = mMode == eWaifu2xModelTypeScale || mMode == eWaifu2xModelTypeNoiseScale || mMode == eWaifu2xModelTypeAutoScale;
+
+	// o͂\΁AkTCYo͂̃TCYȂ͈͂JPEGkăfR[h
+	// (lbgŊg傷񐔂͕ς炸AfR[hƃlbgɒʂf)
+	cv::Size_<int> reducedOrgSize;
+	const auto GetReduce = [&](const cv::Size_<int> &org_size)
+	{
+		const cv::Size_<int> outputSize = CalcOutputSize(scale_ratio, scale_width, scale_height, org_size);
+
+		int reduce = 8;
+		while (reduce > 1 && ((org_size.width + reduce - 1) / reduce < outputSize.width || (org_size.height + reduce - 1) / reduce < outputSize.height))
+			reduce /= 2;
+
+		if (reduce > 1)
+			reducedOrgSize = org_size;
+
+		return reduce;
+	};
+
+	const bool isReduceEnabled = g_IsReducedDecodeEnabled && isReconstructScale && (scale_ratio || scale_width || scale_height);
 
 	stImage image;
-	ret = image.Load(source, width, height, in_channel, in_stride);
+	double stageStartTime = cMetrics::Now();
+	ret = image.Load(input_file, isReduceEnabled ? stImage::ReduceFunc(GetReduce) : stImage::ReduceFunc());
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"load\"");
 
-	image.Preprocess(mInputPlane, mMaxNetOffset);
+	UpdateImageMemoryUsage(image.GetMemorySize());
 
-	const bool isReconstructNoise = mMode == eWaifu2xModelTypeNoise || mMode == eWaifu2xModelTypeNoiseScale;
-	const bool isReconstructScale = mMode == eWaifu2xModelTypeScale || mMode == eWaifu2xModelTypeNoiseScale || mMode == eWaifu2xModelTypeAutoScale;
+	const bool isReconstructNoise = mMode == eWaifu2xModelTypeNoise || mMode == eWaifu2xModelTypeNoiseScale || (mMode == eWaifu2xModelTypeAutoScale && image.RequestDenoise());
+
+	auto factor = CalcScaleRatio(scale_ratio, scale_width, scale_height, image.GetOrgSize());
+
+	boost::optional<int> end_width = scale_width;
+	boost::optional<int> end_height = scale_height;
+	if (reducedOrgSize.area() > 0 && image.GetOrgSize() != reducedOrgSize)
+	{
+		// kăfR[hł̂ŁẢ摜TCY狁߂o͂̃TCYɏk
+		const cv::Size_<int> outputSize = CalcOutputSize(scale_ratio, scale_width, scale_height, reducedOrgSize);
+		const cv::Size_<int> &size = image.GetOrgSize();
+
+		const Factor fw((double)outputSize.width, (double)size.width);
+		const Factor fh((double)outputSize.height, (double)size.height);
+		factor = fw.toDouble() >= fh.toDouble() ? fw : fh;
+
+		end_width = outputSize.width;
+		end_height = outputSize.height;
+
+		cMetrics::Increment("waifu2x_reduced_decodes_total");
+	}
 
-	Factor nowFactor = Factor(factor, 1.0);
 	if (!isReconstructScale)
-		nowFactor = Factor(1.0, 1.0);
+		factor = Factor(1.0, 1.0);
+
+	// 摜̃TCY_Ńs[Ñgpʂ𐄒肵ė\Z\񂷂(܂ȂΑ̃Wu܂ő҂)
+	mMemoryEstimate = EstimateMemoryUsage(image, factor, isReconstructNoise, isReconstructScale, crop_w, crop_h, use_tta, batch_size, end_depth);
+
+	cMemoryBudget::cReservation reservation;
+	if (!reservation.Acquire(mMemoryEstimate.total, cancel_func))
+		return Waifu2x::eWaifu2xError_Cancel;
+
+	if (mProgressFunc)
+		BeginProgress(image, end_width && end_height ? cv::Size_<int>(*end_width, *end_height) : image.GetScaledSize(factor));
+
+	stageStartTime = cMetrics::Now();
+	image.Preprocess(mInputPlane, mMaxNetOffset);
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"preprocess\"");
+
+	UpdateImageMemoryUsage(image.GetMemorySize());
 
 	cv::Mat reconstruct_image;
-	ret = ReconstructImage(nowFactor, crop_w, crop_h, use_tta, batch_size, isReconstructNoise, isReconstructScale, nullptr, image);
+	stageStartTime = cMetrics::Now();
+	ret = ReconstructImage(factor, crop_w, crop_h, use_tta, batch_size, isReconstructNoise, isReconstructScale, cancel_func, image);
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"reconstruct\"");
 
-	image.Postprocess(mInputPlane, nowFactor, 8);
+	stageStartTime = cMetrics::Now();
+	if(!end_width || !end_height)
+		image.Postprocess(mInputPlane, factor, end_depth);
+	else
+		image.Postprocess(mInputPlane, *end_width, *end_height, end_depth);
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"postprocess\"");
 
-	cv::Mat out_bgr_image = image.GetEndImage();
-	image.Clear();
+	UpdateImageMemoryUsage(image.GetMemorySize());
 
-	cv::Mat out_image;
-	if (cvrSetting >= 0)
-		cv::cvtColor(out_bgr_image, out_image, cvrSetting); // BGRRGBɖ߂
-	else
-		out_image = out_bgr_image;
-	out_bgr_image.release();
+	if (mProgressFunc)
+		EndProgress(image.GetEndImage());
+
+	stageStartTime = cMetrics::Now();
+	if (IsDziFile(output_file))
+	{
+		// ۑo͂ǂݒɁÂ܂܃^C̃s~bhɂ
+		const cv::Mat end_image = image.GetEndImage();
 
-	// o͔z֏
+		cDziWriter writer(output_quality);
+		if (!writer.Open(output_file, end_image.size(), end_image.channels(), end_image.depth()) || !writer.WriteRows(end_image) || !writer.Close())
+			return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+	}
+	else
 	{
-		const auto width = out_image.size().width;
-		const auto stride = out_image.step1();
-		for (int i = 0; i < out_image.size().height; i++)
-			memcpy((uint8_t *)dest + out_stride * i, out_image.data + stride * i, out_stride);
+		ret = image.Save(output_file, output_quality);
+		if (ret != Waifu2x::eWaifu2xError_OK)
+			return ret;
 	}
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"save\"");
 
 	return Waifu2x::eWaifu2xError_OK;
 }
 
-Factor Waifu2x::CalcScaleRatio(const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
-	const stImage &image)
+Waifu2x::eWaifu2xError Waifu2x::ProcessTiffStream(const boost::filesystem::path &input_file, const boost::filesystem::path &output_file,
+	const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+	const waifu2xCancelFunc cancel_func, const int crop_w, const int crop_h,
+	const boost::optional<int> output_quality, const int output_depth, const bool use_tta,
+	const int batch_size, bool &is_processed)
 {
-	if (scale_ratio)
-		return Factor(*scale_ratio, 1.0);
+	TRACE_SCOPE_WAIFU2X("Waifu2x::ProcessTiffStream");
 
-	if (scale_width && scale_height)
-	{
-		const auto d1 = image.GetScaleFromWidth(*scale_width);
-		const auto d2 = image.GetScaleFromWidth(*scale_height);
+	is_processed = false;
 
-		return d1.toDouble() >= d2.toDouble() ? d1 : d2;
-	}
+	cTiffReader reader;
+	if (!reader.Open(input_file))
+		return Waifu2x::eWaifu2xError_OK;
 
-	if (scale_width)
-		return image.GetScaleFromWidth(*scale_width);
+	const cv::Size_<int> orgSize = reader.GetSize();
 
-	if(scale_height)
-		return image.GetScaleFromHeight(*scale_height);
+	// TIFF͎ŃmCYȂ
+	const bool isReconstructNoise = mMode == eWaifu2xModelTypeNoise || mMode == eWaifu2xModelTypeNoiseScale;
+	const bool isReconstructScale = mMode == eWaifu2xModelTypeScale || mMode == eWaifu2xModelTypeNoiseScale || mMode == eWaifu2xModelTypeAutoScale;
 
-	return Factor(1.0, 1.0);
-}
+	const Factor factor = isReconstructScale ? CalcScaleRatio(scale_ratio, scale_width, scale_height, orgSize) : Factor(1.0, 1.0);
 
-int Waifu2x::GetcuDNNAlgorithm(const char * layer_name, int num_input, int num_output, int batch_size,
-	int width, int height, int kernel_w, int kernel_h, int pad_w, int pad_h, int stride_w, int stride_h)
-{
-	// g_ConvCcuDNNAlgorithmg_DeconvCcuDNNAlgorithmtɂȂĂ܂Ă邪At@CɂeȂ̂ƌ݊ȂȂ̂ł̂܂܎dlƂ
-	if (strcmp(layer_name, "Deconvolution") == 0)
-		return g_ConvCcuDNNAlgorithm.GetAlgorithm(num_input, num_output, batch_size, width, height, kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h);
-	else if (strcmp(layer_name, "Convolution") == 0)
-		return g_DeconvCcuDNNAlgorithm.GetAlgorithm(num_input, num_output, batch_size, width, height, kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h);
+	const int netScale = CalcNetScale(factor, isReconstructNoise, isReconstructScale);
 
-	return -1;
+	// тƂ̏o͂̍s摜Ŝ̏o͂̍sƂȂ悤ɁAŌɏkȂ{̏ꍇď
+	const cv::Size_<int> outputSize = scale_width && scale_height ? cv::Size_<int>(*scale_width, *scale_height)
+		: cv::Size_<int>((int)factor.MultiNumerator(orgSize.width).toDouble(), (int)factor.MultiNumerator(orgSize.height).toDouble());
+	if (outputSize != orgSize * netScale)
+		return Waifu2x::eWaifu2xError_OK;
+
+	is_processed = true;
+
+	ResetMemoryUsage();
+
+	// т̏㉺ɕt̍s(SẲ̃lbgQƂ͈́Bg2ڈȍ~͓͂̉fɂƔȉɂȂ)
+	const int BandRows = g_TiffStreamRows;
+	const int HaloRows = mMaxNetOffset * 2;
+
+	const Factor bandFactor((double)netScale, 1.0);
+
+	std::unique_ptr<cRowWriter> writer;
+	if (IsDziFile(output_file))
+		writer.reset(new cDziWriter(output_quality));
+	else
+		writer.reset(new cTiffWriter());
+
+	for (int y0 = 0; y0 < orgSize.height; y0 += BandRows)
+	{
+		if (cancel_func && cancel_func())
+			return Waifu2x::eWaifu2xError_Cancel;
+
+		const int y1 = std::min(y0 + BandRows, orgSize.height);
+		const int ry0 = std::max(y0 - HaloRows, 0);
+		const int ry1 = std::min(y1 + HaloRows, orgSize.height);
+
+		cv::Mat band;
+		double stageStartTime = cMetrics::Now();
+		if (!reader.ReadRegion(cv::Rect(0, ry0, orgSize.width, ry1 - ry0), band))
+			return Waifu2x::eWaifu2xError_FailedOpenInputFile;
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"load\"");
+
+		stImage image;
+		image.Load(band);
+
+		UpdateImageMemoryUsage(image.GetMemorySize());
+
+		mMemoryEstimate = EstimateMemoryUsage(image, bandFactor, isReconstructNoise, isReconstructScale, crop_w, crop_h, use_tta, batch_size, output_depth);
+
+		cMemoryBudget::cReservation reservation;
+		if (!reservation.Acquire(mMemoryEstimate.total, cancel_func))
+			return Waifu2x::eWaifu2xError_Cancel;
+
+		stageStartTime = cMetrics::Now();
+		image.Preprocess(mInputPlane, mMaxNetOffset);
+		band.release();
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"preprocess\"");
+
+		UpdateImageMemoryUsage(image.GetMemorySize());
+
+		stageStartTime = cMetrics::Now();
+		const auto ret = ReconstructImage(bandFactor, crop_w, crop_h, use_tta, batch_size, isReconstructNoise, isReconstructScale, cancel_func, image);
+		if (ret != Waifu2x::eWaifu2xError_OK)
+			return ret;
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"reconstruct\"");
+
+		stageStartTime = cMetrics::Now();
+		image.Postprocess(mInputPlane, bandFactor, output_depth);
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"postprocess\"");
+
+		UpdateImageMemoryUsage(image.GetMemorySize());
+
+		// ̍s̕ď
+		const cv::Mat end_image = image.GetEndImage();
+		const cv::Mat rows = end_image(cv::Rect(0, (y0 - ry0) * netScale, end_image.cols, (y1 - y0) * netScale));
+
+		stageStartTime = cMetrics::Now();
+		if (!writer->IsOpen() && !writer->Open(output_file, outputSize, end_image.channels(), end_image.depth()))
+			return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+
+		if (!writer->WriteRows(rows))
+			return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"save\"");
+	}
+
+	if (!writer->Close())
+		return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+Waifu2x::eWaifu2xError Waifu2x::ProcessAnimation(const boost::filesystem::path &input_file, const boost::filesystem::path &output_file,
+	const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+	const waifu2xCancelFunc cancel_func, const int crop_w, const int crop_h, const int output_depth, const bool use_tta,
+	const int batch_size, bool &is_processed)
+{
+	TRACE_SCOPE_WAIFU2X("Waifu2x::ProcessAnimation");
+
+	is_processed = false;
+
+	std::vector<cAnimation::stFrame> frames;
+	int loop = 0;
+	double stageStartTime = cMetrics::Now();
+	if (!cAnimation::Load(input_file, frames, loop))
+		return Waifu2x::eWaifu2xError_OK;
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"load\"");
+
+	is_processed = true;
+
+	ResetMemoryUsage();
+
+	const cv::Size_<int> orgSize = frames[0].image.size();
+	const cv::Rect orgRect(0, 0, orgSize.width, orgSize.height);
+
+	// GIF, APNG͎ŃmCYȂ
+	const bool isReconstructNoise = mMode == eWaifu2xModelTypeNoise || mMode == eWaifu2xModelTypeNoiseScale;
+	const bool isReconstructScale = mMode == eWaifu2xModelTypeScale || mMode == eWaifu2xModelTypeNoiseScale || mMode == eWaifu2xModelTypeAutoScale;
+
+	const Factor factor = isReconstructScale ? CalcScaleRatio(scale_ratio, scale_width, scale_height, orgSize) : Factor(1.0, 1.0);
+	const int netScale = CalcNetScale(factor, isReconstructNoise, isReconstructScale);
+
+	const cv::Size_<int> outputSize = scale_width && scale_height ? cv::Size_<int>(*scale_width, *scale_height)
+		: cv::Size_<int>((int)factor.MultiNumerator(orgSize.width).toDouble(), (int)factor.MultiNumerator(orgSize.height).toDouble());
+
+	// ς͈͂̏o͂t[Ŝ̏o͂ƂȂ悤ɁAŌɏkȂ{̏ꍇς͈͂
+	// ȊO̔{ł͑SẴt[Ŝŏ
+	const bool isPartial = outputSize == orgSize * netScale;
+	const Factor frameFactor = isPartial ? Factor((double)netScale, 1.0) : factor;
+
+	// ς͈͂̎ɕtf(SẲ̃lbgQƂ͈)
+	const int Halo = mMaxNetOffset * 2;
+
+	// SẴt[sȂ烿`lȂ
+	bool isOpaque = true;
+	for (const auto &f : frames)
+	{
+		cv::Mat alpha;
+		cv::extractChannel(f.image, alpha, 3);
+
+		double minVal = 0.0;
+		cv::minMaxLoc(alpha, &minVal);
+		if (minVal < 255.0)
+		{
+			isOpaque = false;
+			break;
+		}
+	}
+
+	if (isOpaque)
+	{
+		for (auto &f : frames)
+			cv::cvtColor(f.image, f.image, cv::COLOR_BGRA2BGR);
+	}
+
+	std::vector<cAnimation::stFrame> outFrames;
+	int64_t reusedPixels = 0;
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		if (cancel_func && cancel_func())
+			return Waifu2x::eWaifu2xError_Cancel;
+
+		const auto &frame = frames[i];
+
+		const cv::Rect rect = isPartial && i > 0 ? frame.rect : orgRect;
+		if (rect.area() == 0) // Õt[ƓȂÕt[𒷂\
+		{
+			outFrames.back().delay += frame.delay;
+			reusedPixels += orgSize.area();
+			continue;
+		}
+
+		const cv::Rect region = cv::Rect(rect.x - Halo, rect.y - Halo, rect.width + Halo * 2, rect.height + Halo * 2) & orgRect;
+		reusedPixels += orgSize.area() - region.area();
+
+		stImage image;
+		image.Load(frame.image(region).clone());
+
+		UpdateImageMemoryUsage(image.GetMemorySize());
+
+		mMemoryEstimate = EstimateMemoryUsage(image, frameFactor, isReconstructNoise, isReconstructScale, crop_w, crop_h, use_tta, batch_size, output_depth);
+
+		cMemoryBudget::cReservation reservation;
+		if (!reservation.Acquire(mMemoryEstimate.total, cancel_func))
+			return Waifu2x::eWaifu2xError_Cancel;
+
+		stageStartTime = cMetrics::Now();
+		image.Preprocess(mInputPlane, mMaxNetOffset);
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"preprocess\"");
+
+		UpdateImageMemoryUsage(image.GetMemorySize());
+
+		stageStartTime = cMetrics::Now();
+		const auto ret = ReconstructImage(frameFactor, crop_w, crop_h, use_tta, batch_size, isReconstructNoise, isReconstructScale, cancel_func, image);
+		if (ret != Waifu2x::eWaifu2xError_OK)
+			return ret;
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"reconstruct\"");
+
+		stageStartTime = cMetrics::Now();
+		if (isPartial || !scale_width || !scale_height)
+			image.Postprocess(mInputPlane, frameFactor, output_depth);
+		else
+			image.Postprocess(mInputPlane, *scale_width, *scale_height, output_depth);
+		cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"postprocess\"");
+
+		UpdateImageMemoryUsage(image.GetMemorySize());
+
+		// ̉f̕āAÕt[̏o͂̏ɒut[ɂ
+		const cv::Mat end_image = image.GetEndImage();
+
+		cAnimation::stFrame out;
+		out.delay = frame.delay;
+		if (isPartial)
+		{
+			out.rect = cv::Rect(rect.x * netScale, rect.y * netScale, rect.width * netScale, rect.height * netScale);
+			out.image = end_image(cv::Rect((rect.x - region.x) * netScale, (rect.y - region.y) * netScale, out.rect.width, out.rect.height)).clone();
+		}
+		else
+		{
+			out.rect = cv::Rect(0, 0, end_image.cols, end_image.rows);
+			out.image = end_image;
+		}
+
+		outFrames.push_back(out);
+	}
+
+	cMetrics::Increment("waifu2x_animation_pixels_reused_total", reusedPixels);
+
+	stageStartTime = cMetrics::Now();
+	if (!cAnimation::SaveAPNG(output_file, outFrames[0].image.size(), outFrames, loop))
+		return Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"save\"");
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+Waifu2x::eWaifu2xError Waifu2x::ProcessBuffer(const double factor, const void* source, void* dest, const int width, const int height,
+	const int in_channel, const int in_stride, const int out_channel, const int out_stride,
+	const int crop_w, const int crop_h, const bool use_tta, const int batch_size, const int in_depth, const int out_depth)
+{
+	TRACE_SCOPE_WAIFU2X("Waifu2x::waifu2x(buffer)");
+
+	Waifu2x::eWaifu2xError ret;
+
+	if (!mIsInited)
+		return Waifu2x::eWaifu2xError_NotInitialized;
+
+	// ʂsourceƓRGB(A)̏Ȃ̂ŁA`lႤƂϊ
+	int cvrSetting = -1;
+	if (in_channel == 3 && out_channel == 4)
+		cvrSetting = CV_RGB2RGBA;
+	else if (in_channel == 4 && out_channel == 3)
+		cvrSetting = CV_RGBA2RGB;
+	else if (in_channel != out_channel || (in_channel != 1 && in_channel != 3 && in_channel != 4))
+		return Waifu2x::eWaifu2xError_InvalidParameter;
+
+	if ((in_depth != 8 && in_depth != 16 && in_depth != 32) || (out_depth != 8 && out_depth != 16 && out_depth != 32))
+		return Waifu2x::eWaifu2xError_InvalidParameter;
+
+	if (width <= 0 || height <= 0 || in_stride < width * in_channel * (in_depth / 8))
+		return Waifu2x::eWaifu2xError_InvalidParameter;
+
+	ResetMemoryUsage();
+
+	stImage image;
+	double stageStartTime = cMetrics::Now();
+	ret = image.Load(source, width, height, in_channel, in_stride, in_depth);
+	if (ret != Waifu2x::eWaifu2xError_OK)
+		return ret;
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"load\"");
+
+	UpdateImageMemoryUsage(image.GetMemorySize());
+
+	const bool isReconstructNoise = mMode == eWaifu2xModelTypeNoise || mMode == eWaifu2xModelTypeNoiseScale;
+	const bool isReconstructScale = mMode == eWaifu2xModelTypeScale || mMode == eWaifu2xModelTypeNoiseScale || mMode == eWaifu2xModelTypeAutoScale;
+
+	Factor nowFactor = Factor(factor, 1.0);
+	if (!isReconstructScale)
+		nowFactor = Factor(1.0, 1.0);
+
+	if (out_stride < image.GetScaledSize(nowFactor).width * out_channel * (out_depth / 8))
+		return Waifu2x::eWaifu2xError_InvalidParameter;
+
+	mMemoryEstimate = EstimateMemoryUsage(image, nowFactor, isReconstructNoise, isReconstructScale, crop_w, crop_h, use_tta, batch_size, out_depth);
+
+	// obt@łɂ͒f֐̂ŗ\Z󂭂܂ő҂(falseɂȂȂǍoHƓ悤Ɉ)
+	cMemoryBudget::cReservation reservation;
+	if (!reservation.Acquire(mMemoryEstimate.total))
+		return Waifu2x::eWaifu2xError_Cancel;
+
+	if (mProgressFunc)
+		BeginProgress(image, image.GetScaledSize(nowFactor));
+
+	stageStartTime = cMetrics::Now();
+	image.Preprocess(mInputPlane, mMaxNetOffset);
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"preprocess\"");
+
+	UpdateImageMemoryUsage(image.GetMemorySize());
+
+	cv::Mat reconstruct_image;
+	stageStartTime = cMetrics::Now();
+	ret = ReconstructImage(nowFactor, crop_w, crop_h, use_tta, batch_size, isReconstructNoise, isReconstructScale, nullptr, image);
+	if (ret != Waifu2x::eWaifu2xError_OK)
+		return ret;
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"reconstruct\"");
+
+	stageStartTime = cMetrics::Now();
+	image.Postprocess(mInputPlane, nowFactor, out_depth);
+	cMetrics::Observe("waifu2x_stage_seconds", cMetrics::Now() - stageStartTime, "stage=\"postprocess\"");
+
+	UpdateImageMemoryUsage(image.GetMemorySize());
+
+	const cv::Mat out_image = image.GetEndImage();
+	image.Clear();
+
+	if (mProgressFunc) // ro߂̉摜BGR(A)
+	{
+		cv::Mat out_bgr_image;
+		if (out_image.channels() >= 3)
+			cv::cvtColor(out_image, out_bgr_image, out_image.channels() == 4 ? CV_RGBA2BGRA : CV_RGB2BGR);
+		else
+			out_bgr_image = out_image;
+
+		EndProgress(out_bgr_image);
+	}
+
+	// o͔z֒ڏ
+	cv::Mat dest_image(out_image.size(), CV_MAKETYPE(out_image.depth(), out_channel), dest, out_stride);
+	if (cvrSetting >= 0)
+		cv::cvtColor(out_image, dest_image, cvrSetting);
+	else
+		out_image.copyTo(dest_image);
+
+	return Waifu2x::eWaifu2xError_OK;
+}
+
+Factor Waifu2x::CalcScaleRatio(const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+	const cv::Size_<int> &org_size)
+{
+	if (scale_ratio)
+		return Factor(*scale_ratio, 1.0);
+
+	// stImage::GetScaleFromWidth(), stImage::GetScaleFromHeight()Ɠ
+	const auto GetScaleFromWidth = [&org_size](const int width) { return Factor((double)width, (double)org_size.width); };
+	const auto GetScaleFromHeight = [&org_size](const int height) { return Factor((double)height, (double)org_size.height); };
+
+	if (scale_width && scale_height)
+	{
+		const auto d1 = GetScaleFromWidth(*scale_width);
+		const auto d2 = GetScaleFromWidth(*scale_height);
+
+		return d1.toDouble() >= d2.toDouble() ? d1 : d2;
+	}
+
+	if (scale_width)
+		return GetScaleFromWidth(*scale_width);
+
+	if(scale_height)
+		return GetScaleFromHeight(*scale_height);
+
+	return Factor(1.0, 1.0);
+}
+
+cv::Size_<int> Waifu2x::CalcOutputSize(const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+	const cv::Size_<int> &org_size)
+{
+	if (scale_width && scale_height)
+		return cv::Size_<int>(*scale_width, *scale_height);
+
+	// stImage::GetScaledSize()Ɠ
+	const Factor factor = CalcScaleRatio(scale_ratio, scale_width, scale_height, org_size);
+	return cv::Size_<int>((int)factor.MultiNumerator(org_size.width).toDouble(), (int)factor.MultiNumerator(org_size.height).toDouble());
+}
+
+int Waifu2x::GetcuDNNAlgorithm(const char * layer_name, int num_input, int num_output, int batch_size,
+	int width, int height, int kernel_w, int kernel_h, int pad_w, int pad_h, int stride_w, int stride_h)
+{
+	// g_ConvCcuDNNAlgorithmg_DeconvCcuDNNAlgorithmtɂȂĂ܂Ă邪At@CɂeȂ̂ƌ݊ȂȂ̂ł̂܂܎dlƂ
+	if (strcmp(layer_name, "Deconvolution") == 0)
+		return g_ConvCcuDNNAlgorithm.GetAlgorithm(num_input, num_output, batch_size, width, height, kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h);
+	else if (strcmp(layer_name, "Convolution") == 0)
+		return g_DeconvCcuDNNAlgorithm.GetAlgorithm(num_input, num_output, batch_size, width, height, kernel_w, kernel_h, pad_w, pad_h, stride_w, stride_h);
+
+	return -1;
 }
 
 void Waifu2x::SetcuDNNAlgorithm(int algo, const char * layer_name, int num_input, int num_output, int batch_size,
@@ -899,19 +1402,36 @@ void Waifu2x::SetcuDNNAlgorithm(int algo, const char * layer_name, int num_input
 Waifu2x::eWaifu2xError Waifu2x::ReconstructImage(const Factor factor, const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 	const bool isReconstructNoise, const bool isReconstructScale, const Waifu2x::waifu2xCancelFunc cancel_func, stImage &image)
 {
+	TRACE_SCOPE_WAIFU2X("Waifu2x::ReconstructImage");
+
 	Waifu2x::eWaifu2xError ret;
 
 	Factor nowFactor = factor;
 
+	// mCYƊg𓯎ɍsꍇ́A̕{gŏ
+	if (isReconstructNoise && mHasNoiseScale)
+		nowFactor = nowFactor.MultiDenominator(mNoiseNet->GetInnerScale()); //nowFactor /= mNoiseNet->GetInnerScale();
+
+	const int scaleNum = isReconstructScale ? (int)ceil(log(nowFactor.toDouble()) / log(ScaleBase)) : 0;
+
 	if (isReconstructNoise)
 	{
+		// Ɋg傪΍Ō̉
+		mIsProgressPass = scaleNum <= 0;
+
 		if (!mHasNoiseScale) // mCY
 		{
+			TRACE_SCOPE_WAIFU2X("Waifu2x::ReconstructNoise");
+
 			cv::Mat im;
 			cv::Size_<int> size;
 			image.GetScalePaddingedRGB(im, size, mNoiseNet->GetNetOffset(), OuterPadding, crop_w, crop_h, 1);
+			mImageMemoryBase = image.GetMemorySize();
+
+			SetProgressStage(size, mNoiseNet->GetInnerScale(), use_tta);
 
 			ret = ReconstructByNet(mNoiseNet, crop_w, crop_h, use_tta, batch_size, cancel_func, im);
+			ClearProgressStage();
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
 
@@ -922,21 +1442,18 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructImage(const Factor factor, const int
 			ret = ReconstructNoiseScale(crop_w, crop_h, use_tta, batch_size, cancel_func, image);
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
-
-			//nowFactor /= mNoiseNet->GetInnerScale();
-			nowFactor = nowFactor.MultiDenominator(mNoiseNet->GetInnerScale());
 		}
 	}
 
 	if (cancel_func && cancel_func())
 		return Waifu2x::eWaifu2xError_Cancel;
 
-	const int scaleNum = ceil(log(nowFactor.toDouble()) / log(ScaleBase));
-
 	if (isReconstructScale)
 	{
 		for (int i = 0; i < scaleNum; i++)
 		{
+			mIsProgressPass = i == scaleNum - 1;
+
 			ret = ReconstructScale(crop_w, crop_h, use_tta, batch_size, cancel_func, image);
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
@@ -946,9 +1463,32 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructImage(const Factor factor, const int
 	return Waifu2x::eWaifu2xError_OK;
 }
 
+int Waifu2x::CalcNetScale(const Factor factor, const bool isReconstructNoise, const bool isReconstructScale) const
+{
+	// ReconstructImage()Ɠ񐔂g傷
+	int netScale = 1;
+	Factor nowFactor = factor;
+	if (isReconstructNoise && mHasNoiseScale)
+	{
+		netScale *= mNoiseNet->GetScale();
+		nowFactor = nowFactor.MultiDenominator(mNoiseNet->GetInnerScale());
+	}
+
+	if (isReconstructScale)
+	{
+		const int scaleNum = ceil(log(nowFactor.toDouble()) / log(ScaleBase));
+		for (int i = 0; i < scaleNum; i++)
+			netScale *= mScaleNet->GetScale();
+	}
+
+	return netScale;
+}
+
 Waifu2x::eWaifu2xError Waifu2x::ReconstructScale(const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 	const Waifu2x::waifu2xCancelFunc cancel_func, stImage &image)
 {
+	TRACE_SCOPE_WAIFU2X("Waifu2x::ReconstructScale");
+
 	Waifu2x::eWaifu2xError ret;
 
 	if (image.HasAlpha())
@@ -956,6 +1496,7 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructScale(const int crop_w, const int cro
 		cv::Mat im;
 		cv::Size_<int> size;
 		image.GetScalePaddingedA(im, size, mScaleNet->GetNetOffset(), OuterPadding, crop_w, crop_h, mScaleNet->GetScale() / mScaleNet->GetInnerScale());
+		mImageMemoryBase = image.GetMemorySize();
 
 		ret = ReconstructByNet(mScaleNet, crop_w, crop_h, use_tta, batch_size, cancel_func, im);
 		if (ret != Waifu2x::eWaifu2xError_OK)
@@ -967,8 +1508,12 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructScale(const int crop_w, const int cro
 	cv::Mat im;
 	cv::Size_<int> size;
 	image.GetScalePaddingedRGB(im, size, mScaleNet->GetNetOffset(), OuterPadding, crop_w, crop_h, mScaleNet->GetScale() / mScaleNet->GetInnerScale());
+	mImageMemoryBase = image.GetMemorySize();
+
+	SetProgressStage(size, mScaleNet->GetInnerScale(), use_tta);
 
 	ret = ReconstructByNet(mScaleNet, crop_w, crop_h, use_tta, batch_size, cancel_func, im);
+	ClearProgressStage();
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
 
@@ -980,6 +1525,8 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructScale(const int crop_w, const int cro
 Waifu2x::eWaifu2xError Waifu2x::ReconstructNoiseScale(const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 	const Waifu2x::waifu2xCancelFunc cancel_func, stImage &image)
 {
+	TRACE_SCOPE_WAIFU2X("Waifu2x::ReconstructNoiseScale");
+
 	Waifu2x::eWaifu2xError ret;
 
 	if (image.HasAlpha())
@@ -989,6 +1536,7 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructNoiseScale(const int crop_w, const in
 		cv::Mat im;
 		cv::Size_<int> size;
 		image.GetScalePaddingedA(im, size, mScaleNet->GetNetOffset(), OuterPadding, crop_w, crop_h, mScaleNet->GetScale() / mScaleNet->GetInnerScale());
+		mImageMemoryBase = image.GetMemorySize();
 
 		ret = ReconstructByNet(mScaleNet, crop_w, crop_h, use_tta, batch_size, cancel_func, im);
 		if (ret != Waifu2x::eWaifu2xError_OK)
@@ -1000,8 +1548,12 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructNoiseScale(const int crop_w, const in
 	cv::Mat im;
 	cv::Size_<int> size;
 	image.GetScalePaddingedRGB(im, size, mNoiseNet->GetNetOffset(), OuterPadding, crop_w, crop_h, mNoiseNet->GetScale() / mNoiseNet->GetInnerScale());
+	mImageMemoryBase = image.GetMemorySize();
+
+	SetProgressStage(size, mNoiseNet->GetInnerScale(), use_tta);
 
 	ret = ReconstructByNet(mNoiseNet, crop_w, crop_h, use_tta, batch_size, cancel_func, im);
+	ClearProgressStage();
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
 
@@ -1014,11 +1566,17 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructNoiseScale(const int crop_w, const in
 Waifu2x::eWaifu2xError Waifu2x::ReconstructByNet(std::shared_ptr<cNet> net, const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 	const Waifu2x::waifu2xCancelFunc cancel_func, cv::Mat &im)
 {
+	TRACE_SCOPE_WAIFU2X("Waifu2x::ReconstructByNet");
+
 	Waifu2x::eWaifu2xError ret;
 
+	// Ɨp摜̓lbg̓͂Əo͂1ATTȀꍇ͂ɕϊ̉摜ƍvp̉摜
+	const size_t workImageSize = im.total() * im.elemSize();
+	UpdateImageMemoryUsage(mImageMemoryBase + workImageSize * (use_tta ? 4 : 2));
+
 	if (!use_tta) // ʂɏ
 	{
-		ret = ProcessNet(net, crop_w, crop_h, use_tta, batch_size, im);
+		ret = ProcessNet(net, crop_w, crop_h, use_tta, batch_size, cancel_func, im);
 		if (ret != Waifu2x::eWaifu2xError_OK)
 			return ret;
 	}
@@ -1062,7 +1620,7 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructByNet(std::shared_ptr<cNet> net, cons
 			const int cw = (rotateNum % 2 == 0) ? crop_w : crop_h;
 			const int ch = (rotateNum % 2 == 0) ? crop_h : crop_w;
 
-			ret = ProcessNet(net, cw, ch, use_tta, batch_size, in);
+			ret = ProcessNet(net, cw, ch, use_tta, batch_size, cancel_func, in);
 			if (ret != Waifu2x::eWaifu2xError_OK)
 				return ret;
 
@@ -1085,7 +1643,8 @@ Waifu2x::eWaifu2xError Waifu2x::ReconstructByNet(std::shared_ptr<cNet> net, cons
 	return Waifu2x::eWaifu2xError_OK;
 }
 
-Waifu2x::eWaifu2xError Waifu2x::ProcessNet(std::shared_ptr<cNet> net, const int crop_w, const int crop_h, const bool use_tta, const int batch_size, cv::Mat &im)
+Waifu2x::eWaifu2xError Waifu2x::ProcessNet(std::shared_ptr<cNet> net, const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
+	const Waifu2x::waifu2xCancelFunc cancel_func, cv::Mat &im)
 {
 	Waifu2x::eWaifu2xError ret;
 
@@ -1101,22 +1660,520 @@ Waifu2x::eWaifu2xError Waifu2x::ProcessNet(std::shared_ptr<cNet> net, const int
 		}
 		else
 		{
-			SAFE_DELETE_WAIFU2X(mOutputBlock);
-			mOutputBlock = new float[OutputMemorySize];
+			mOutputBlockMat.release();
+			mOutputBlockMat.create(1, (int)OutputMemorySize, CV_32FC1);
+			mOutputBlock = (float *)mOutputBlockMat.data;
 		}
 
 		mOutputBlockSize = OutputMemorySize;
 	}
 
-	ret = net->ReconstructImage(use_tta, crop_w, crop_h, OuterPadding, batch_size, mOutputBlock, im, im);
+	// [J[Wu̎sXbhĂ΂(Init()XbhƈႤȂ)̂Ŗ񃂁[hݒ肷
+	SetCaffeMode();
+
+	std::function<cNet*(const int)> get_worker_net;
+	if (mTileScheduler)
+	{
+		cTileScheduler *scheduler = mTileScheduler;
+		const bool isNoiseNet = net == mNoiseNet;
+
+		// 񂾃[J[̃XbhŌĂ΂̂ŁÃ[J[̃CX^X̃lbgԂ
+		get_worker_net = [scheduler, isNoiseNet](const int worker_no) -> cNet*
+		{
+			const Waifu2x *w = (const Waifu2x *)scheduler->GetWorkerContext(worker_no);
+			if (!w || !w->mIsInited)
+				return nullptr;
+
+			w->SetCaffeMode();
+
+			return isNoiseNet ? w->mNoiseNet.get() : w->mScaleNet.get();
+		};
+	}
+
+	bool isProgressStage;
+	{
+		std::lock_guard<std::mutex> lock(mProgressMutex);
+		isProgressStage = mProgressFunc && mProgressStageSize.area() > 0;
+	}
+
+	std::function<void(const cv::Mat &, const cv::Rect &)> tile_func;
+	if (isProgressStage)
+		tile_func = [this](const cv::Mat &net_image, const cv::Rect &rect) { UpdateProgress(net_image, rect); };
+
+	ret = net->ReconstructImage(use_tta, crop_w, crop_h, OuterPadding, batch_size, mOutputBlock, cancel_func, g_TileSkipThreshold, im, im, mTileScheduler, get_worker_net, tile_func);
 	if (ret != Waifu2x::eWaifu2xError_OK)
 		return ret;
 
+	// blobReconstructImage()̒crop_w, crop_h, batch_sizeɍ킹Ċmۂ̂ŌĂяoɌv
+	UpdateNetMemoryUsage();
+
 	return Waifu2x::eWaifu2xError_OK;
 }
 
+void Waifu2x::BeginProgress(const stImage &image, const cv::Size_<int> &output_size)
+{
+	waifu2xProgressFunc func;
+	cv::Mat preview;
+
+	{
+		std::lock_guard<std::mutex> lock(mProgressMutex);
+
+		mProgressImage = image.CreatePreview(output_size);
+		mIsProgressPass = false;
+		mProgressStageSize = cv::Size_<int>();
+
+		// ̃[J[UpdateProgress()ŏނȂ̂ŁAn
+		func = mProgressFunc;
+		if (func)
+			preview = mProgressImage.clone();
+	}
+
+	CallProgressFunc(func, preview, cv::Rect(0, 0, preview.cols, preview.rows), preview.size(), true);
+}
+
+void Waifu2x::SetProgressStage(const cv::Size_<int> &size, const int inner_scale, const bool use_tta)
+{
+	std::lock_guard<std::mutex> lock(mProgressMutex);
+
+	// TTA8̕ς܂ŌʂoȂ̂œro߂m点Ȃ
+	if (mProgressFunc && mIsProgressPass && !use_tta)
+		mProgressStageSize = size * inner_scale;
+	else
+		mProgressStageSize = cv::Size_<int>();
+}
+
+void Waifu2x::ClearProgressStage()
+{
+	std::lock_guard<std::mutex> lock(mProgressMutex);
+
+	mProgressStageSize = cv::Size_<int>();
+}
+
+void Waifu2x::UpdateProgress(const cv::Mat &net_image, const cv::Rect &rect)
+{
+	TRACE_SCOPE_WAIFU2X("Waifu2x::UpdateProgress");
+
+	waifu2xProgressFunc func;
+	cv::Mat preview;
+	cv::Rect dst_rect;
+	cv::Size preview_size;
+
+	{
+		std::lock_guard<std::mutex> lock(mProgressMutex);
+
+		if (mProgressImage.empty() || mProgressStageSize.area() == 0)
+			return;
+
+		// ubNp̃pfBÔ͎̕Ă
+		const cv::Rect src_rect = rect & cv::Rect(0, 0, mProgressStageSize.width, mProgressStageSize.height);
+		if (src_rect.area() == 0)
+			return;
+
+		// o̓TCYɍ킹(Ō̏k̕)
+		const double ratio_x = (double)mProgressImage.cols / mProgressStageSize.width;
+		const double ratio_y = (double)mProgressImage.rows / mProgressStageSize.height;
+
+		const int x0 = (int)floor(src_rect.x * ratio_x);
+		const int y0 = (int)floor(src_rect.y * ratio_y);
+		const int x1 = std::min((int)ceil((src_rect.x + src_rect.width) * ratio_x), mProgressImage.cols);
+		const int y1 = std::min((int)ceil((src_rect.y + src_rect.height) * ratio_y), mProgressImage.rows);
+		if (x1 <= x0 || y1 <= y0)
+			return;
+
+		dst_rect = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+
+		cv::Mat patch;
+		if (dst_rect.size() == src_rect.size())
+			patch = net_image(src_rect);
+		else
+			cv::resize(net_image(src_rect), patch, dst_rect.size(), 0.0, 0.0, ratio_x < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+
+		cv::Mat dst = mProgressImage(dst_rect);
+		const int channel = mProgressImage.channels();
+
+		cv::Mat color; // 0`1BGRO[XP[
+		if (mInputPlane == 3) // RGBf
+			cv::cvtColor(patch, color, channel == 1 ? CV_RGB2GRAY : CV_RGB2BGR);
+		else if (channel == 1)
+			color = patch;
+		else // YfBF͓ro߂̉摜(oCL[rbNŊg債)̂̂g
+		{
+			cv::Mat bgr;
+			if (channel == 4)
+				cv::cvtColor(dst, bgr, CV_BGRA2BGR);
+			else
+				bgr = dst;
+
+			cv::Mat yuv;
+			bgr.convertTo(yuv, CV_32F, 1.0 / 255.0);
+			cv::cvtColor(yuv, yuv, CV_BGR2YUV);
+
+			std::vector<cv::Mat> planes;
+			cv::split(yuv, planes);
+			planes[0] = patch;
+			cv::merge(planes, yuv);
+
+			cv::cvtColor(yuv, color, CV_YUV2BGR);
+		}
+
+		cv::Mat color8;
+		color.convertTo(color8, CV_8U, 255.0);
+
+		if (channel == 4) // ͓ro߂̉摜̂̂c
+		{
+			const int from_to[] = {0, 0, 1, 1, 2, 2};
+			cv::mixChannels(&color8, 1, &dst, 1, from_to, 3);
+		}
+		else
+			color8.copyTo(dst);
+
+		// R[obNĂłԂɑ̃[J[܂Ȃ悤ɁAXV͈͂ēn
+		func = mProgressFunc;
+		preview = dst.clone();
+		preview_size = mProgressImage.size();
+	}
+
+	CallProgressFunc(func, preview, dst_rect, preview_size, true);
+}
+
+void Waifu2x::EndProgress(const cv::Mat &end_image)
+{
+	waifu2xProgressFunc func;
+
+	{
+		std::lock_guard<std::mutex> lock(mProgressMutex);
+
+		mProgressImage.release();
+		mIsProgressPass = false;
+		mProgressStageSize = cv::Size_<int>();
+
+		func = mProgressFunc;
+	}
+
+	const cv::Mat im = stImage::ConvertTo8bit(end_image);
+
+	CallProgressFunc(func, im, cv::Rect(0, 0, im.cols, im.rows), im.size(), false);
+}
+
+void Waifu2x::CallProgressFunc(const waifu2xProgressFunc &func, const cv::Mat &image, const cv::Rect &rect, const cv::Size &size, const bool is_preview)
+{
+	if (!func)
+		return;
+
+	std::lock_guard<std::mutex> lock(mProgressCallMutex);
+
+	func(image, rect, size, is_preview);
+}
+
+void Waifu2x::ResetMemoryUsage()
+{
+	mMemoryCurrent = stMemoryUsage();
+	mMemoryPeak = stMemoryUsage();
+	mMemoryEstimate = stMemoryUsage();
+	mImageMemoryBase = 0;
+}
+
+void Waifu2x::UpdateMemoryUsage()
+{
+	mMemoryCurrent.total = mMemoryCurrent.image + mMemoryCurrent.net_blob + mMemoryCurrent.output_block + mMemoryCurrent.col_buffer;
+
+	mMemoryPeak.image = std::max(mMemoryPeak.image, mMemoryCurrent.image);
+	mMemoryPeak.net_blob = std::max(mMemoryPeak.net_blob, mMemoryCurrent.net_blob);
+	mMemoryPeak.output_block = std::max(mMemoryPeak.output_block, mMemoryCurrent.output_block);
+	mMemoryPeak.col_buffer = std::max(mMemoryPeak.col_buffer, mMemoryCurrent.col_buffer);
+	mMemoryPeak.total = std::max(mMemoryPeak.total, mMemoryCurrent.total);
+
+	if (cTrace::IsEnabled())
+	{
+		static const char * const Keys[] = {"image", "net_blob", "output_block", "col_buffer", "total"};
+		const int64_t values[] = {(int64_t)mMemoryCurrent.image, (int64_t)mMemoryCurrent.net_blob, (int64_t)mMemoryCurrent.output_block,
+			(int64_t)mMemoryCurrent.col_buffer, (int64_t)mMemoryCurrent.total};
+
+		cTrace::AddCounter("memory", Keys, values, 5);
+	}
+}
+
+void Waifu2x::UpdateImageMemoryUsage(const size_t image_size)
+{
+	mMemoryCurrent.image = image_size;
+	UpdateMemoryUsage();
+}
+
+void Waifu2x::UpdateNetMemoryUsage()
+{
+	size_t blob = 0;
+	size_t col = 0;
+
+	// gĂȂlbgmۍς݂blob͉Ȃ̂ŗ
+	if (mNoiseNet)
+	{
+		blob += mNoiseNet->GetBlobMemorySize();
+		col += mNoiseNet->GetColBufferMemorySize();
+	}
+
+	if (mScaleNet && mScaleNet != mNoiseNet)
+	{
+		blob += mScaleNet->GetBlobMemorySize();
+		col += mScaleNet->GetColBufferMemorySize();
+	}
+
+	mMemoryCurrent.net_blob = blob;
+	mMemoryCurrent.col_buffer = col;
+
+	// CUDÂƂmOutputBlockSizeoCgACPÛƂfloatmOutputBlockSizemۂĂ
+	mMemoryCurrent.output_block = mIsCuda ? mOutputBlockSize : mOutputBlockSize * sizeof(float);
+
+	UpdateMemoryUsage();
+}
+
+Waifu2x::stMemoryUsage Waifu2x::EstimateMemoryUsage(const stImage &image, const Factor factor, const bool isReconstructNoise, const bool isReconstructScale,
+	const int crop_w, const int crop_h, const bool use_tta, const int batch_size, const int output_depth) const
+{
+	stMemoryUsage usage = stMemoryUsage();
+
+	// ReconstructImage()Ɠ2{̊gJԂ(mCYƊg𓯎ɍslbg1ڂ̊gƂĐ)
+	int scaleNum = 0;
+	if (isReconstructScale)
+		scaleNum = std::max((int)ceil(log(factor.toDouble()) / log(ScaleBase)), 0);
+	if (isReconstructNoise && mHasNoiseScale)
+		scaleNum = std::max(scaleNum, 1);
+
+	usage.image = image.EstimateMemorySize(mInputPlane, mMaxNetOffset, OuterPadding, crop_w, crop_h, scaleNum, use_tta, output_depth);
+
+	// UpdateNetMemoryUsage()ƓAgĂȂlbgmۍς݂blob͉Ȃ̂ŗ
+	int outputMemorySize = 0;
+	const cNet *netList[] = {mNoiseNet.get(), mScaleNet != mNoiseNet ? mScaleNet.get() : nullptr};
+	for (const auto net : netList)
+	{
+		if (!net)
+			continue;
+
+		usage.net_blob += net->EstimateBlobMemorySize(crop_w, crop_h, OuterPadding, batch_size);
+		usage.col_buffer += net->EstimateColBufferMemorySize(crop_w, crop_h, OuterPadding);
+		outputMemorySize = std::max(outputMemorySize, net->GetOutputMemorySize(crop_w, crop_h, OuterPadding, batch_size));
+	}
+
+	// o̓obt@͑傫ȂƂmۂ
+	const size_t outputBlockSize = std::max((size_t)outputMemorySize, mOutputBlockSize);
+	usage.output_block = mIsCuda ? outputBlockSize : outputBlockSize * sizeof(float);
+
+	usage.total = usage.image + usage.net_blob + usage.output_block + usage.col_buffer;
+
+	return usage;
+}
+
+void Waifu2x::SetCPUAutoTune(const bool enable)
+{
+	g_IsCPUAutoTuneEnabled = enable;
+}
+
+void Waifu2x::SetTileSkipThreshold(const double threshold)
+{
+	g_TileSkipThreshold = std::max(threshold, 0.0);
+}
+
+void Waifu2x::SetTiffStreamRows(const int rows)
+{
+	g_TiffStreamRows = std::max(rows, 0);
+}
+
+void Waifu2x::SetNpyPlanar(const bool planar)
+{
+	stImage::SetNpyPlanar(planar);
+}
+
+void Waifu2x::SetReducedDecode(const bool enable)
+{
+	g_IsReducedDecodeEnabled = enable;
+}
+
+void Waifu2x::SetThreadBudget(const int threads, const int worker_num)
+{
+	g_ThreadBudget = std::max(threads, 0);
+	g_ThreadBudgetWorkerNum = std::max(worker_num, 1);
+
+	const int num = CalcWorkerThreadNum();
+
+	// OpenCVOpenBLAS̃Xbh̐ݒ̓vZXŜŋLȂ̂ŁA[J[1ɂĂ
+	// (e[J[ɎgĂvthreadsɎ܂)
+	if (g_ThreadBudget > 0)
+		cv::setNumThreads(num);
+	else
+		cv::setNumThreads(-1); // OpenCṼftHgɖ߂
+
+	openblas_set_num_threads(num);
+}
+
+int Waifu2x::GetWorkerThreadNum()
+{
+	return CalcWorkerThreadNum();
+}
+
+bool Waifu2x::GetCPUTuneParam(int &crop_size, int &batch_size, int &threads) const
+{
+	if (mCPUTuneCropSize <= 0)
+		return false;
+
+	crop_size = mCPUTuneCropSize;
+	batch_size = mCPUTuneBatchSize;
+	threads = mCPUTuneThreads;
+
+	return true;
+}
+
+void Waifu2x::ApplyCPUTuneParam(const std::string &model_name)
+{
+	// lbg̍\̓fƃ[hŌ܂(mCYxł͕ςȂ)
+	const char *ModeNameList[] = {"noise", "scale", "noise_scale", "auto_scale"};
+	std::string key = model_name + " " + ModeNameList[mMode];
+
+	// Xbh𐧌ĂƂ͎Xbhς̂ŁAȂ̌ʂƂ͕ʂɕۑ
+	if (g_ThreadBudget > 0)
+		key += " threads=" + std::to_string(CalcWorkerThreadNum());
+
+	// ȂOpenBLAS̃XbhςȂ(GUIDLLgꍇ̃ftHg)
+	if (!g_IsCPUAutoTuneEnabled)
+		return;
+
+	CCPUTuneElement elm;
+	if (!g_CPUTuneData.Get(key, elm))
+	{
+		if (!TuneCPU(elm.crop_size, elm.batch_size, elm.threads))
+			return;
+
+		g_CPUTuneData.Set(key, elm);
+		g_CPUTuneData.Save();
+	}
+
+	mCPUTuneCropSize = elm.crop_size;
+	mCPUTuneBatchSize = elm.batch_size;
+	mCPUTuneThreads = elm.threads;
+
+	openblas_set_num_threads(std::min(mCPUTuneThreads, CalcWorkerThreadNum()));
+}
+
+bool Waifu2x::TuneCPU(int &crop_size, int &batch_size, int &threads)
+{
+	TRACE_SCOPE_WAIFU2X("Waifu2x::TuneCPU");
+
+	// ɈԎԂ̂͊gȂ̂Ŋgp̃lbgŌv
+	const std::shared_ptr<cNet> net = mScaleNet ? mScaleNet : mNoiseNet;
+	if (!net)
+		return false;
+
+	// TCYɂ炸炢̖ʐς1f̎Ԃׂ
+	const int MeasureArea = 256 * 256;
+
+	const auto Measure = [this, &net](const int crop, const int batch, const int thread_num)
+	{
+		openblas_set_num_threads(thread_num);
+
+		const int tiles = std::max(batch, (MeasureArea + crop * crop - 1) / (crop * crop));
+		const int padding = net->GetNetOffset() + OuterPadding;
+
+		cv::Mat org(crop + padding * 2, crop * tiles + padding * 2, CV_MAKETYPE(CV_32F, mInputPlane));
+		cv::randu(org, cv::Scalar::all(0.0), cv::Scalar::all(1.0));
+
+		double best = DBL_MAX;
+		for (int i = 0; i < 3; i++) // 1ڂ̓mۂ̂Ŏ̂Ă
+		{
+			cv::Mat im = org.clone();
+
+			const auto start = std::chrono::steady_clock::now();
+			if (ProcessNet(net, crop, crop, false, batch, nullptr, im) != Waifu2x::eWaifu2xError_OK)
+				return DBL_MAX;
+			const auto end = std::chrono::steady_clock::now();
+
+			if (i > 0)
+				best = std::min(best, std::chrono::duration<double>(end - start).count());
+		}
+
+		return best / ((double)tiles * crop * crop);
+	};
+
+	// SetThreadBudget()ŐĂ΃[J[1̃Xbh܂łȂ
+	const int cores = CalcWorkerThreadNum();
+
+	std::vector<int> threadList = {1, cores / 4, cores / 2, cores};
+	std::sort(threadList.begin(), threadList.end());
+	threadList.erase(std::unique(threadList.begin(), threadList.end()), threadList.end());
+	threadList.erase(std::remove(threadList.begin(), threadList.end(), 0), threadList.end());
+
+	const std::vector<int> cropList = GetCropSizeList();
+	const std::vector<int> batchList = {1, 2, 4};
+
+	// SĂ̑gݍ킹͎Ԃ肷̂ŁAXbhTCYob`TCY̏1߂
+	int bestCrop = std::find(cropList.begin(), cropList.end(), 128) != cropList.end() ? 128 : cropList[0];
+	int bestBatch = 1;
+	int bestThreads = cores;
+
+	double bestTime = DBL_MAX;
+	for (const auto t : threadList)
+	{
+		const double time = Measure(bestCrop, bestBatch, t);
+		if (time < bestTime)
+		{
+			bestTime = time;
+			bestThreads = t;
+		}
+	}
+
+	bestTime = DBL_MAX;
+	for (const auto c : cropList)
+	{
+		const double time = Measure(c, bestBatch, bestThreads);
+		if (time < bestTime)
+		{
+			bestTime = time;
+			bestCrop = c;
+		}
+	}
+
+	bestTime = DBL_MAX;
+	for (const auto b : batchList)
+	{
+		const double time = Measure(bestCrop, b, bestThreads);
+		if (time < bestTime)
+		{
+			bestTime = time;
+			bestBatch = b;
+		}
+	}
+
+	// vő傫mۂo̓obt@͉Ă
+	mOutputBlockMat.release();
+	mOutputBlock = nullptr;
+	mOutputBlockSize = 0;
+
+	if (bestTime == DBL_MAX)
+		return false;
+
+	crop_size = bestCrop;
+	batch_size = bestBatch;
+	threads = bestThreads;
+
+	return true;
+}
+
+const Waifu2x::stLoadTime& Waifu2x::GetLoadTime() const
+{
+	return mLoadTime;
+}
+
+const Waifu2x::stMemoryUsage& Waifu2x::GetPeakMemoryUsage() const
+{
+	return mMemoryPeak;
+}
+
+const Waifu2x::stMemoryUsage& Waifu2x::GetEstimatedMemoryUsage() const
+{
+	return mMemoryEstimate;
+}
+
 void Waifu2x::Destroy()
 {
+	SetTileScheduler(nullptr, -1);
+
 	CudaDeviceSet devset(mProcess, mGPUNo);
 
 	mNoiseNet.reset();
@@ -1128,12 +2185,43 @@ void Waifu2x::Destroy()
 	}
 	else
 	{
-		SAFE_DELETE_WAIFU2X(mOutputBlock);
+		mOutputBlockMat.release();
+		mOutputBlock = nullptr;
 	}
 
 	mIsInited = false;
 }
 
+void Waifu2x::SetTileScheduler(cTileScheduler *scheduler, const int worker_no)
+{
+	if (mTileScheduler)
+		mTileScheduler->SetWorkerContext(mTileWorkerNo, nullptr);
+
+	mTileScheduler = scheduler;
+	mTileWorkerNo = worker_no;
+
+	if (mTileScheduler)
+		mTileScheduler->SetWorkerContext(mTileWorkerNo, this);
+}
+
+void Waifu2x::SetProgressFunc(const waifu2xProgressFunc &func)
+{
+	std::lock_guard<std::mutex> lock(mProgressMutex);
+
+	mProgressFunc = func;
+}
+
+void Waifu2x::SetCaffeMode() const
+{
+	if (mIsCuda)
+	{
+		cudaSetDevice(mGPUNo);
+		caffe::Caffe::set_mode(caffe::Caffe::GPU);
+	}
+	else
+		caffe::Caffe::set_mode(caffe::Caffe::CPU);
+}
+
 const std::string& Waifu2x::used_process() const
 {
 	return mProcess;
@@ -5,6 +5,7 @@
 #include <vector>
 #include <utility>
 #include <functional>
+#include <mutex>
 #include <boost/shared_ptr.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
@@ -23,6 +24,7 @@ namespace caffe
 
 class cNet;
 class stImage;
+class cTileScheduler;
 
 
 class Factor
@@ -119,8 +121,47 @@ public:
 		eWaifu2xcuDNNError_CannotCreate,
 	};
 
+	// gp(oCgP)
+	struct stMemoryUsage
+	{
+		size_t image; // stImagẻ摜obt@ƕϊ̍Ɨp摜
+		size_t net_blob; // Caffeblob(ԏo͂Əd)
+		size_t output_block; // lbg̏o͂󂯎obt@(mOutputBlock)
+		size_t col_buffer; // Caffeim2colpobt@(C[ݒ肩̐l)
+		size_t total; // L̍v
+	};
+
+	// f̓ǂݍݕ@
+	enum eWaifu2xModelLoadPath
+	{
+		eWaifu2xModelLoadPath_Protobin = 0, // protobincaffemodelǂݍ
+		eWaifu2xModelLoadPath_Prototxt, // prototxtcaffemodelǂݍ(protobino)
+		eWaifu2xModelLoadPath_Json, // prototxtjsonǂݍ(protobincaffemodelo)
+	};
+
+	// f̓ǂݍ݂ɂ(b)
+	struct stLoadTime
+	{
+		eWaifu2xModelLoadPath path; // ̃lbgǂݍ񂾏ꍇ͈Ԓxǂݍݕ@
+		double info; // info.json̓ǂݍ
+		double parse; // ft@C̓ǂݍ݂Ɖ
+		double construct; // lbg̍\z
+		double weight_copy; // d݂̃Rs[
+		double write; // protobin, caffemodel̏o
+		double total; // Init()S
+	};
+
+	// trueԂƏ𒆒f
+	// ubNlbgɒʂтɌĂ΂̂ŁA̒ő҂ĂΑ̏ɏ邱Ƃł
 	typedef std::function<bool()> waifu2xCancelFunc;
 
+	// ro߂̉摜󂯎֐(SetProgressFunc()Q)
+	// image: ro߂̉摜rect͈̔(TCYrect.size())8bit̉摜(BGR(A)O[XP[)BĂяo̊ԂL
+	// rect: O񂩂XVꂽ͈
+	// size: ro߂̉摜Ŝ̃TCY(o̓TCY)
+	// is_preview: ro߂ȂtrueAŏIʂȂfalse
+	typedef std::function<void(const cv::Mat &image, const cv::Rect &rect, const cv::Size &size, const bool is_preview)> waifu2xProgressFunc;
+
 	static std::string ExeDir;
 
 private:
@@ -142,13 +183,38 @@ private:
 
 	float *mOutputBlock;
 	size_t mOutputBlockSize;
+	cv::Mat mOutputBlockMat; // CPÛƂmOutputBlock̎(傫cMatAllocatorŃq[Wy[WɊmۂ)
+
+	stLoadTime mLoadTime;
+
+	int mCPUTuneCropSize; // CPU̎(0Ȃ璲ĂȂ)
+	int mCPUTuneBatchSize;
+	int mCPUTuneThreads;
+
+	cTileScheduler *mTileScheduler; // o^ĂXPW[(o^ĂȂnullptr)
+	int mTileWorkerNo;
+
+	stMemoryUsage mMemoryCurrent; // ݂̃gp
+	stMemoryUsage mMemoryPeak; // ̃Wũgpʂ̃s[N
+	stMemoryUsage mMemoryEstimate; // ̃Wũgpʂ̃s[N̐l(\Z̗\Ɏg)
+	size_t mImageMemoryBase; // lbgɓnĂƗp摜ȊỎ摜obt@̃TCY
+
+	waifu2xProgressFunc mProgressFunc;
+	std::mutex mProgressMutex; // ubÑ͕[J[珑܂
+	std::mutex mProgressCallMutex; // R[obN𓯎ɌĂ΂Ȃ悤ɂ(mProgressMutex͎ɌĂԂ̂ŁAR[obNSetProgressFunc()Ăł悢)
+	cv::Mat mProgressImage; // ro߂̉摜
+	bool mIsProgressPass; // RGBlbgɒʂ̂Ō̉
+	cv::Size_<int> mProgressStageSize; // lbgɒʂĂ摜̃pfBOTCY(ro߂m点Ȃ͋)BmProgressMutexēǂݏ
 
 private:
 	static boost::filesystem::path GetModeDirPath(const boost::filesystem::path &model_dir);
 	static boost::filesystem::path GetInfoPath(const boost::filesystem::path &model_dir);
 
 	static Factor CalcScaleRatio(const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
-		const stImage &image);
+		const cv::Size_<int> &org_size);
+	// o͂摜̃TCY
+	static cv::Size_<int> CalcOutputSize(const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+		const cv::Size_<int> &org_size);
 
 	static int GetcuDNNAlgorithm(const char *layer_name, int num_input, int num_output, int batch_size,
 		int width, int height, int kernel_w, int kernel_h, int pad_w, int pad_h, int stride_w, int stride_h);
@@ -158,13 +224,69 @@ private:
 
 	Waifu2x::eWaifu2xError ReconstructImage(const Factor factor, const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 		const bool isReconstructNoise, const bool isReconstructScale, const Waifu2x::waifu2xCancelFunc cancel_func, stImage &image);
+	// ReconstructImage()Ńlbgg傷{
+	int CalcNetScale(const Factor factor, const bool isReconstructNoise, const bool isReconstructScale) const;
 	Waifu2x::eWaifu2xError ReconstructScale(const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 		const Waifu2x::waifu2xCancelFunc cancel_func, stImage &image);
 	Waifu2x::eWaifu2xError ReconstructNoiseScale(const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 		const Waifu2x::waifu2xCancelFunc cancel_func, stImage &image);
 	Waifu2x::eWaifu2xError ReconstructByNet(std::shared_ptr<cNet> net, const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
 		const Waifu2x::waifu2xCancelFunc cancel_func, cv::Mat &im);
-	Waifu2x::eWaifu2xError ProcessNet(std::shared_ptr<cNet> net, const int crop_w, const int crop_h, const bool use_tta, const int batch_size, cv::Mat &im);
+	Waifu2x::eWaifu2xError ProcessNet(std::shared_ptr<cNet> net, const int crop_w, const int crop_h, const bool use_tta, const int batch_size,
+		const Waifu2x::waifu2xCancelFunc cancel_func, cv::Mat &im);
+
+	Waifu2x::eWaifu2xError ProcessFile(const boost::filesystem::path &input_file, const boost::filesystem::path &output_file,
+		const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+		const waifu2xCancelFunc cancel_func, const int crop_w, const int crop_h,
+		const boost::optional<int> output_quality, const int output_depth, const bool use_tta,
+		const int batch_size);
+	// ͂яɕēǂݍ݁Ao͂^C`TIFFDZĨs~bhɏ݂Ȃ珈
+	// ͂ΉĂȂ`AŌɏkKvȔ{Ȃis_processedfalseɂĉȂ
+	Waifu2x::eWaifu2xError ProcessTiffStream(const boost::filesystem::path &input_file, const boost::filesystem::path &output_file,
+		const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+		const waifu2xCancelFunc cancel_func, const int crop_w, const int crop_h,
+		const boost::optional<int> output_quality, const int output_depth, const bool use_tta,
+		const int batch_size, bool &is_processed);
+	// Aj[V(GIF, APNG)̊et[̑Õt[ς͈͂āAAPNGɏ
+	// ͂Aj[VłȂis_processedfalseɂĉȂ
+	Waifu2x::eWaifu2xError ProcessAnimation(const boost::filesystem::path &input_file, const boost::filesystem::path &output_file,
+		const boost::optional<double> scale_ratio, const boost::optional<int> scale_width, const boost::optional<int> scale_height,
+		const waifu2xCancelFunc cancel_func, const int crop_w, const int crop_h, const int output_depth, const bool use_tta,
+		const int batch_size, bool &is_processed);
+	Waifu2x::eWaifu2xError ProcessBuffer(const double factor, const void* source, void* dest, const int width, const int height,
+		const int in_channel, const int in_stride, const int out_channel, const int out_stride,
+		const int crop_w, const int crop_h, const bool use_tta, const int batch_size, const int in_depth, const int out_depth);
+
+	// ʂcMetricsɋL^
+	static void RecordResultMetrics(const Waifu2x::eWaifu2xError ret);
+
+	// ĂяoXbhCaffẽ[hGPUݒ肷
+	void SetCaffeMode() const;
+
+	void ApplyCPUTuneParam(const std::string &model_name);
+	bool TuneCPU(int &crop_size, int &batch_size, int &threads);
+
+	void ResetMemoryUsage();
+	void UpdateMemoryUsage();
+	void UpdateImageMemoryUsage(const size_t image_size);
+	void UpdateNetMemoryUsage();
+
+	// ro߂̉摜oCL[rbNŊg債摜ŏĒm点
+	void BeginProgress(const stImage &image, const cv::Size_<int> &output_size);
+	// lbg̏o͉摜(pfBOTCYmProgressStageSize)rect͈̔͂ro߂̉摜ɏŒm点
+	void UpdateProgress(const cv::Mat &net_image, const cv::Rect &rect);
+	// ŏIʂm点
+	void EndProgress(const cv::Mat &end_image);
+	// mProgressMutex̊OŃR[obNĂ(funcmProgressMutexĂԂɃRs[Aimage͑̃XbhȂ̂n)
+	void CallProgressFunc(const waifu2xProgressFunc &func, const cv::Mat &image, const cv::Rect &rect, const cv::Size &size, const bool is_preview);
+	// RGBlbgɒʂOɌĂԁBŌ̉Ȃsize * inner_scalero߂m点TCYɂ
+	void SetProgressStage(const cv::Size_<int> &size, const int inner_scale, const bool use_tta);
+	// lbgɒʂIĂ(ȍ~̃ubN͓ro߂̉摜ɏ܂Ȃ)
+	void ClearProgressStage();
+
+	// Load()摜Ƃ̃gpʂ̃s[N𐄒肷
+	stMemoryUsage EstimateMemoryUsage(const stImage &image, const Factor factor, const bool isReconstructNoise, const bool isReconstructScale,
+		const int crop_w, const int crop_h, const bool use_tta, const int batch_size, const int output_depth) const;
 
 public:
 	Waifu2x();
@@ -193,14 +315,72 @@ public:
 	// dest: (4`l̏ꍇ)RGBAȉfz
 	// in_stride: sourcẽXgCh(oCgP)
 	// out_stride: dest̃XgCh(oCgP)
+	// in_depth, out_depth: source, dest1`l̃rbg(8, 16, 32(_A0`1)̂ǂꂩ)
+	// 8bitoRɁAsource𒼐ڃlbǧ`ɕϊAʂ𒼐destɏ
 	eWaifu2xError waifu2x(const double factor, const void* source, void* dest, const int width, const int height,
 		const int in_channel, const int in_stride, const int out_channel, const int out_stride,
-		const int crop_w = 128, const int crop_h = 128,  const bool use_tta = false, const int batch_size = 1);
+		const int crop_w = 128, const int crop_h = 128,  const bool use_tta = false, const int batch_size = 1,
+		const int in_depth = 8, const int out_depth = 8);
 
 	void Destroy();
 
 	const std::string& used_process() const;
 
+	// CPUŏƂA߂ĎgfECPȖgݍ킹ȂInit()ŕTCYAob`TCYAXbhvĕۑ(ftHg͖)
+	// vς݂ȂInit()Ōvʂ̃Xbhݒ肳BȂvvʂ̓KpȂ
+	static void SetCPUAutoTune(const bool enable);
+
+	// ׂ(ׂ荇f̍̓敽ς̕Afl0`1)threshold̃ubNɈ͂܂ꂽubŃA
+	// lbgɒʂɃoCL[rbNŊg傷B0ȂSălbgɒʂ(ftHg)
+	// mCỸlbgł́Â܂܎gƌpڂł̂őSălbgɒʂ
+	// Rȕ̑摜őȂ邪A掿͏
+	static void SetTileSkipThreshold(const double threshold);
+
+	// ͂TIFFŏo͂TIFFDZȈꍇA͂rowss̑тɕĕKvȕǂݍ݁Ao͂̓^C`TIFFDZĨs~bhɑтƂɏ(0Ȃ番ȂBftHg0)
+	// 摜ŜɎȂ̂ŋȉ摜łBlbg̊g嗦̂܂܂̔{(ŌɏkȂ{)̏ꍇď
+	static void SetTiffStreamRows(const int rows);
+
+	// o͂NPY̏ꍇA`lƂ̖ʂׂ(C, H, W)̌`ŕۑ(falseȂ(H, W, C)BftHgfalse)
+	// o͂PFMNPY̏ꍇoutput_depthɊւ炸_̂܂(0`1ɃNbsO邾ŗʎq)ۑ
+	static void SetNpyPlanar(const bool planar);
+
+	// o͂͂1/2ȉɂȂg嗦(k)̏ꍇAJPEGDCT̒iK1/2, 1/4, 1/8ɏkăfR[h(ftHg͗L)
+	// kTCYo͂̃TCYȂ͈͂ňԏfR[ĥŁAlbgɒʂf
+	static void SetReducedDecode(const bool enable);
+
+	// vZXŜŕ񏈗ɎgXbh̏ݒ肷(0Ȃ琧ȂBftHg0)
+	// threadsworker_numŕOpenCV(cv::setNumThreads)BLAS̃XbhɂBCPU̎ʂ̃Xbh𒴂Ȃ
+	// Init()̑OɌĂԂ
+	static void SetThreadBudget(const int threads, const int worker_num = 1);
+
+	// [J[1񏈗ɎgXbh
+	static int GetWorkerThreadNum();
+
+	// CPU̎ʂ擾BĂȂfalse
+	bool GetCPUTuneParam(int &crop_size, int &batch_size, int &threads) const;
+
+	// XPW[worker_noԖڂ̃[J[Ƃēo^(nullptrœo^)
+	// o^ƃ[J[̃XbhŏƂɃ^C𑼂̃[J[ɂÃ[J[̃^C̃CX^X̃lbgŏ
+	// XPW[ɓo^CX^X͑SēݒInit()邱
+	void SetTileScheduler(cTileScheduler *scheduler, const int worker_no);
+
+	// ɓro߂̉摜m点֐ݒ肷(nullptrŉ)
+	// ŏɓ͂oCL[rbNŊg債摜AŌ̃lbg̏̓ubNI邽тɂ̕u摜A
+	// ŌɍŏIʂnČĂ(TTÂƂ͍ŏƍŌゾ)BubN݂̏̓[J[̃XbhĂ΂邱Ƃ
+	void SetProgressFunc(const waifu2xProgressFunc &func);
+
+	// Init()Ńf̓ǂݍ݂ɂ
+	const stLoadTime& GetLoadTime() const;
+
+	// ŌɏWũgpʂ̃s[N(ڂƂ̃s[Nƍṽs[N)
+	const stMemoryUsage& GetPeakMemoryUsage() const;
+
+	// ŌɏWũgpʂ̃s[N̐l(Oɉ摜̃TCYƐݒ肩狁߂)
+	const stMemoryUsage& GetEstimatedMemoryUsage() const;
+
+	// G[̖O("OK", "FailedOpenInputFile"ȂǁBṽxɂg)
+	static const char* GetErrorName(const eWaifu2xError ret);
+
 	static std::string GetModelName(const boost::filesystem::path &model_dir);
 	static bool GetInfo(const boost::filesystem::path &model_dir, stInfo &info);
 };
@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <memory>
+#include <opencv2/imgproc.hpp>
 #include "../common/waifu2x.h"
+#include "../common/cMetrics.h"
+#include "../common/cMemoryBudget.h"
+#include "../common/cMatAllocator.h"
 
 
 __declspec(dllexport)
@@ -73,7 +79,185 @@ bool Waifu2xProcessNew(void *waifu2xObj, double factor, const void* source, void
 
 	Waifu2x *obj = (Waifu2x *)waifu2xObj;
 
-	return obj->waifu2x(factor, source, dest, width, height, in_channel, in_stride, out_channel, out_stride, crop_w, crop_h, use_tta, batch_size) == Waifu2x::eWaifu2xError_OK;
+	return obj->waifu2x(factor, source, dest, width, height, in_channel, in_stride, out_channel, out_stride, crop_w, crop_h, use_tta, batch_size,
+		8, output_depth) == Waifu2x::eWaifu2xError_OK;
+}
+
+// 16bit, 32bit_̉fẑ܂܏
+// in_depth, out_depth: source, dest1`l̃rbg(8, 16, 32̂ǂꂩB320`1̕_)
+// in_stride, out_stride: XgCh(oCgP)
+__declspec(dllexport)
+bool Waifu2xProcessDepth(void *waifu2xObj, double factor, const void* source, void* dest, int width, int height,
+	int in_channel, int in_depth, int in_stride, int out_channel, int out_depth, int out_stride,
+	bool use_tta = false, int crop_w = 128, int crop_h = 128, int batch_size = 1)
+{
+	if (!waifu2xObj)
+		return false;
+
+	Waifu2x *obj = (Waifu2x *)waifu2xObj;
+
+	return obj->waifu2x(factor, source, dest, width, height, in_channel, in_stride, out_channel, out_stride, crop_w, crop_h, use_tta, batch_size,
+		in_depth, out_depth) == Waifu2x::eWaifu2xError_OK;
+}
+
+// Ōɏ摜̃gpʂ̃s[N(oCgP)擾
+// 擾ȂڂɂNULLn
+__declspec(dllexport)
+bool Waifu2xGetPeakMemoryUsage(void *waifu2xObj, size_t *image, size_t *net_blob, size_t *output_block, size_t *col_buffer, size_t *total)
+{
+	if (!waifu2xObj)
+		return false;
+
+	Waifu2x *obj = (Waifu2x *)waifu2xObj;
+
+	const auto &usage = obj->GetPeakMemoryUsage();
+	if (image)
+		*image = usage.image;
+	if (net_blob)
+		*net_blob = usage.net_blob;
+	if (output_block)
+		*output_block = usage.output_block;
+	if (col_buffer)
+		*col_buffer = usage.col_buffer;
+	if (total)
+		*total = usage.total;
+
+	return true;
+}
+
+// ro߂̉摜󂯎R[obN
+// image: o̓TCỶfz(`l͓͂ƓA4`lȂRGBA)BĂяo̊ԂL
+// stride: imagẽXgCh(oCgP)
+// x, y, w, h: O񂩂XVꂽ͈
+// is_preview: ro߂ȂtrueAŏIʂȂfalse
+typedef void (*Waifu2xProgressCallback)(const void *image, int width, int height, int channel, int stride,
+	int x, int y, int w, int h, bool is_preview, void *user);
+
+// Waifu2xProcess()̏ɓro߂̉摜m点R[obNݒ肷(NULLŉ)
+// ŏɓ͂oCL[rbNŊg債摜AIubNu摜AŏIʂ̏ɌĂ΂
+__declspec(dllexport)
+bool Waifu2xSetProgressCallback(void *waifu2xObj, Waifu2xProgressCallback callback, void *user)
+{
+	if (!waifu2xObj)
+		return false;
+
+	Waifu2x *obj = (Waifu2x *)waifu2xObj;
+
+	if (!callback)
+	{
+		obj->SetProgressFunc(nullptr);
+		return true;
+	}
+
+	// XVꂽ͈͂RGBɕϊāAϊς݂̉摜n
+	std::shared_ptr<cv::Mat> rgb = std::make_shared<cv::Mat>();
+	obj->SetProgressFunc([callback, user, rgb](const cv::Mat &image, const cv::Rect &rect, const cv::Size &size, const bool is_preview)
+	{
+		if (rgb->size() != size || rgb->type() != image.type())
+			rgb->create(size, image.type());
+
+		cv::Mat dst = (*rgb)(rect);
+		if (image.channels() == 3)
+			cv::cvtColor(image, dst, CV_BGR2RGB);
+		else if (image.channels() == 4)
+			cv::cvtColor(image, dst, CV_BGRA2RGBA);
+		else
+			image.copyTo(dst);
+
+		callback(rgb->data, rgb->cols, rgb->rows, rgb->channels(), (int)rgb->step, rect.x, rect.y, rect.width, rect.height, is_preview, user);
+
+		if (!is_preview)
+			rgb->release();
+	});
+
+	return true;
+}
+
+// vPrometheus̃eLXg`Ŏ擾
+// I[܂߂KvȃoCgԂBbufNULL܂sizeȂꍇ͏܂Ȃ
+__declspec(dllexport)
+size_t Waifu2xGetMetricsText(char *buf, size_t size)
+{
+	const std::string text = cMetrics::ToPrometheusText();
+	const size_t needSize = text.size() + 1;
+
+	if (buf && size >= needSize)
+		memcpy(buf, text.c_str(), needSize);
+
+	return needSize;
+}
+
+// JE^̒l擾
+// labels: Ⴆ "error=\"FailedOpenInputFile\""BxꍇNULL󕶎
+__declspec(dllexport)
+int64_t Waifu2xGetMetricCounter(const char *name, const char *labels)
+{
+	if (!name)
+		return 0;
+
+	return cMetrics::GetCounter(name, labels ? labels : "");
+}
+
+// voXbhJn(interval_secbƂoutput_fileu)
+// output_fileNULLnƃXbhI
+__declspec(dllexport)
+void Waifu2xSetMetricsFile(const char *output_file, int interval_sec)
+{
+	if (!output_file)
+		cMetrics::StopExporter();
+	else
+		cMetrics::StartExporter(output_file, interval_sec);
+}
+
+// 񏈗ɎgXbh̏ݒ肷(0Ȃ琧Ȃ)
+// ̃XbhłꂼWaifu2xProcess()Ăԏꍇworker_numɂ̐n
+// Waifu2xInit()̑OɌĂԂ
+__declspec(dllexport)
+void Waifu2xSetThreadBudget(int threads, int worker_num)
+{
+	Waifu2x::SetThreadBudget(threads, worker_num);
+}
+
+// CPUŏƂAœKȕTCYAob`TCYAXbhvĎg(ftHg͖)
+// ߂Ďgfł͌vɐbBʂcpu_tune_datatH_ɕۑA񂩂͂̂܂܎g
+// Waifu2xInit()̑OɌĂԂ
+__declspec(dllexport)
+void Waifu2xSetCPUAutoTune(bool enable)
+{
+	Waifu2x::SetCPUAutoTune(enable);
+}
+
+// ɏ摜g̍v̏(MBPʁA0Ȃ琧Ȃ)
+// 𒴂ꍇAWaifu2xProcess()͑̃Xbh̏I܂ő҂
+__declspec(dllexport)
+void Waifu2xSetMemoryBudget(int megabytes)
+{
+	cMemoryBudget::SetLimit((size_t)std::max(megabytes, 0) * 1024 * 1024);
+}
+
+// megabytes MBȏ̒ԉ摜scratch_dirɍꎞt@C}bv̈Ɋmۂ
+// scratch_dirNULLnƕʂ̃ɖ߂
+__declspec(dllexport)
+void Waifu2xSetScratchStorage(const char *scratch_dir, int megabytes)
+{
+	if (!scratch_dir)
+		cMatAllocator::Disable();
+	else
+		cMatAllocator::Enable(scratch_dir, (size_t)std::max(megabytes, 1) * 1024 * 1024);
+}
+
+// megabytes MBȏ̉摜Əo̓obt@q[Wy[WɊmۂ
+// mode: 0ȂgȂA1ȂTransparent Huge Pages(Linux̂)A2Ȃ\񂳂ꂽq[Wy[W(WindowsSeLockMemoryPrivilegeKv)
+__declspec(dllexport)
+void Waifu2xSetHugePages(int mode, int megabytes)
+{
+	cMatAllocator::eHugePageMode m = cMatAllocator::eHugePageModeNone;
+	if (mode == 1)
+		m = cMatAllocator::eHugePageModeTransparent;
+	else if (mode == 2)
+		m = cMatAllocator::eHugePageModeExplicit;
+
+	cMatAllocator::SetHugePages(m, (size_t)std::max(megabytes, 0) * 1024 * 1024);
 }
 
 __declspec(dllexport)
@@ -89,5 +273,6 @@ void Waifu2xDestory(void *waifu2xObj)
 __declspec(dllexport)
 void Waifu2xGlobalDestroy()
 {
+	cMetrics::StopExporter();
 	Waifu2x::quit_liblary();
 }
@@ -1,13 +1,30 @@
 #include <stdio.h>
 #include <algorithm>
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
 #include <functional>
 #include <boost/tokenizer.hpp>
 #include <boost/tokenizer.hpp>
 #include <glog/logging.h>
 #include <codecvt>
+#include <memory>
+#include <mutex>
+#include <iostream>
+#include <map>
+#include <cmath>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
 #include "../common/waifu2x.h"
+#include "../common/stImage.h"
+#include "../common/cTrace.h"
+#include "../common/cMetrics.h"
+#include "../common/cTileScheduler.h"
+#include "../common/cJobScheduler.h"
+#include "../common/cMemoryBudget.h"
+#include "../common/cWriterPool.h"
+#include "../common/cMatAllocator.h"
 
 #if defined(UNICODE) && defined(_WIN32)
 #define WIN_UNICODE
@@ -24,6 +41,7 @@ typedef wchar_t TCHAR;
 #define totlower towlower
 #define to_tstring std::to_wstring
 #define tprintf wprintf
+#define tfprintf fwprintf
 #define CHAR_STR_FORMAT L"%S"
 
 const tstring& path_to_tstring(const boost::filesystem::path &p)
@@ -41,6 +59,7 @@ typedef char TCHAR;
 #define totlower tolower
 #define to_tstring std::to_string
 #define tprintf printf
+#define tfprintf fprintf
 #define CHAR_STR_FORMAT "%s"
 
 const tstring& path_to_tstring(const boost::filesystem::path &p)
@@ -111,7 +130,7 @@ int main(int argc, char** argv)
 	CmdLine cmd(TEXT("waifu2x reimplementation using Caffe"), ' ', TEXT("1.0.0"));
 
 	ValueArg<tstring> cmdInputFile(TEXT("i"), TEXT("input_path"),
-		TEXT("path to input image file"), true, TEXT(""),
+		TEXT("path to input image file (not required in daemon mode)"), false, TEXT(""),
 		TEXT("string"), cmd);
 
 	ValueArg<tstring> cmdOutputFile(TEXT("o"), TEXT("output_path"),
@@ -200,6 +219,149 @@ int main(int argc, char** argv)
 	ValueArg<int> cmdTTALevel(TEXT("t"), TEXT("tta"), TEXT("8x slower and slightly high quality"),
 		false, 0, &cmdTTAConstraint, cmd);
 
+	ValueArg<tstring> cmdTraceFile(TEXT(""), TEXT("trace"),
+		TEXT("path to output Chrome trace-event file (view in chrome://tracing or Perfetto)"), false,
+		TEXT(""), TEXT("string"), cmd);
+
+	std::vector<int> cmdReportMemoryConstraintV;
+	cmdReportMemoryConstraintV.push_back(0);
+	cmdReportMemoryConstraintV.push_back(1);
+	ValuesConstraint<int> cmdReportMemoryConstraint(cmdReportMemoryConstraintV);
+	ValueArg<int> cmdReportMemory(TEXT(""), TEXT("report_memory"), TEXT("print peak memory usage of each image"),
+		false, 0, &cmdReportMemoryConstraint, cmd);
+
+	std::vector<int> cmdReportLoadTimeConstraintV;
+	cmdReportLoadTimeConstraintV.push_back(0);
+	cmdReportLoadTimeConstraintV.push_back(1);
+	ValuesConstraint<int> cmdReportLoadTimeConstraint(cmdReportLoadTimeConstraintV);
+	ValueArg<int> cmdReportLoadTime(TEXT(""), TEXT("report_load_time"), TEXT("print time taken to load models"),
+		false, 0, &cmdReportLoadTimeConstraint, cmd);
+
+	std::vector<int> cmdCPUAutoTuneConstraintV;
+	cmdCPUAutoTuneConstraintV.push_back(0);
+	cmdCPUAutoTuneConstraintV.push_back(1);
+	ValuesConstraint<int> cmdCPUAutoTuneConstraint(cmdCPUAutoTuneConstraintV);
+	ValueArg<int> cmdCPUAutoTune(TEXT(""), TEXT("cpu_autotune"), TEXT("measure and use best crop size, batch size and thread count on CPU"),
+		false, 0, &cmdCPUAutoTuneConstraint, cmd);
+
+	ValueArg<tstring> cmdMetricsFile(TEXT(""), TEXT("metrics_file"),
+		TEXT("path to output metrics in Prometheus text format (for node_exporter textfile collector)"), false,
+		TEXT(""), TEXT("string"), cmd);
+
+	ValueArg<int> cmdMetricsInterval(TEXT(""), TEXT("metrics_interval"),
+		TEXT("interval in seconds to update metrics file"), false,
+		10, TEXT("int"), cmd);
+
+	ValueArg<int> cmdWorkers(TEXT(""), TEXT("workers"),
+		TEXT("number of worker threads (each worker loads its own network and idle workers help with tiles of other images)"), false,
+		1, TEXT("int"), cmd);
+
+	ValueArg<int> cmdThreads(TEXT(""), TEXT("threads"),
+		TEXT("total number of threads used by OpenCV, BLAS and workers (0: no limit)"), false,
+		0, TEXT("int"), cmd);
+
+	std::vector<int> cmdNumaConstraintV;
+	cmdNumaConstraintV.push_back(0);
+	cmdNumaConstraintV.push_back(1);
+	ValuesConstraint<int> cmdNumaConstraint(cmdNumaConstraintV);
+	ValueArg<int> cmdNuma(TEXT(""), TEXT("numa"), TEXT("bind each worker and its network to a NUMA node"),
+		false, 0, &cmdNumaConstraint, cmd);
+
+	ValueArg<double> cmdTileSkipThreshold(TEXT(""), TEXT("tile_skip_threshold"),
+		TEXT("tiles surrounded by tiles with detail (RMS of neighbouring pixel difference) below this are upscaled by bicubic instead of the network (0: disabled)"), false,
+		0.0, TEXT("double"), cmd);
+
+	ValueArg<int> cmdTiffStreamRows(TEXT(""), TEXT("tiff_stream_rows"),
+		TEXT("process TIFF input in bands of this many rows and write a tiled TIFF while processing (0: disabled)"), false,
+		0, TEXT("int"), cmd);
+
+	std::vector<int> cmdNpyPlanarConstraintV;
+	cmdNpyPlanarConstraintV.push_back(0);
+	cmdNpyPlanarConstraintV.push_back(1);
+	ValuesConstraint<int> cmdNpyPlanarConstraint(cmdNpyPlanarConstraintV);
+	ValueArg<int> cmdNpyPlanar(TEXT(""), TEXT("npy_planar"), TEXT("write .npy output as planar (C, H, W) instead of (H, W, C)"),
+		false, 0, &cmdNpyPlanarConstraint, cmd);
+
+	std::vector<int> cmdReducedDecodeConstraintV;
+	cmdReducedDecodeConstraintV.push_back(0);
+	cmdReducedDecodeConstraintV.push_back(1);
+	ValuesConstraint<int> cmdReducedDecodeConstraint(cmdReducedDecodeConstraintV);
+	ValueArg<int> cmdReducedDecode(TEXT(""), TEXT("reduced_decode"), TEXT("decode JPEG at 1/2, 1/4 or 1/8 size when the output is that much smaller"),
+		false, 1, &cmdReducedDecodeConstraint, cmd);
+
+	std::vector<tstring> cmdEncodePresetConstraintV;
+	cmdEncodePresetConstraintV.push_back(TEXT("default"));
+	cmdEncodePresetConstraintV.push_back(TEXT("fast"));
+	cmdEncodePresetConstraintV.push_back(TEXT("balanced"));
+	cmdEncodePresetConstraintV.push_back(TEXT("small"));
+	ValuesConstraint<tstring> cmdEncodePresetConstraint(cmdEncodePresetConstraintV);
+	ValueArg<tstring> cmdEncodePreset(TEXT(""), TEXT("encode_preset"), TEXT("PNG and JPEG encoder settings (fast: fastest encode, small: smallest file)"),
+		false, TEXT("default"), &cmdEncodePresetConstraint, cmd);
+
+	std::vector<tstring> cmdJpegSamplingConstraintV;
+	cmdJpegSamplingConstraintV.push_back(TEXT("default"));
+	cmdJpegSamplingConstraintV.push_back(TEXT("420"));
+	cmdJpegSamplingConstraintV.push_back(TEXT("422"));
+	cmdJpegSamplingConstraintV.push_back(TEXT("444"));
+	ValuesConstraint<tstring> cmdJpegSamplingConstraint(cmdJpegSamplingConstraintV);
+	ValueArg<tstring> cmdJpegSampling(TEXT(""), TEXT("jpeg_sampling"), TEXT("chroma subsampling of JPEG output"),
+		false, TEXT("default"), &cmdJpegSamplingConstraint, cmd);
+
+	ValueArg<int> cmdWriterThreads(TEXT(""), TEXT("writer_threads"),
+		TEXT("number of threads that write output files while the next image is processed (0: write in the processing thread)"), false,
+		0, TEXT("int"), cmd);
+
+	ValueArg<int> cmdWriterQueue(TEXT(""), TEXT("writer_queue"),
+		TEXT("number of encoded images that may wait for the writer threads"), false,
+		16, TEXT("int"), cmd);
+
+	std::vector<tstring> cmdFsyncConstraintV;
+	cmdFsyncConstraintV.push_back(TEXT("none"));
+	cmdFsyncConstraintV.push_back(TEXT("file"));
+	cmdFsyncConstraintV.push_back(TEXT("dir"));
+	ValuesConstraint<tstring> cmdFsyncConstraint(cmdFsyncConstraintV);
+	ValueArg<tstring> cmdFsync(TEXT(""), TEXT("fsync"), TEXT("flush output files (file) and their directory (dir) to disk before reporting them written"),
+		false, TEXT("none"), &cmdFsyncConstraint, cmd);
+
+	std::vector<int> cmdDirectIOConstraintV;
+	cmdDirectIOConstraintV.push_back(0);
+	cmdDirectIOConstraintV.push_back(1);
+	ValuesConstraint<int> cmdDirectIOConstraint(cmdDirectIOConstraintV);
+	ValueArg<int> cmdDirectIO(TEXT(""), TEXT("direct_io"), TEXT("write output files bypassing the OS cache in large aligned blocks"),
+		false, 0, &cmdDirectIOConstraint, cmd);
+
+	ValueArg<int> cmdMemoryBudget(TEXT(""), TEXT("memory_budget"),
+		TEXT("total memory in MB that images processed at the same time may use (0: no limit)"), false,
+		0, TEXT("int"), cmd);
+
+	ValueArg<tstring> cmdScratchDir(TEXT(""), TEXT("scratch_dir"),
+		TEXT("folder for memory-mapped temporary files that hold large intermediate images (fast local SSD recommended)"), false,
+		TEXT(""), TEXT("string"), cmd);
+
+	ValueArg<int> cmdScratchThreshold(TEXT(""), TEXT("scratch_threshold"),
+		TEXT("intermediate images of at least this many MB are placed in --scratch_dir"), false,
+		256, TEXT("int"), cmd);
+
+	std::vector<tstring> cmdHugePagesConstraintV;
+	cmdHugePagesConstraintV.push_back(TEXT("none"));
+	cmdHugePagesConstraintV.push_back(TEXT("thp"));
+	cmdHugePagesConstraintV.push_back(TEXT("explicit"));
+	ValuesConstraint<tstring> cmdHugePagesConstraint(cmdHugePagesConstraintV);
+	ValueArg<tstring> cmdHugePages(TEXT(""), TEXT("huge_pages"),
+		TEXT("allocate large image and output buffers in transparent (thp) or reserved (explicit) huge pages"),
+		false, TEXT("none"), &cmdHugePagesConstraint, cmd);
+
+	ValueArg<int> cmdHugePageThreshold(TEXT(""), TEXT("huge_page_threshold"),
+		TEXT("buffers of at least this many MB are allocated in huge pages"), false,
+		16, TEXT("int"), cmd);
+
+	std::vector<int> cmdDaemonConstraintV;
+	cmdDaemonConstraintV.push_back(0);
+	cmdDaemonConstraintV.push_back(1);
+	ValuesConstraint<int> cmdDaemonConstraint(cmdDaemonConstraintV);
+	ValueArg<int> cmdDaemon(TEXT(""), TEXT("daemon"), TEXT("read JSON requests from stdin and process them by priority and deadline"),
+		false, 0, &cmdDaemonConstraint, cmd);
+
 	// definition of command line argument : end
 
 	Arg::enableIgnoreMismatched();
@@ -222,6 +384,22 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
+	const bool is_daemon = cmdDaemon.getValue() == 1;
+
+	// f[[h̃[J[͗DxƂ1Ȃ̂--workers͎gȂB--threads͂̐̃[J[ŕ
+	// (Wo͂͌ʂԂ̂ɎĝŕWG[o͂ɕ\)
+	if (is_daemon && cmdWorkers.isSet())
+		tfprintf(stderr, TEXT("x: --daemonw肵ꍇA--workers͖܂([J[͗DxƂ1ł)\n"));
+	if (is_daemon && cmdThreads.isSet() && cmdThreads.getValue() > 0 && cmdThreads.getValue() < cJobScheduler::ePriorityNum)
+		tfprintf(stderr, TEXT("x: --daemonw肵ꍇA[J[%d̂ŁA--threads%dł[J[Ƃ1Xbh͎g܂\n"),
+			(int)cJobScheduler::ePriorityNum, (int)cJobScheduler::ePriorityNum);
+
+	if (!is_daemon && !cmdInputFile.isSet())
+	{
+		tprintf(TEXT("G[: ̓pX(-i)w肳Ă܂\n"));
+		return 1;
+	}
+
 	boost::optional<double> ScaleRatio;
 	boost::optional<int> ScaleWidth;
 	boost::optional<int> ScaleHeight;
@@ -265,7 +443,11 @@ int main(int argc, char** argv)
 	const bool use_tta = cmdTTALevel.getValue() == 1;
 
 	std::vector<std::pair<tstring, tstring>> file_paths;
-	if (boost::filesystem::is_directory(input_path)) // input_pathtH_Ȃ炻̃fBNgȉ̉摜t@Cꊇϊ
+	if (is_daemon)
+	{
+		// t@C͕W͂󂯎
+	}
+	else if (boost::filesystem::is_directory(input_path)) // input_pathtH_Ȃ炻̃fBNgȉ̉摜t@Cꊇϊ
 	{
 		boost::filesystem::path output_path;
 
@@ -433,8 +615,84 @@ int main(int argc, char** argv)
 	else if (cmdMode.getValue() == TEXT("auto_scale"))
 		mode = Waifu2x::eWaifu2xModelTypeAutoScale;
 
-	Waifu2x::eWaifu2xError ret;
-	Waifu2x w;
+	const boost::filesystem::path trace_path(cmdTraceFile.getValue());
+	if (!trace_path.empty())
+	{
+		cTrace::Enable();
+		cTrace::SetThreadName("main");
+	}
+
+	Waifu2x::SetCPUAutoTune(cmdCPUAutoTune.getValue() == 1);
+	Waifu2x::SetTileSkipThreshold(cmdTileSkipThreshold.getValue());
+	Waifu2x::SetTiffStreamRows(cmdTiffStreamRows.getValue());
+	Waifu2x::SetNpyPlanar(cmdNpyPlanar.getValue() == 1);
+	Waifu2x::SetReducedDecode(cmdReducedDecode.getValue() == 1);
+
+	{
+		stImage::eEncodePreset preset = stImage::eEncodePresetDefault;
+		if (cmdEncodePreset.getValue() == TEXT("fast"))
+			preset = stImage::eEncodePresetFast;
+		else if (cmdEncodePreset.getValue() == TEXT("balanced"))
+			preset = stImage::eEncodePresetBalanced;
+		else if (cmdEncodePreset.getValue() == TEXT("small"))
+			preset = stImage::eEncodePresetSmall;
+
+		stImage::stEncodeOption option = stImage::GetEncodePreset(preset);
+		if (cmdJpegSampling.getValue() == TEXT("420"))
+			option.jpeg_sampling = stImage::eJpegSampling420;
+		else if (cmdJpegSampling.getValue() == TEXT("422"))
+			option.jpeg_sampling = stImage::eJpegSampling422;
+		else if (cmdJpegSampling.getValue() == TEXT("444"))
+			option.jpeg_sampling = stImage::eJpegSampling444;
+
+		// ÂOpenCVł͎włȂ̂ŁAقĖɒm点(Wo͂̓f[[hŌʂԂ̂ɎĝŕWG[o͂ɕ\)
+		if (option.jpeg_sampling != stImage::eJpegSamplingDefault && !stImage::IsJpegSamplingSupported())
+		{
+			tfprintf(stderr, TEXT("x: ̃rhOpenCVJPEG̐F̊ԈwłȂ(4.5.5ȍ~Kv)̂ŁA--jpeg_sampling͖܂\n"));
+			option.jpeg_sampling = stImage::eJpegSamplingDefault;
+		}
+
+		stImage::SetEncodeOption(option);
+	}
+
+	if (cmdFsync.getValue() == TEXT("file"))
+		cWriterPool::SetFsyncPolicy(cWriterPool::eFsyncPolicyFile);
+	else if (cmdFsync.getValue() == TEXT("dir"))
+		cWriterPool::SetFsyncPolicy(cWriterPool::eFsyncPolicyFileAndDir);
+	cWriterPool::SetDirectIO(cmdDirectIO.getValue() == 1);
+
+	// [J[ƂɃlbg(1ڂ̓[J[gȂꍇɂg)
+	// Xbh̏w肳Ă΃[J[̐Ɏ߂
+	// f[[hł͗DxƂɃlbg(Dx̒ႢWurŏĂÃlbg̏Ԃ󂳂Ȃ悤)
+	int worker_num = (std::max)(cmdWorkers.getValue(), 1);
+	if (is_daemon)
+		worker_num = cJobScheduler::ePriorityNum;
+	else if (cmdThreads.getValue() > 0)
+		worker_num = (std::min)(worker_num, cmdThreads.getValue());
+
+	// CPU̎̓Xbh̏ɍ킹čŝInit()Oɐݒ肷
+	// --threads[J[1ȂAOpenCVOpenBLAS̃Xbh(OPENBLAS_NUM_THREADSȂ)ɂ͐GȂ
+	if (cmdThreads.isSet() || worker_num > 1)
+		Waifu2x::SetThreadBudget(cmdThreads.getValue(), worker_num);
+
+	// 傫ԉ摜͈ꎞt@C}bv̈ɒuAȂĂfBXN̑ŏ𑱂悤ɂ
+	if (cmdScratchDir.isSet())
+		cMatAllocator::Enable(cmdScratchDir.getValue(), (size_t)(std::max)(cmdScratchThreshold.getValue(), 1) * 1024 * 1024);
+
+	// x擪珇ɓǂݏ傫obt@̓q[Wy[WɒuATLB~X炷
+	if (cmdHugePages.getValue() == TEXT("thp"))
+		cMatAllocator::SetHugePages(cMatAllocator::eHugePageModeTransparent, (size_t)(std::max)(cmdHugePageThreshold.getValue(), 0) * 1024 * 1024);
+	else if (cmdHugePages.getValue() == TEXT("explicit"))
+		cMatAllocator::SetHugePages(cMatAllocator::eHugePageModeExplicit, (size_t)(std::max)(cmdHugePageThreshold.getValue(), 0) * 1024 * 1024);
+
+	// ɏ摜̓\ZɎ܂邾ɂ(܂Ȃ摜͑̉摜I܂ő҂)
+	cMemoryBudget::SetLimit((size_t)(std::max)(cmdMemoryBudget.getValue(), 0) * 1024 * 1024);
+
+	std::vector<std::unique_ptr<Waifu2x>> workerList;
+	for (int i = 0; i < worker_num; i++)
+		workerList.emplace_back(new Waifu2x);
+
+	Waifu2x &w = *workerList[0];
 
 #ifdef WIN_UNICODE
 	std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> cv;
@@ -443,29 +701,111 @@ int main(int argc, char** argv)
 	const std::string sProcess = cmdProcess.getValue();
 #endif
 
-	ret = w.Init(mode, cmdNRLevel.getValue(), cmdModelPath.getValue(), sProcess, cmdGPUNoFile.getValue());
-	switch (ret)
+	// [J[gꍇ́Albg̏d݂Ɨp̃[J[NUMAm[hɊmۂ悤Ƀ[J[̃XbhInit()
+	const bool use_scheduler = !is_daemon && (worker_num > 1 || cmdNuma.getValue() == 1);
+
+	std::vector<Waifu2x::eWaifu2xError> initRetList(worker_num, Waifu2x::eWaifu2xError_OK);
+	const auto InitWorker = [&](const int worker_no)
 	{
-	case Waifu2x::eWaifu2xError_InvalidParameter:
-		tprintf(TEXT("G[: p[^sł\n"));
-		return 1;
-	case Waifu2x::eWaifu2xError_FailedOpenModelFile:
-		tprintf(TEXT("G[: ft@CJ܂ł\n"));
-		return 1;
-	case Waifu2x::eWaifu2xError_FailedParseModelFile:
-		tprintf(TEXT("G[: ft@CĂ܂\n"));
-		return 1;
-	case Waifu2x::eWaifu2xError_FailedConstructModel:
-		tprintf(TEXT("G[: lbg[N̍\zɎs܂\n"));
-		return 1;
+		initRetList[worker_no] = workerList[worker_no]->Init(mode, cmdNRLevel.getValue(), cmdModelPath.getValue(), sProcess, cmdGPUNoFile.getValue());
+	};
+
+	std::unique_ptr<cTileScheduler> scheduler;
+	if (use_scheduler)
+	{
+		// Init()O𓊂ꍇcTileScheduler̃RXgN^瓊
+		try
+		{
+			scheduler.reset(new cTileScheduler(worker_num, cmdNuma.getValue() == 1, InitWorker));
+		}
+		catch (...)
+		{
+			std::fill(initRetList.begin(), initRetList.end(), Waifu2x::eWaifu2xError_FailedConstructModel);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < worker_num; i++)
+			InitWorker(i);
 	}
 
+	for (const auto ret : initRetList)
+	{
+		switch (ret)
+		{
+		case Waifu2x::eWaifu2xError_InvalidParameter:
+			tprintf(TEXT("G[: p[^sł\n"));
+			return 1;
+		case Waifu2x::eWaifu2xError_FailedOpenModelFile:
+			tprintf(TEXT("G[: ft@CJ܂ł\n"));
+			return 1;
+		case Waifu2x::eWaifu2xError_FailedParseModelFile:
+			tprintf(TEXT("G[: ft@CĂ܂\n"));
+			return 1;
+		case Waifu2x::eWaifu2xError_FailedConstructModel:
+			tprintf(TEXT("G[: lbg[N̍\zɎs܂\n"));
+			return 1;
+		}
+	}
+
+	int batch_size = cmdBatchSizeFile.getValue();
+
+	// TCYƃob`TCYw肳ĂȂCPU̎ʂg
+	{
+		int tune_crop_size = 0, tune_batch_size = 0, tune_threads = 0;
+		if (w.GetCPUTuneParam(tune_crop_size, tune_batch_size, tune_threads))
+		{
+			if (!cmdCropSizeFile.isSet() && !cmdCropWidth.isSet())
+				crop_w = tune_crop_size;
+			if (!cmdCropSizeFile.isSet() && !cmdCropHeight.isSet())
+				crop_h = tune_crop_size;
+			if (!cmdBatchSizeFile.isSet())
+				batch_size = tune_batch_size;
+		}
+	}
+
+	if (cmdReportLoadTime.getValue() == 1)
+	{
+		const auto &t = w.GetLoadTime();
+
+		const TCHAR *loadPath = TEXT("protobin");
+		if (t.path == Waifu2x::eWaifu2xModelLoadPath_Prototxt)
+			loadPath = TEXT("prototxt");
+		else if (t.path == Waifu2x::eWaifu2xModelLoadPath_Json)
+			loadPath = TEXT("json");
+
+		tprintf(TEXT("f̓ǂݍݎ: v %.3fb (ǂݍݕ@ %s, info.json %.3fb,  %.3fb, \z %.3fb, d݂̃Rs[ %.3fb, o %.3fb)\n"),
+			t.total, loadPath, t.info, t.parse, t.construct, t.weight_copy, t.write);
+	}
+
+	const boost::filesystem::path metrics_path(cmdMetricsFile.getValue());
+	if (!metrics_path.empty())
+		cMetrics::StartExporter(metrics_path, cmdMetricsInterval.getValue());
+
 	bool isError = false;
-	for (const auto &p : file_paths)
+	std::mutex printMutex;
+
+	// f[[hł͌ʂԂƂɏo̓t@CłĂKv̂ŁA݂͔񓯊ɂȂ
+	if (!is_daemon && cmdWriterThreads.getValue() > 0)
+	{
+		cWriterPool::SetErrorFunc([&isError, &printMutex](const boost::filesystem::path &path)
+		{
+			std::lock_guard<std::mutex> lock(printMutex);
+
+			tprintf(TEXT("G[: o͉摜u%sv߂܂ł\n"), path_to_tstring(path).c_str());
+			isError = true;
+		});
+		cWriterPool::Start(cmdWriterThreads.getValue(), cmdWriterQueue.getValue());
+	}
+
+	const auto ProcessFile = [&](Waifu2x &w, const std::pair<tstring, tstring> &p)
 	{
 		const Waifu2x::eWaifu2xError ret = w.waifu2x(p.first, p.second, ScaleRatio, ScaleWidth, ScaleHeight, nullptr,
 			crop_w, crop_h,
-			cmdOutputQuality.getValue() == -1 ? boost::optional<int>() : cmdOutputQuality.getValue(), cmdOutputDepth.getValue(), use_tta, cmdBatchSizeFile.getValue());
+			cmdOutputQuality.getValue() == -1 ? boost::optional<int>() : cmdOutputQuality.getValue(), cmdOutputDepth.getValue(), use_tta, batch_size);
+
+		std::lock_guard<std::mutex> lock(printMutex);
+
 		if (ret != Waifu2x::eWaifu2xError_OK)
 		{
 			switch (ret)
@@ -486,6 +826,408 @@ int main(int argc, char** argv)
 
 			isError = true;
 		}
+		else if (cmdReportMemory.getValue() == 1)
+		{
+			const auto &usage = w.GetPeakMemoryUsage();
+			const auto &estimate = w.GetEstimatedMemoryUsage();
+			const auto ToMB = [](const size_t size) { return (double)size / (1024.0 * 1024.0); };
+
+			tprintf(TEXT("gpʂ̃s[Nu%sv: v %.1fMB (摜 %.1fMB, blob %.1fMB, o̓obt@ %.1fMB, im2colobt@() %.1fMB), O̐ %.1fMB\n"),
+				p.first.c_str(), ToMB(usage.total), ToMB(usage.image), ToMB(usage.net_blob), ToMB(usage.output_block), ToMB(usage.col_buffer), ToMB(estimate.total));
+		}
+	};
+
+	if (is_daemon)
+	{
+		// 1s1JSONŃNGXg󂯎AÎ1s1JSONŌʂԂ
+		// {"id": "1", "input": "in.png", "output": "out.png", "priority": "interactive", "deadline_ms": 500}
+		cJobScheduler jobScheduler;
+
+		const auto PrintResponse = [&printMutex](const std::string &id, const Waifu2x::eWaifu2xError ret, const cJobScheduler::stJobResult *result, const bool coalesced)
+		{
+			rapidjson::StringBuffer buf;
+			rapidjson::Writer<rapidjson::StringBuffer, rapidjson::UTF8<>, rapidjson::ASCII<>> writer(buf);
+
+			writer.StartObject();
+			writer.String("id");
+			writer.String(id.c_str(), (rapidjson::SizeType)id.length());
+			writer.String("status");
+			writer.String(ret == Waifu2x::eWaifu2xError_OK ? "ok" : "error");
+			writer.String("error");
+			writer.String(Waifu2x::GetErrorName(ret));
+			if (result)
+			{
+				writer.String("queue_ms");
+				writer.Double(result->queue_time * 1000.0);
+				writer.String("run_ms");
+				writer.Double(result->run_time * 1000.0);
+				writer.String("yield_ms");
+				writer.Double(result->yield_time * 1000.0);
+				writer.String("deadline_missed");
+				writer.Bool(result->deadline_missed);
+			}
+			writer.String("coalesced");
+			writer.Bool(coalesced);
+			writer.EndObject();
+
+			std::lock_guard<std::mutex> lock(printMutex);
+			tprintf(CHAR_STR_FORMAT TEXT("\n"), buf.GetString());
+			fflush(stdout);
+		};
+
+		const auto ToPath = [&](const std::string &str) -> boost::filesystem::path
+		{
+#ifdef WIN_UNICODE
+			return cv.from_bytes(str);
+#else
+			return str;
+#endif
+		};
+
+		const boost::optional<int> output_quality = cmdOutputQuality.getValue() == -1 ? boost::optional<int>() : cmdOutputQuality.getValue();
+
+		// ͉摜̓eƐݒ肪NGXgȂAVɂ̌ʂL
+		// (LbVɓ摜ւ̃NGXg܂Ƃ߂ė邱Ƃ)
+		struct stRequest
+		{
+			std::string id;
+			boost::filesystem::path input_file;
+			boost::filesystem::path output_file;
+			cJobScheduler::ePriority priority;
+			bool has_deadline;
+			cJobScheduler::TimePoint deadline;
+			std::chrono::steady_clock::time_point receive_time;
+			boost::optional<double> scaleRatio;
+			boost::optional<int> scaleWidth;
+			boost::optional<int> scaleHeight;
+			std::string file_id; // ͉摜̃pXƍXV(ȂeŜ̃nbVׂɓ摜Ƃ݂Ȃ)
+		};
+
+		std::mutex coalesceMutex;
+		std::map<std::string, std::vector<stRequest>> inFlightMap; // ̃NGXg̃L[ƁA肵NGXg
+
+		// 󂯕t̃XbhōL[B͉摜̃TCYƐ擪ẼubÑnbV(FNV-1a)ƁANGXgƂɕςݒ肩
+		// eŜ̃nbV͑傫摜Ǝ󂯕t~߂Ă܂̂ŁAł͌vZȂ(肵ɏXbhŊm߂)
+		// o͌`͊gqŌ܂̂Ŋgq܂߂BDẍႤNGXg͂܂Ƃ߂Ȃ(Dx̋t]NȂ悤)
+		// ǂ߂Ȃ΋󕶎
+		const auto MakeCoalesceKey = [](stRequest &req) -> std::string
+		{
+			boost::system::error_code ec;
+
+			const boost::filesystem::path path = boost::filesystem::canonical(req.input_file, ec);
+			if (ec)
+				return std::string();
+
+			const auto mtime = boost::filesystem::last_write_time(path, ec);
+			if (ec)
+				return std::string();
+
+			boost::filesystem::ifstream ifs(path, std::ios::binary);
+			if (!ifs)
+				return std::string();
+
+			const auto size = (uint64_t)ifs.seekg(0, std::ios::end).tellg();
+
+			const uint64_t BlockSize = 64 * 1024;
+			std::vector<char> buf(BlockSize);
+
+			uint64_t hash = 14695981039346656037ULL;
+			const auto HashBlock = [&](const uint64_t pos)
+			{
+				ifs.clear();
+				ifs.seekg(pos);
+				ifs.read(buf.data(), (std::streamsize)(std::min)(BlockSize, size - pos));
+
+				const auto n = ifs.gcount();
+				for (std::streamsize i = 0; i < n; i++)
+				{
+					hash ^= (uint8_t)buf[i];
+					hash *= 1099511628211ULL;
+				}
+			};
+
+			HashBlock(0);
+			if (size > BlockSize)
+				HashBlock((std::max)(size - BlockSize, BlockSize));
+
+			std::string ext = req.output_file.extension().string();
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+			char key[256];
+			sprintf(key, "%016llx %llu %d %.6f %d %d ", (unsigned long long)hash, (unsigned long long)size, (int)req.priority,
+				req.scaleRatio ? *req.scaleRatio : 0.0, req.scaleWidth ? *req.scaleWidth : 0, req.scaleHeight ? *req.scaleHeight : 0);
+
+			// pXׂ͔邾Ȃ̂ŁAR[hϊɂ̂܂܂̃oCgg
+			const auto &native = path.native();
+			req.file_id = std::to_string((long long)mtime) + " " + std::string((const char *)native.data(), native.size() * sizeof(native[0]));
+
+			return key + ext;
+		};
+
+		// ͉摜̓eŜ̃nbV(FNV-1a)Bǂ߂Ȃfalse
+		const auto HashFile = [](const boost::filesystem::path &input_file, uint64_t &hash) -> bool
+		{
+			boost::filesystem::ifstream ifs(input_file, std::ios::binary);
+			if (!ifs)
+				return false;
+
+			hash = 14695981039346656037ULL;
+
+			std::vector<char> buf(64 * 1024);
+			while (ifs.read(buf.data(), buf.size()) || ifs.gcount() > 0)
+			{
+				const auto n = ifs.gcount();
+				for (std::streamsize i = 0; i < n; i++)
+				{
+					hash ^= (uint8_t)buf[i];
+					hash *= 1099511628211ULL;
+				}
+			}
+
+			return !ifs.bad();
+		};
+
+		// reqWuǉBkeyłȂ΁AIƂɑ肵NGXgɂʂԂ
+		std::function<void(const stRequest &req, const std::string &key)> PushRequest;
+		PushRequest = [&](const stRequest &req, const std::string &key)
+		{
+			const auto ret = std::make_shared<Waifu2x::eWaifu2xError>(Waifu2x::eWaifu2xError_OK);
+
+			jobScheduler.Push(req.priority, req.has_deadline ? &req.deadline : nullptr,
+				[&, ret, req](const cJobScheduler::Checkpoint &checkpoint)
+			{
+				*ret = workerList[req.priority]->waifu2x(req.input_file, req.output_file, req.scaleRatio, req.scaleWidth, req.scaleHeight, checkpoint,
+					crop_w, crop_h, output_quality, cmdOutputDepth.getValue(), use_tta, batch_size);
+			},
+				[&, ret, req, key](const cJobScheduler::stJobResult &result)
+			{
+				if (key.empty())
+				{
+					PrintResponse(req.id, *ret, &result, false);
+					return;
+				}
+
+				std::vector<stRequest> followers;
+				{
+					std::lock_guard<std::mutex> lock(coalesceMutex);
+
+					const auto it = inFlightMap.find(key);
+					followers = std::move(it->second);
+					inFlightMap.erase(it);
+				}
+
+				// L[͐擪ƖĂȂ̂ŁA͉摜̃pXXVႦΓeŜ̃nbVׂ
+				// (̃Xbh̓WuXbhȂ̂ŁA󂯕t͎~܂Ȃ)
+				bool isLeaderHashed = false;
+				bool isLeaderHashOK = false;
+				uint64_t leaderHash = 0;
+
+				std::vector<stRequest> sameList;
+				std::vector<stRequest> differentList;
+				for (const auto &f : followers)
+				{
+					bool isSame = f.file_id == req.file_id;
+					if (!isSame)
+					{
+						if (!isLeaderHashed)
+						{
+							isLeaderHashOK = HashFile(req.input_file, leaderHash);
+							isLeaderHashed = true;
+						}
+
+						uint64_t hash = 0;
+						isSame = isLeaderHashOK && HashFile(f.input_file, hash) && hash == leaderHash;
+					}
+
+					if (isSame)
+						sameList.push_back(f);
+					else
+						differentList.push_back(f);
+				}
+
+				// 肵NGXgɂ͏o͉摜Rs[ēʂԂ
+				// ɕԎƁA󂯎Rs[̏IOɏo͉摜菑肷邩Ȃ̂ŁASăRs[ĂԂ
+				std::vector<Waifu2x::eWaifu2xError> fretList;
+				for (const auto &f : sameList)
+				{
+					Waifu2x::eWaifu2xError fret = *ret;
+					if (fret == Waifu2x::eWaifu2xError_OK && f.output_file != req.output_file)
+					{
+						boost::system::error_code ec;
+						boost::filesystem::copy_file(req.output_file, f.output_file, boost::filesystem::copy_option::overwrite_if_exists, ec);
+						if (ec)
+							fret = Waifu2x::eWaifu2xError_FailedOpenOutputFile;
+					}
+
+					fretList.push_back(fret);
+				}
+
+				PrintResponse(req.id, *ret, &result, false);
+
+				const auto now = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < sameList.size(); i++)
+				{
+					const auto &f = sameList[i];
+					const Waifu2x::eWaifu2xError fret = fretList[i];
+
+					cJobScheduler::stJobResult fresult;
+					fresult.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(now - f.receive_time).count();
+					fresult.run_time = 0.0;
+					fresult.yield_time = 0.0;
+					fresult.deadline_missed = f.has_deadline && now > f.deadline;
+
+					PrintResponse(f.id, fret, &fresult, true);
+				}
+
+				// eNGXg͑肹ɏ
+				for (const auto &f : differentList)
+					PushRequest(f, std::string());
+			});
+		};
+
+		std::string line;
+		while (std::getline(std::cin, line))
+		{
+			// ߐ؂͎󂯎Ԃ琔
+			const auto receive_time = std::chrono::steady_clock::now();
+
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (line.empty())
+				continue;
+
+			rapidjson::Document d;
+			d.Parse(line.c_str());
+
+			std::string id;
+			if (!d.HasParseError() && d.IsObject() && d.HasMember("id") && d["id"].IsString())
+				id = d["id"].GetString();
+
+			if (d.HasParseError() || !d.IsObject() || !d.HasMember("input") || !d["input"].IsString() || !d.HasMember("output") || !d["output"].IsString())
+			{
+				PrintResponse(id, Waifu2x::eWaifu2xError_InvalidParameter, nullptr, false);
+				continue;
+			}
+
+			cJobScheduler::ePriority priority = cJobScheduler::ePriorityNormal;
+			if (d.HasMember("priority") && (!d["priority"].IsString() || !cJobScheduler::ParsePriority(d["priority"].GetString(), priority)))
+			{
+				PrintResponse(id, Waifu2x::eWaifu2xError_InvalidParameter, nullptr, false);
+				continue;
+			}
+
+			bool has_deadline = false;
+			cJobScheduler::TimePoint deadline;
+			if (d.HasMember("deadline_ms") && d["deadline_ms"].IsNumber())
+			{
+				// ̒l傫l̓}CNbɕϊƈ̂Ŏ󂯕tȂ
+				const double MaxDeadlineMs = 7.0 * 24 * 60 * 60 * 1000;
+				const double deadline_ms = d["deadline_ms"].GetDouble();
+				if (!std::isfinite(deadline_ms) || deadline_ms < 0.0 || deadline_ms > MaxDeadlineMs)
+				{
+					PrintResponse(id, Waifu2x::eWaifu2xError_InvalidParameter, nullptr, false);
+					continue;
+				}
+
+				has_deadline = true;
+				deadline = receive_time + std::chrono::microseconds((int64_t)(deadline_ms * 1000.0));
+			}
+
+			// g嗦̓NGXgŎw肳Ă΂g
+			boost::optional<double> scaleRatio = ScaleRatio;
+			boost::optional<int> scaleWidth = ScaleWidth;
+			boost::optional<int> scaleHeight = ScaleHeight;
+			if (d.HasMember("scale_ratio") && d["scale_ratio"].IsNumber())
+			{
+				scaleRatio = d["scale_ratio"].GetDouble();
+				scaleWidth = boost::none;
+				scaleHeight = boost::none;
+			}
+			else if ((d.HasMember("scale_width") && d["scale_width"].IsInt()) || (d.HasMember("scale_height") && d["scale_height"].IsInt()))
+			{
+				scaleRatio = boost::none;
+				scaleWidth = boost::none;
+				scaleHeight = boost::none;
+				if (d.HasMember("scale_width") && d["scale_width"].IsInt() && d["scale_width"].GetInt() > 0)
+					scaleWidth = d["scale_width"].GetInt();
+				if (d.HasMember("scale_height") && d["scale_height"].IsInt() && d["scale_height"].GetInt() > 0)
+					scaleHeight = d["scale_height"].GetInt();
+			}
+
+			stRequest req;
+			req.id = id;
+			req.input_file = ToPath(d["input"].GetString());
+			req.output_file = ToPath(d["output"].GetString());
+			req.priority = priority;
+			req.has_deadline = has_deadline;
+			req.deadline = deadline;
+			req.receive_time = receive_time;
+			req.scaleRatio = scaleRatio;
+			req.scaleWidth = scaleWidth;
+			req.scaleHeight = scaleHeight;
+
+			const std::string key = MakeCoalesceKey(req);
+			if (!key.empty())
+			{
+				std::lock_guard<std::mutex> lock(coalesceMutex);
+
+				const auto it = inFlightMap.find(key);
+				if (it != inFlightMap.end())
+				{
+					it->second.push_back(req);
+					cMetrics::Increment("waifu2x_coalesced_requests_total");
+					continue;
+				}
+
+				inFlightMap[key];
+			}
+
+			PushRequest(req, key);
+		}
+
+		jobScheduler.WaitAll();
+	}
+	else if (!scheduler)
+	{
+		for (const auto &p : file_paths)
+			ProcessFile(w, p);
+	}
+	else
+	{
+		// 摜[J[ɐU蕪A傫摜̃^C͋󂢂Ă郏[J[ɂ
+		for (int i = 0; i < worker_num; i++)
+			workerList[i]->SetTileScheduler(scheduler.get(), i);
+
+		for (const auto &p : file_paths)
+		{
+			scheduler->PushJob([&workerList, &ProcessFile, &p](const int worker_no)
+			{
+				ProcessFile(*workerList[worker_no], p);
+			});
+		}
+
+		scheduler->WaitJobs();
+
+		for (auto &worker : workerList)
+			worker->SetTileScheduler(nullptr, -1);
+	}
+
+	// ݑ҂̏o͂Sď(st@CErrorFuncŕ\ς)
+	const size_t writeErrorNum = cWriterPool::Stop();
+	if (writeErrorNum > 0)
+	{
+		tprintf(TEXT("G[: %d̏o͉摜߂܂ł\n"), (int)writeErrorNum);
+		isError = true;
+	}
+
+	if (!trace_path.empty() && !cTrace::Save(trace_path))
+		tprintf(TEXT("G[: g[Xt@Cu%sv߂܂ł\n"), path_to_tstring(trace_path).c_str());
+
+	if (!metrics_path.empty())
+	{
+		cMetrics::StopExporter();
+		if (!cMetrics::WritePrometheusFile(metrics_path))
+			tprintf(TEXT("G[: gNXt@Cu%sv߂܂ł\n"), path_to_tstring(metrics_path).c_str());
 	}
 
 	if (isError)
@@ -494,7 +1236,8 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	tprintf(TEXT("ϊɐ܂\n"));
+	if (!is_daemon)
+		tprintf(TEXT("ϊɐ܂\n"));
 
 	Waifu2x::quit_liblary();
 